@@ -65,9 +65,15 @@
  *       - removed another gtk_file_selector, fixed breakage on gtk-2.6
  *       - added invert to recolour functions
  * 1.1.9 - fix longstanding deprecated Gtk problems
+ *       - added parallel processing in worker gimp-consoles
+ *       - overlap reading and writing files with processing
+ *       - skip output files which are up to date, using a manifest
  */
 
 #include "gui.h"
+#include "worker.h"
+
+#include <string.h>
 
 #include <libintl.h>
 #define _(String) gettext(String)
@@ -110,6 +116,24 @@ query() {
       "<Toolbox>/Xtns/Batch Process...",
       NULL, GIMP_EXTENSION,
       n_args, n_return_vals, args, return_vals);
+
+  static GimpParamDef workerArgs[] = {
+    { GIMP_PDB_INT32, mode, desc },
+    { GIMP_PDB_STRING, g_strdup("settings"), g_strdup("Settings file") },
+    { GIMP_PDB_STRING, g_strdup("files"), g_strdup("File with the list of images, one per line") },
+    { GIMP_PDB_STRING, g_strdup("results"), g_strdup("File to append the results to") }
+  };
+  static int n_worker_args = sizeof(workerArgs) / sizeof(workerArgs[0]);
+
+  gimp_install_procedure(WORKER_NAME,
+      "Processes a share of a DBP batch",
+      "Used by DBP to run a batch in several processes at once, not meant to be called otherwise.",
+      "David Hodson <hodsond@acm.org>",
+      "2001 - 2008 David Hodson",
+      "16 Dec 2008 (Version 1.1.9)",
+      NULL,
+      NULL, GIMP_PLUGIN,
+      n_worker_args, n_return_vals, workerArgs, return_vals);
 }
 
 static void
@@ -119,13 +143,30 @@ run (const gchar* name,
      gint* nreturn_vals,
      GimpParam** return_vals)
 {
-  GimpParam values;
+  static GimpParam values;
 
   *return_vals = &values;
   *nreturn_vals = 1;
   values.type = GIMP_PDB_STATUS;
   values.data.d_status = GIMP_PDB_SUCCESS;
 
+  // the load and save stages have threads of their own
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  if (! g_thread_supported()) {
+    g_thread_init(0);
+  }
+#endif
+
+  if (strcmp(name, WORKER_NAME) == 0) {
+    if (nparams != 4) {
+      values.data.d_status = GIMP_PDB_CALLING_ERROR;
+    } else if (! Dbp::WorkerPool::runWorker(param[1].data.d_string,
+        param[2].data.d_string, param[3].data.d_string)) {
+      values.data.d_status = GIMP_PDB_EXECUTION_ERROR;
+    }
+    return;
+  }
+
   GimpRunMode run_mode = (GimpRunMode)param[0].data.d_int32;
   switch (run_mode) {
   case GIMP_RUN_INTERACTIVE:
@@ -1127,8 +1127,13 @@ OutputGui::selectOption() {
 }
 
 
+// how often to look at the workers, in milliseconds
+static const guint workerPollInterval = 250;
+
 DbpGui::DbpGui(DbpData& data, std::string name):
   _data(data),
+  _idleProcess(0),
+  _usingWorkers(false),
   _name(name) {
 }
 
@@ -1198,6 +1203,9 @@ DbpGui::build() {
   connect(gtkSignal(_show, "toggled", &DbpGui::show, this));
   gtk_box_pack_end(GTK_BOX(hbox), _show, FALSE, FALSE, 0);
 
+  _parallel = Gui::stdToggle(_("Use All Processors"));
+  gtk_box_pack_end(GTK_BOX(hbox), _parallel, FALSE, FALSE, 0);
+
   setBusy(false);
 
   gtk_widget_show_all(dialog);
@@ -1267,16 +1275,52 @@ DbpGui::start() {
     return;
   }
 
+  // skip the files DBP has already done, with these settings
+  InputOp::FileList files = _data.filesToProcess(_data._input._files);
+  if (files.empty()) {
+    gtk_label_set_text(GTK_LABEL(_messageText), _("-- all output files are up to date --"));
+    return;
+  }
+
   setBusy(true);
-  _data.start(_data._input._files);
+
+  // the workers' images can't be shown here
+  bool show = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(_show));
+  bool parallel = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(_parallel));
+  if (parallel && !show) {
+    // one worker would only add the time to start it
+    int numWorkers = WorkerPool::numWorkers(files);
+    if ((numWorkers > 1) &&
+        _pool.start(_data, files, numWorkers)) {
+      _usingWorkers = true;
+      _idleProcess = g_timeout_add(workerPollInterval, &idleProcess, this);
+      return;
+    }
+  }
+
+  _usingWorkers = false;
+  _data.start(files);
   _idleProcess = g_idle_add(&idleProcess, this);
 }
 
 bool
 DbpGui::step() {
+  if (_usingWorkers) {
+    return workerStep();
+  }
   if (_data.done()) {
-    gtk_label_set_text(GTK_LABEL(_messageText), _("-- done --"));
+    _data.takeResults();
+    Location stoppedAt;
+    if (_data.stopped(stoppedAt)) {
+      gchar* message = g_strdup_printf(_("-- stopped at %s --"),
+        stoppedAt.fullPath().c_str());
+      gtk_label_set_text(GTK_LABEL(_messageText), message);
+      g_free(message);
+    } else {
+      gtk_label_set_text(GTK_LABEL(_messageText), _("-- done --"));
+    }
     setBusy(false);
+    _idleProcess = 0;
     return false;
   }
   gtk_label_set_text(GTK_LABEL(_messageText), _data.current().fullPath().c_str());
@@ -1285,12 +1329,88 @@ DbpGui::step() {
   return true;
 }
 
+bool
+DbpGui::workerStep() {
+  _pool.poll();
+  gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(_progress), _pool.progress());
+
+  if (_pool.done()) {
+    const InputOp::FileList& failed = _pool.failed();
+    if (failed.empty()) {
+      gtk_label_set_text(GTK_LABEL(_messageText), _("-- done --"));
+    } else {
+      gchar* message = g_strdup_printf(_("-- done, %d of %d failed --"),
+        (int)failed.size(), _pool.numFiles());
+      gtk_label_set_text(GTK_LABEL(_messageText), message);
+      g_free(message);
+    }
+    setBusy(false);
+    _usingWorkers = false;
+    _idleProcess = 0;
+    if (! failed.empty()) {
+      showFailed(failed);
+    }
+    return false;
+  }
+
+  gchar* message = g_strdup_printf(_("%d of %d files, %d workers"),
+    _pool.numFinished(), _pool.numFiles(), _pool.numRunning());
+  gtk_label_set_text(GTK_LABEL(_messageText), message);
+  g_free(message);
+  return true;
+}
+
+// the whole list, in a list view like the input files
+void
+DbpGui::showFailed(const InputOp::FileList& failed) {
+  GtkWidget* dialog = gimp_dialog_new(
+    _("Failed Files"),
+    _name.c_str(),
+    0, GTK_DIALOG_MODAL, 0, 0,
+    GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE,
+    (char*)0); // to fix gcc compiler warning - may be an error on 64 bit processors
+  gtk_window_set_default_size(GTK_WINDOW(dialog), 400, 300);
+
+  GtkWidget* scroll = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(
+    GTK_SCROLLED_WINDOW(scroll), GTK_POLICY_AUTOMATIC, GTK_POLICY_ALWAYS);
+  gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), scroll, TRUE, TRUE, 0);
+
+  GtkListStore* list = gtk_list_store_new(1, G_TYPE_STRING);
+  InputOp::FileList::const_iterator iter = failed.begin();
+  while (iter != failed.end()) {
+    GtkTreeIter row;
+    gtk_list_store_append(list, &row);
+    gtk_list_store_set(list, &row, 0, (*iter).fullPath().c_str(), -1);
+    ++iter;
+  }
+  GtkWidget* view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(list));
+  g_object_unref(list);
+  GtkCellRenderer* renderer =
+    gtk_cell_renderer_text_new();
+  GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(
+    _("Images"), renderer,
+    "text", 0,
+    (char*)0); // to fix gcc compiler warning - may be an error on 64 bit processors
+  gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
+  gtk_scrolled_window_add_with_viewport(
+    GTK_SCROLLED_WINDOW(scroll), view);
+
+  gtk_widget_show_all(dialog);
+  gtk_dialog_run(GTK_DIALOG(dialog));
+  gtk_widget_destroy(dialog);
+}
+
 void
 DbpGui::cancel() {
   if (_idleProcess != 0) {
     g_source_remove(_idleProcess);
     _idleProcess = 0;
   }
+  if (_usingWorkers) {
+    _pool.cancel();
+    _usingWorkers = false;
+  }
   setBusy(false);
 }
 
@@ -24,6 +24,7 @@
 #include <string>
 
 #include "op.h"
+#include "worker.h"
 
 namespace Dbp {
 
@@ -333,10 +334,16 @@ private:
   GtkWidget* _start;
   GtkWidget* _cancel;
   GtkWidget* _show;
+  GtkWidget* _parallel;
 
   gint _idleProcess;
   bool _done;
 
+  WorkerPool _pool;
+  bool _usingWorkers;
+  bool workerStep();
+  void showFailed(const InputOp::FileList& failed);
+
   std::string _name;
 
   void add(const std::string& label, Gui* gui);
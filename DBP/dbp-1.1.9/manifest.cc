@@ -0,0 +1,261 @@
+/* DBP (Dave's Batch Processor)
+ * A simple batch processor for the GIMP
+ * Copyright (C) 2001 - 2008 David Hodson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "manifest.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+using namespace Dbp;
+
+// a line is output, input, size, mtime, checksum and settings,
+// separated by tabs, with tabs and newlines in the paths escaped
+static const int numFields = 6;
+
+static const int checksumBufferSize = 256 * 1024;
+
+// in place of the checksum, for an output announced but not recorded
+static const char* announced = "-";
+
+static std::string
+escaped(const std::string& s) {
+  gchar* e = g_strescape(s.c_str(), 0);
+  std::string result(e);
+  g_free(e);
+  return result;
+}
+
+static std::string
+unescaped(const gchar* s) {
+  gchar* u = g_strcompress(s);
+  std::string result(u);
+  g_free(u);
+  return result;
+}
+
+Manifest::Manifest(const std::string& fileName):
+  _fileName(fileName),
+  _log(0) {
+}
+
+Manifest::~Manifest() {
+  if (_log) {
+    fclose(_log);
+  }
+}
+
+void
+Manifest::load() {
+  if (_log) {
+    fclose(_log);
+    _log = 0;
+  }
+  _entries.clear();
+
+  gchar* contents = 0;
+  if (g_file_get_contents(_fileName.c_str(), &contents, 0, 0)) {
+    gchar** lines = g_strsplit(contents, "\n", -1);
+    for (gchar** l = lines; *l; ++l) {
+      gchar** fields = g_strsplit(*l, "\t", numFields);
+      // a line cut short by a crash is just dropped
+      if (g_strv_length(fields) == (guint)numFields) {
+        Entry entry;
+        entry._input = unescaped(fields[1]);
+        entry._size = g_ascii_strtoll(fields[2], 0, 10);
+        entry._mtime = g_ascii_strtoll(fields[3], 0, 10);
+        entry._checksum = fields[4];
+        entry._settings = fields[5];
+        if (entry._input.empty()) {
+          // forgotten
+          _entries.erase(unescaped(fields[0]));
+        } else {
+          _entries[unescaped(fields[0])] = entry;
+        }
+      }
+      g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+
+  // write it back without the lines that have been replaced
+  std::string compacted;
+  Entries::const_iterator iter = _entries.begin();
+  while (iter != _entries.end()) {
+    compacted += line((*iter).first, (*iter).second);
+    ++iter;
+  }
+  std::string temp = _fileName + ".new";
+  if (g_file_set_contents(temp.c_str(), compacted.c_str(), compacted.length(), 0)) {
+#ifdef G_OS_WIN32
+    // won't rename over an existing file
+    g_remove(_fileName.c_str());
+#endif
+    g_rename(temp.c_str(), _fileName.c_str());
+  }
+}
+
+Manifest::State
+Manifest::check(
+  const std::string& input, const std::string& output, const std::string& settings) {
+
+  struct stat info;
+  if (stat(output.c_str(), &info) != 0) {
+    return MISSING;
+  }
+  Entries::iterator iter = _entries.find(output);
+  if (iter == _entries.end()) {
+    return FOREIGN;
+  }
+  Entry& entry = (*iter).second;
+  if ((entry._input != input) || (entry._settings != settings) ||
+      (entry._checksum == announced)) {
+    return STALE;
+  }
+
+  Entry now;
+  if (! describe(input, now)) {
+    return STALE;
+  }
+  if ((now._size == entry._size) && (now._mtime == entry._mtime)) {
+    return UP_TO_DATE;
+  }
+  // only read the file if it might not have changed
+  if ((now._size != entry._size) || (checksum(input) != entry._checksum)) {
+    return STALE;
+  }
+  // touched, but the same - remember the new time, to save reading it again
+  if (settled(now._mtime)) {
+    entry._mtime = now._mtime;
+    append(output, entry);
+  }
+  return UP_TO_DATE;
+}
+
+void
+Manifest::record(
+  const std::string& input, const std::string& output, const std::string& settings) {
+
+  Entry entry;
+  if (! describe(input, entry)) {
+    return;
+  }
+  entry._input = input;
+  entry._checksum = checksum(input);
+  entry._settings = settings;
+  if (! settled(entry._mtime)) {
+    // no time matches, so check() reads the checksum
+    entry._mtime = 0;
+  }
+  _entries[output] = entry;
+  append(output, entry);
+}
+
+void
+Manifest::announce(
+  const std::string& input, const std::string& output, const std::string& settings) {
+
+  Entry entry;
+  entry._input = input;
+  entry._size = 0;
+  entry._mtime = 0;
+  entry._checksum = announced;
+  entry._settings = settings;
+  _entries[output] = entry;
+  append(output, entry);
+}
+
+void
+Manifest::forget(const std::string& output) {
+  if (_entries.erase(output) == 0) {
+    return;
+  }
+  Entry entry;
+  entry._size = 0;
+  entry._mtime = 0;
+  entry._checksum = announced;
+  append(output, entry);
+}
+
+void
+Manifest::append(const std::string& output, const Entry& entry) {
+  if (! _log) {
+    _log = g_fopen(_fileName.c_str(), "ab");
+    if (! _log) {
+      return;
+    }
+  }
+  // in one write, the workers append to the same file
+  std::string text = line(output, entry);
+  fwrite(text.c_str(), 1, text.length(), _log);
+  fflush(_log);
+}
+
+// size and modification time only, the checksum takes a while
+bool
+Manifest::describe(const std::string& input, Entry& entry) {
+  struct stat info;
+  if (stat(input.c_str(), &info) != 0) {
+    return false;
+  }
+  entry._size = info.st_size;
+  entry._mtime = info.st_mtime;
+  return true;
+}
+
+// Times are in seconds, so a change later in the second an input was
+// described in wouldn't show; its time is only trusted a second later.
+bool
+Manifest::settled(gint64 mtime) {
+  return mtime < (gint64)time(0) - 1;
+}
+
+std::string
+Manifest::checksum(const std::string& fileName) {
+  std::string result;
+  FILE* file = g_fopen(fileName.c_str(), "rb");
+  if (! file) {
+    return result;
+  }
+  GChecksum* sum = g_checksum_new(G_CHECKSUM_SHA1);
+  guchar* buffer = new guchar[checksumBufferSize];
+  size_t n;
+  while ((n = fread(buffer, 1, checksumBufferSize, file)) > 0) {
+    g_checksum_update(sum, buffer, n);
+  }
+  if (! ferror(file)) {
+    result = g_checksum_get_string(sum);
+  }
+  delete[] buffer;
+  g_checksum_free(sum);
+  fclose(file);
+  return result;
+}
+
+std::string
+Manifest::line(const std::string& output, const Entry& entry) {
+  gchar* numbers = g_strdup_printf("%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT,
+    entry._size, entry._mtime);
+  std::string result = escaped(output) + "\t" + escaped(entry._input) + "\t" +
+    numbers + "\t" + entry._checksum + "\t" + entry._settings + "\n";
+  g_free(numbers);
+  return result;
+}
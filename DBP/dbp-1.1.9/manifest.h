@@ -0,0 +1,91 @@
+/* DBP (Dave's Batch Processor)
+ * A simple batch processor for the GIMP
+ * Copyright (C) 2001 - 2008 David Hodson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _DBP_MANIFEST_H_
+#define _DBP_MANIFEST_H_
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <glib.h>
+
+namespace Dbp {
+
+// What DBP made each output file from: the input's path, size,
+// modification time and checksum, and a checksum of the settings.
+//
+// The file is a log, a line per output appended as each one is
+// finished, so it's up to date even if DBP or Gimp crashes half way
+// through. Later lines win; load() writes it back with one line each.
+// The workers only append to it.
+//
+// An output is announced before it's written, so that one left by a
+// crash between writing it and recording it is still known as DBP's,
+// and is made again rather than refused as foreign.
+class Manifest {
+
+public:
+
+  Manifest(const std::string& fileName);
+  ~Manifest();
+
+  void load();
+
+  enum State {
+    MISSING,    // no output file
+    UP_TO_DATE, // made by DBP, from this input and these settings
+    STALE,      // made by DBP, but something has changed
+    FOREIGN     // not made by DBP, leave it alone
+  };
+  State check(const std::string& input, const std::string& output,
+    const std::string& settings);
+
+  void record(const std::string& input, const std::string& output,
+    const std::string& settings);
+  // about to write output, which is missing or DBP's
+  void announce(const std::string& input, const std::string& output,
+    const std::string& settings);
+  // output wasn't written after all, it isn't DBP's
+  void forget(const std::string& output);
+
+private:
+
+  struct Entry {
+    std::string _input;
+    gint64 _size;
+    gint64 _mtime;
+    std::string _checksum;
+    std::string _settings;
+  };
+  typedef std::map<std::string, Entry> Entries;
+
+  std::string _fileName;
+  Entries _entries;
+  FILE* _log;
+
+  void append(const std::string& output, const Entry&);
+  static bool describe(const std::string& input, Entry&);
+  static bool settled(gint64 mtime);
+  static std::string checksum(const std::string& fileName);
+  static std::string line(const std::string& output, const Entry&);
+};
+
+} // namespace Dbp
+
+#endif // _DBP_MANIFEST_H_
@@ -18,10 +18,24 @@
  */
 
 #include "op.h"
+#include "pipeline.h"
+#include "manifest.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// files read ahead of the one being processed
+static const int readAheadFiles = 2;
+// saved files waiting to be moved into place
+static const int writeBehindFiles = 2;
 
 using namespace Dbp;
 
@@ -92,6 +106,16 @@ Op::Op(): _enabled(false) {
 Op::~Op() {
 }
 
+void
+Op::save(GKeyFile* keys, const char* group) const {
+  g_key_file_set_boolean(keys, group, "enabled", _enabled);
+}
+
+void
+Op::load(GKeyFile* keys, const char* group) {
+  _enabled = g_key_file_get_boolean(keys, group, "enabled", 0);
+}
+
 Filter::Filter(const std::string& gimpFnName):
   _gimpFnName(gimpFnName) {
 }
@@ -163,6 +187,18 @@ TurnOp::execute(int& image, int& drawableId, Location& file) {
   return true;
 }
 
+void
+TurnOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_integer(keys, group, "turn", _turn);
+}
+
+void
+TurnOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _turn = g_key_file_get_integer(keys, group, "turn", 0);
+}
+
 BlurOp::BlurOp():
   Filter("plug_in_gauss_iir"),
   _radius(1.0) {
@@ -175,6 +211,18 @@ BlurOp::addParams(GimpCall& call) {
   call.param(TRUE);
 }
 
+void
+BlurOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_double(keys, group, "radius", _radius);
+}
+
+void
+BlurOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _radius = g_key_file_get_double(keys, group, "radius", 0);
+}
+
 RecolourOp::RecolourOp():
   _auto(false), _brightness(0.0), _contrast(0.0),
   _saturation(1.0), _gamma(1.0), _invert(false), _mono(false) {
@@ -217,6 +265,30 @@ RecolourOp::execute(int& image, int& drawableId, Location&) {
   return true;
 }
 
+void
+RecolourOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_boolean(keys, group, "auto", _auto);
+  g_key_file_set_double(keys, group, "brightness", _brightness);
+  g_key_file_set_double(keys, group, "contrast", _contrast);
+  g_key_file_set_double(keys, group, "saturation", _saturation);
+  g_key_file_set_double(keys, group, "gamma", _gamma);
+  g_key_file_set_boolean(keys, group, "invert", _invert);
+  g_key_file_set_boolean(keys, group, "mono", _mono);
+}
+
+void
+RecolourOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _auto = g_key_file_get_boolean(keys, group, "auto", 0);
+  _brightness = g_key_file_get_double(keys, group, "brightness", 0);
+  _contrast = g_key_file_get_double(keys, group, "contrast", 0);
+  _saturation = g_key_file_get_double(keys, group, "saturation", 0);
+  _gamma = g_key_file_get_double(keys, group, "gamma", 0);
+  _invert = g_key_file_get_boolean(keys, group, "invert", 0);
+  _mono = g_key_file_get_boolean(keys, group, "mono", 0);
+}
+
 ResizeOp::ResizeOp():
   _relative(true),
   _keepAspect(true),
@@ -304,6 +376,30 @@ ResizeOp::execute(int& image, int& drawableId, Location&) {
   return result;
 }
 
+void
+ResizeOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_boolean(keys, group, "relative", _relative);
+  g_key_file_set_boolean(keys, group, "keepAspect", _keepAspect);
+  g_key_file_set_double(keys, group, "xScale", _xScale);
+  g_key_file_set_double(keys, group, "yScale", _yScale);
+  g_key_file_set_integer(keys, group, "xSize", _xSize);
+  g_key_file_set_integer(keys, group, "ySize", _ySize);
+  g_key_file_set_integer(keys, group, "fit", _fit);
+}
+
+void
+ResizeOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _relative = g_key_file_get_boolean(keys, group, "relative", 0);
+  _keepAspect = g_key_file_get_boolean(keys, group, "keepAspect", 0);
+  _xScale = g_key_file_get_double(keys, group, "xScale", 0);
+  _yScale = g_key_file_get_double(keys, group, "yScale", 0);
+  _xSize = g_key_file_get_integer(keys, group, "xSize", 0);
+  _ySize = g_key_file_get_integer(keys, group, "ySize", 0);
+  _fit = (FitOptions)g_key_file_get_integer(keys, group, "fit", 0);
+}
+
 CropOp::CropOp():
   _width(1), _height(1), _x(0), _y(0) {
 }
@@ -325,6 +421,24 @@ CropOp::execute(int& image, int& drawableId, Location& file) {
   return result;  
 }
 
+void
+CropOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_integer(keys, group, "width", _width);
+  g_key_file_set_integer(keys, group, "height", _height);
+  g_key_file_set_integer(keys, group, "x", _x);
+  g_key_file_set_integer(keys, group, "y", _y);
+}
+
+void
+CropOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _width = g_key_file_get_integer(keys, group, "width", 0);
+  _height = g_key_file_get_integer(keys, group, "height", 0);
+  _x = g_key_file_get_integer(keys, group, "x", 0);
+  _y = g_key_file_get_integer(keys, group, "y", 0);
+}
+
 SharpenOp::SharpenOp():
   Filter("plug_in_unsharp_mask"),
   _radius(1.0), _amount(1.0), _threshhold(0.0) {
@@ -351,6 +465,22 @@ SharpenOp::addParams(GimpCall& call) {
 #endif
 }
 
+void
+SharpenOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_double(keys, group, "radius", _radius);
+  g_key_file_set_double(keys, group, "amount", _amount);
+  g_key_file_set_double(keys, group, "threshhold", _threshhold);
+}
+
+void
+SharpenOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _radius = g_key_file_get_double(keys, group, "radius", 0);
+  _amount = g_key_file_get_double(keys, group, "amount", 0);
+  _threshhold = g_key_file_get_double(keys, group, "threshhold", 0);
+}
+
 RenameOp::RenameOp():
 //  _numericRename(false),
   _flatten(false),
@@ -396,6 +526,43 @@ RenameOp::modify(Location& file) const {
 //  }
 }
 
+void
+RenameOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_string(keys, group, "dirPath", _dirPath.c_str());
+  g_key_file_set_string(keys, group, "prefix", _prefix.c_str());
+  g_key_file_set_string(keys, group, "postfix", _postfix.c_str());
+  g_key_file_set_boolean(keys, group, "flatten", _flatten);
+  g_key_file_set_boolean(keys, group, "convertToGreyscale", _convertToGreyscale);
+  g_key_file_set_boolean(keys, group, "convertToIndexed", _convertToIndexed);
+  g_key_file_set_integer(keys, group, "ditherType", _ditherType);
+  g_key_file_set_integer(keys, group, "numberOfIndexedColours", _numberOfIndexedColours);
+}
+
+static std::string
+keyString(GKeyFile* keys, const char* group, const char* key) {
+  std::string result;
+  gchar* value = g_key_file_get_string(keys, group, key, 0);
+  if (value) {
+    result = value;
+    g_free(value);
+  }
+  return result;
+}
+
+void
+RenameOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  _dirPath = keyString(keys, group, "dirPath");
+  _prefix = keyString(keys, group, "prefix");
+  _postfix = keyString(keys, group, "postfix");
+  _flatten = g_key_file_get_boolean(keys, group, "flatten", 0);
+  _convertToGreyscale = g_key_file_get_boolean(keys, group, "convertToGreyscale", 0);
+  _convertToIndexed = g_key_file_get_boolean(keys, group, "convertToIndexed", 0);
+  _ditherType = g_key_file_get_integer(keys, group, "ditherType", 0);
+  _numberOfIndexedColours = g_key_file_get_integer(keys, group, "numberOfIndexedColours", 0);
+}
+
 OutputFormat::OutputFormat(int tag, std::string name, std::string extn, std::string fn):
   _tag(tag),
   _name(name),
@@ -588,7 +755,11 @@ OutputOp::execute(int& image, int& drawableId, Location& file) {
   if (fileExists(outputPath)) {
     return false;
   }
+  return save(image, drawableId, outputPath);
+}
 
+bool
+OutputOp::save(int image, int drawableId, const std::string& outputPath) {
   OutputFormat& format = _format[_selection];
   GimpCall call(format._functionName);
   call.param(GIMP_RUN_NONINTERACTIVE);
@@ -608,6 +779,67 @@ OutputOp::execute(int& image, int& drawableId, Location& file) {
   return result;
 }
 
+// only the parameters of the selected format are saved
+void
+OutputOp::save(GKeyFile* keys, const char* group) const {
+  Op::save(keys, group);
+  g_key_file_set_integer(keys, group, "format", _selection);
+  const OutputFormat& format = _format[_selection];
+  int numParams = format._params.size();
+  for (int i = 0; i < numParams; ++i) {
+    const OpParam& param = format._params[i];
+    gchar key[32];
+    g_snprintf(key, sizeof(key), "param%d", i);
+    switch (param._gimpType.type) {
+    case GIMP_PDB_INT32:
+      g_key_file_set_integer(keys, group, key, param._gimpType.data.d_int32);
+      break;
+    case GIMP_PDB_FLOAT:
+      g_key_file_set_double(keys, group, key, param._gimpType.data.d_float);
+      break;
+    case GIMP_PDB_STRING:
+      g_key_file_set_string(keys, group, key, param._string.c_str());
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void
+OutputOp::load(GKeyFile* keys, const char* group) {
+  Op::load(keys, group);
+  int selection = g_key_file_get_integer(keys, group, "format", 0);
+  if ((selection < 0) || (selection >= (int)_format.size())) {
+    return;
+  }
+  _selection = selection;
+  OutputFormat& format = _format[_selection];
+  int numParams = format._params.size();
+  for (int i = 0; i < numParams; ++i) {
+    OpParam& param = format._params[i];
+    gchar key[32];
+    g_snprintf(key, sizeof(key), "param%d", i);
+    if (! g_key_file_has_key(keys, group, key, 0)) {
+      continue;
+    }
+    switch (param._gimpType.type) {
+    case GIMP_PDB_INT32:
+      param._gimpType.data.d_int32 = g_key_file_get_integer(keys, group, key, 0);
+      break;
+    case GIMP_PDB_FLOAT:
+      param._gimpType.data.d_float = g_key_file_get_double(keys, group, key, 0);
+      break;
+    case GIMP_PDB_STRING:
+      param._string = keyString(keys, group, key);
+      param._gimpType.data.d_string = (gchar*)(param._string.c_str());
+      break;
+    default:
+      break;
+    }
+  }
+}
+
 std::string
 OutputOp::outputFileName(Location file) {
   file._extn = _format[_selection]._fileExtension;
@@ -625,14 +857,25 @@ DbpData::DbpData():
   _current(_files.end()),
   _fileNum(0),
   _test(false),
+  _stopOnError(true),
   _done(false),
   _display(-1),
   _image(-1),
-  _drawable(-1) {
+  _drawable(-1),
+  _stopped(false),
+  _readAhead(0),
+  _writeBehind(0),
+  _manifest(0) {
 }
 
 DbpData::~DbpData() {
   removeDisplay();
+  delete _readAhead;
+  delete _writeBehind;
+  delete _manifest;
+  if (! _staging.empty()) {
+    g_remove(_staging.c_str());
+  }
 }
 
 void
@@ -647,14 +890,33 @@ DbpData::removeDisplay() {
   }
 }
 
+Manifest&
+DbpData::manifest() {
+  if (_manifest == 0) {
+    gchar* fileName = gimp_personal_rc_file("dbp-manifest");
+    _manifest = new Manifest(fileName);
+    g_free(fileName);
+  }
+  return *_manifest;
+}
+
+std::string
+DbpData::outputPath(const Location& file) {
+  Location output = file;
+  _rename.modify(output);
+  return _output.outputFileName(output);
+}
+
+// existing files that DBP made may be brought up to date
 int
 DbpData::numExistingOutputFiles(const InputOp::FileList& files) {
+  manifest().load();
+  std::string settings = settingsDigest();
   int n = 0;
   InputOp::FileList::const_iterator iter = files.begin();
   while (iter != files.end()) {
-    Location file = *iter;
-    _rename.modify(file);
-    if (_output.fileExists(_output.outputFileName(file))) {
+    if (manifest().check((*iter).fullPath(), outputPath(*iter), settings) ==
+        Manifest::FOREIGN) {
       ++n;
     }
     ++iter;
@@ -662,18 +924,136 @@ DbpData::numExistingOutputFiles(const InputOp::FileList& files) {
   return n;
 }
 
+InputOp::FileList
+DbpData::filesToProcess(const InputOp::FileList& files) {
+  std::string settings = settingsDigest();
+  _replaceable.clear();
+  InputOp::FileList result;
+  InputOp::FileList::const_iterator iter = files.begin();
+  while (iter != files.end()) {
+    std::string output = outputPath(*iter);
+    switch (manifest().check((*iter).fullPath(), output, settings)) {
+    case Manifest::UP_TO_DATE:
+      break;
+    case Manifest::STALE:
+      // DBP made it, so DBP can replace it - once the new one is saved
+      _replaceable.insert((*iter).fullPath());
+      result.push_back(*iter);
+      break;
+    case Manifest::MISSING:
+    case Manifest::FOREIGN:
+      // OutputOp won't overwrite a foreign file, it fails as before
+      result.push_back(*iter);
+      break;
+    }
+    ++iter;
+  }
+  return result;
+}
+
+bool
+DbpData::mayReplace(const Location& file) const {
+  return _replaceable.count(file.fullPath()) > 0;
+}
+
 void
-DbpData::start(InputOp::FileList& files) {
+DbpData::allowReplace(const Location& file) {
+  _replaceable.insert(file.fullPath());
+}
+
+GKeyFile*
+DbpData::settings() const {
+  GKeyFile* keys = g_key_file_new();
+  _turn.save(keys, "Turn");
+  _blur.save(keys, "Blur");
+  _recolour.save(keys, "Colour");
+  _resize.save(keys, "Resize");
+  _crop.save(keys, "Crop");
+  _sharpen.save(keys, "Sharpen");
+  _rename.save(keys, "Rename");
+  _output.save(keys, "Output");
+  return keys;
+}
+
+std::string
+DbpData::settingsDigest() const {
+  GKeyFile* keys = settings();
+  gsize length = 0;
+  gchar* data = g_key_file_to_data(keys, &length, 0);
+  gchar* digest = g_compute_checksum_for_string(G_CHECKSUM_SHA1, data, length);
+  std::string result(digest);
+  g_free(digest);
+  g_free(data);
+  g_key_file_free(keys);
+  return result;
+}
+
+bool
+DbpData::saveSettings(const std::string& fileName) const {
+  GKeyFile* keys = settings();
+  gsize length = 0;
+  gchar* data = g_key_file_to_data(keys, &length, 0);
+  bool ok = g_file_set_contents(fileName.c_str(), data, length, 0);
+  g_free(data);
+  g_key_file_free(keys);
+  return ok;
+}
+
+bool
+DbpData::loadSettings(const std::string& fileName) {
+  GKeyFile* keys = g_key_file_new();
+  bool ok = g_key_file_load_from_file(keys, fileName.c_str(), G_KEY_FILE_NONE, 0);
+  if (ok) {
+    _turn.load(keys, "Turn");
+    _blur.load(keys, "Blur");
+    _recolour.load(keys, "Colour");
+    _resize.load(keys, "Resize");
+    _crop.load(keys, "Crop");
+    _sharpen.load(keys, "Sharpen");
+    _rename.load(keys, "Rename");
+    _output.load(keys, "Output");
+  }
+  g_key_file_free(keys);
+  return ok;
+}
+
+void
+DbpData::start(InputOp::FileList& files, bool stopOnError) {
   _done = false;
   _files = files;
   _current = _files.begin();
   _fileNum = 0;
   _stage = DoInput;
   _test = false;
+  _stopOnError = stopOnError;
+  finishOutput();
+  _results.clear();
+  _stopped = false;
+  _settingsDigest = settingsDigest();
   if (_current == _files.end()) {
     _done = true;
-  } else {
-    _location = *_current;
+    return;
+  }
+  _location = *_current;
+
+  if (_readAhead == 0) {
+    _readAhead = new ReadAhead(readAheadFiles);
+  }
+  _readAhead->start(_files);
+
+  // the staging files go in the temporary directory, which is
+  // usually local, whatever the output directory is
+  if (_staging.empty()) {
+    gchar* name = 0;
+    int fd = g_file_open_tmp("dbp-XXXXXX", &name, 0);
+    if (fd != -1) {
+      close(fd);
+      _staging = name;
+      g_free(name);
+    }
+  }
+  if (! _staging.empty() && (_writeBehind == 0)) {
+    _writeBehind = new WriteBehind(writeBehindFiles);
   }
 }
 
@@ -685,6 +1065,8 @@ DbpData::start(Location file) {
   _fileNum = 0;
   _stage = DoInput;
   _test = true;
+  finishOutput();
+  _results.clear();
   _location = file;
 }
 
@@ -704,6 +1086,9 @@ DbpData::step() {
     {
       int oldImage = _image;
       ++_fileNum;
+      if (! _test) {
+        _readAhead->advance();
+      }
       ok = _input.execute(_image, _drawable, _location);
       if (ok && _visible) {
         // rename, to protect original image file
@@ -758,13 +1143,9 @@ DbpData::step() {
     }
     break;
   case DoOutput:
-    ok = _output.execute(_image, _drawable, _location);
-    _stage = DoInput;
-    ++_current;
-    if (_current == _files.end()) {
-      _done = true;
-    } else {
-      _location = *_current;
+    ok = output();
+    if (ok) {
+      nextFile();
     }
     break;
   }
@@ -774,12 +1155,145 @@ DbpData::step() {
   gimp_displays_flush();
 
   if (!ok) {
-    // stop if something goes wrong
-    // need error reporting...
+    if (_test) {
+      // stop if something goes wrong
+      _done = true;
+    } else {
+      if (_stopOnError) {
+        // the files saved before this one go first
+        finishOutput();
+      }
+      record(*_current, false);
+      nextFile();
+    }
+  }
+
+  if (! _test) {
+    collectMoved();
+    if (_done) {
+      // the last files may still be on their way
+      finishOutput();
+      _readAhead->stop();
+    }
+  }
+}
+
+// Saves the current image. If there's a staging file the save goes
+// there, and the file is moved into place while the next image is
+// processed. Its result is recorded when the move is done. An out of
+// date output is only replaced by a complete new one.
+bool
+DbpData::output() {
+  bool replace = mayReplace(*_current);
+  std::string outputPath = _output.outputFileName(_location);
+  if (! replace && _output.fileExists(outputPath)) {
+    // don't overwrite files!
+    return false;
+  }
+  manifest().announce((*_current).fullPath(), outputPath, _settingsDigest);
+
+  if ((_writeBehind == 0) || _staging.empty()) {
+    bool ok;
+    if (replace) {
+      std::string newPath = outputPath + ".new";
+      ok = _output.save(_image, _drawable, newPath) &&
+        WriteBehind::move(newPath, outputPath, true);
+      if (! ok) {
+        g_remove(newPath.c_str());
+      }
+    } else {
+      ok = _output.execute(_image, _drawable, _location);
+    }
+    if (ok) {
+      record(*_current, true);
+    }
+    return ok;
+  }
+
+  gchar* suffix = g_strdup_printf(".%d.", _fileNum);
+  std::string stagingPath = _staging + suffix +
+    _output._format[_output._selection]._fileExtension;
+  g_free(suffix);
+  if (! _output.save(_image, _drawable, stagingPath)) {
+    g_remove(stagingPath.c_str());
+    return false;
+  }
+  _writeBehind->put(stagingPath, outputPath, *_current, replace);
+  return true;
+}
+
+void
+DbpData::record(const Location& file, bool ok) {
+  if (ok) {
+    manifest().record(file.fullPath(), outputPath(file), _settingsDigest);
+  } else if (! mayReplace(file)) {
+    // it was announced, but whatever is there now isn't DBP's
+    manifest().forget(outputPath(file));
+  }
+  Result result;
+  result._file = file;
+  result._ok = ok;
+  _results.push_back(result);
+  if (!ok && _stopOnError) {
+    // the moves still queued come after this, but it's where it stopped
+    if (! _stopped) {
+      _stopped = true;
+      _stoppedAt = file;
+    }
     _done = true;
   }
 }
 
+void
+DbpData::nextFile() {
+  if (_done) {
+    return;
+  }
+  _stage = DoInput;
+  ++_current;
+  if (_current == _files.end()) {
+    _done = true;
+  } else {
+    _location = *_current;
+  }
+}
+
+void
+DbpData::collectMoved() {
+  if (_writeBehind == 0) {
+    return;
+  }
+  Location file;
+  bool ok;
+  while (_writeBehind->takeFinished(file, ok)) {
+    record(file, ok);
+  }
+}
+
+void
+DbpData::finishOutput() {
+  if (_writeBehind == 0) {
+    return;
+  }
+  _writeBehind->finish();
+  collectMoved();
+}
+
+DbpData::Results
+DbpData::takeResults() {
+  Results results;
+  results.swap(_results);
+  return results;
+}
+
+bool
+DbpData::stopped(Location& file) const {
+  if (_stopped) {
+    file = _stoppedAt;
+  }
+  return _stopped;
+}
+
 Location
 DbpData::current() const {
   Location loc;
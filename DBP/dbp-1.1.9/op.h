@@ -22,6 +22,7 @@
 
 #include <string>
 #include <list>
+#include <set>
 #include <vector>
 #include "gimpCall.h"
 
@@ -59,6 +60,10 @@ public:
   virtual bool execute(
     int& image, int& drawableId, Location& file) = 0;
 
+  // settings, for the worker processes
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
+
   bool _enabled;
 };
 
@@ -91,12 +96,17 @@ struct TurnOp: public Dbp::Op {
   virtual bool execute(
     int& image, int& drawableId, Location& file);
 
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
+
   enum { TURN_90 = 0, TURN_180 = 1, TURN_270 = 2 };
   int _turn;
 };
 
 struct BlurOp: public Dbp::Filter {
   BlurOp();
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   float _radius;     /* range 1.0 to 100.0, default 1.0, minStep 0.1 */
 
@@ -108,6 +118,8 @@ struct RecolourOp: public Dbp::Op {
   RecolourOp();
   virtual bool execute(
     int& image, int& drawableId, Location& file);
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   bool _auto;
 
@@ -124,6 +136,8 @@ struct ResizeOp: public Dbp::Op {
   ResizeOp();
   virtual bool execute(
     int& image, int& drawableId, Location& file);
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   bool _relative;
 
@@ -142,6 +156,8 @@ struct CropOp: public Dbp::Op {
 
   virtual bool execute(
     int& image, int& drawableId, Location& file);
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   int _width;
   int _height;
@@ -151,6 +167,8 @@ struct CropOp: public Dbp::Op {
 
 struct SharpenOp: public Dbp::Filter {
   SharpenOp();
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   float _radius;
   float _amount;
@@ -164,6 +182,8 @@ struct RenameOp: public Dbp::Op {
   RenameOp();
   virtual bool execute(
     int& image, int& drawableId, Location& file);
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   void modify(Location&) const;
   std::string _dirPath;
@@ -215,14 +235,22 @@ struct OutputOp: public Dbp::Op {
   OutputOp();
   virtual bool execute(
     int& image, int& drawableId, Location& file);
+  virtual void save(GKeyFile*, const char* group) const;
+  virtual void load(GKeyFile*, const char* group);
 
   std::string outputFileName(Location file);
   bool fileExists(const std::string& fileName);
+  // save without checking, for a file that is moved into place later
+  bool save(int image, int drawableId, const std::string& outputPath);
 
   std::vector<OutputFormat> _format;
   int _selection;
 };
 
+class ReadAhead;
+class WriteBehind;
+class Manifest;
+
 struct DbpData {
   DbpData();
   ~DbpData();
@@ -237,9 +265,23 @@ struct DbpData {
   RenameOp _rename;
   OutputOp _output;
 
+  // output files which are in the way, ie. which DBP didn't make
   int numExistingOutputFiles(const InputOp::FileList& files);
+  // the files whose outputs are missing or out of date; the out of
+  // date outputs are replaced as the new ones are saved
+  InputOp::FileList filesToProcess(const InputOp::FileList& files);
+  // whether the output of a file may replace an out of date one, and
+  // for the workers, which don't call filesToProcess, to say so
+  bool mayReplace(const Location& file) const;
+  void allowReplace(const Location& file);
+  // all settings except the file list
+  bool saveSettings(const std::string& fileName) const;
+  bool loadSettings(const std::string& fileName);
+  // checksum of the settings, for the manifest
+  std::string settingsDigest() const;
   // process and output several files
-  void start(InputOp::FileList& files);
+  // if stopOnError is false, a file which fails is skipped
+  void start(InputOp::FileList& files, bool stopOnError = true);
   // process (but don't output) a single file
   void start(Location file);
 
@@ -249,6 +291,16 @@ struct DbpData {
   Location current() const;
   float progress() const;
 
+  // the files finished since the last call, and whether they succeeded
+  struct Result {
+    Location _file;
+    bool _ok;
+  };
+  typedef std::list<Result> Results;
+  Results takeResults();
+  // the file a run which stops on errors stopped at, if it did
+  bool stopped(Location& file) const;
+
   void setVisible(bool);
   bool visible() const;
 
@@ -261,11 +313,37 @@ private:
   InputOp::FileList::iterator _current;
   int _fileNum;
   bool _test;
+  bool _stopOnError;
   bool _done;
   int _display;
   int _image;
   int _drawable;
   Location _location;
+  Results _results;
+  bool _stopped;
+  Location _stoppedAt;
+
+  // the load and save stages, see pipeline.h
+  ReadAhead* _readAhead;
+  WriteBehind* _writeBehind;
+  // files are saved to this name plus a number and moved into place
+  std::string _staging;
+
+  // what made each output, see manifest.h
+  Manifest* _manifest;
+  std::string _settingsDigest;
+  Manifest& manifest();
+  // the files whose outputs are out of date, by input path
+  std::set<std::string> _replaceable;
+
+  std::string outputPath(const Location& file);
+  GKeyFile* settings() const;
+
+  bool output();
+  void record(const Location& file, bool ok);
+  void nextFile();
+  void collectMoved();
+  void finishOutput();
 
   enum {
     DoInput, DoTurn, DoBlur, DoRecolour, DoResize, DoCrop,
@@ -0,0 +1,316 @@
+/* DBP (Dave's Batch Processor)
+ * A simple batch processor for the GIMP
+ * Copyright (C) 2001 - 2008 David Hodson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+using namespace Dbp;
+
+static const int copyBufferSize = 256 * 1024;
+
+// the thread api changed in glib 2.32
+static GMutex*
+newMutex() {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+  GMutex* mutex = g_new(GMutex, 1);
+  g_mutex_init(mutex);
+  return mutex;
+#else
+  return g_mutex_new();
+#endif
+}
+
+static void
+freeMutex(GMutex* mutex) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+  g_mutex_clear(mutex);
+  g_free(mutex);
+#else
+  g_mutex_free(mutex);
+#endif
+}
+
+static GCond*
+newCond() {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+  GCond* cond = g_new(GCond, 1);
+  g_cond_init(cond);
+  return cond;
+#else
+  return g_cond_new();
+#endif
+}
+
+static void
+freeCond(GCond* cond) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+  g_cond_clear(cond);
+  g_free(cond);
+#else
+  g_cond_free(cond);
+#endif
+}
+
+static GThread*
+newThread(GThreadFunc fn, gpointer data) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+  return g_thread_try_new("dbp", fn, data, 0);
+#else
+  return g_thread_create(fn, data, TRUE, 0);
+#endif
+}
+
+static bool
+exists(const std::string& fileName) {
+  struct stat foo;
+  return (stat(fileName.c_str(), &foo) == 0);
+}
+
+ReadAhead::ReadAhead(int depth):
+  _depth(depth),
+  _next(_files.end()),
+  _numTaken(0),
+  _numRead(0),
+  _stop(false),
+  _mutex(newMutex()),
+  _cond(newCond()),
+  _thread(0) {
+}
+
+ReadAhead::~ReadAhead() {
+  stop();
+  freeCond(_cond);
+  freeMutex(_mutex);
+}
+
+void
+ReadAhead::start(const InputOp::FileList& files) {
+  stop();
+  _files = files;
+  _next = _files.begin();
+  _numTaken = 0;
+  _numRead = 0;
+  _stop = false;
+  // without a thread the loader just reads the files itself
+  _thread = newThread(&ReadAhead::run, this);
+}
+
+void
+ReadAhead::advance() {
+  g_mutex_lock(_mutex);
+  ++_numTaken;
+  g_cond_broadcast(_cond);
+  g_mutex_unlock(_mutex);
+}
+
+void
+ReadAhead::stop() {
+  if (_thread == 0) {
+    return;
+  }
+  g_mutex_lock(_mutex);
+  _stop = true;
+  g_cond_broadcast(_cond);
+  g_mutex_unlock(_mutex);
+  g_thread_join(_thread);
+  _thread = 0;
+}
+
+// reads each file through once, the data itself is thrown away
+gpointer
+ReadAhead::run(gpointer data) {
+  ReadAhead* self = static_cast<ReadAhead*>(data);
+  char* buffer = new char[copyBufferSize];
+
+  g_mutex_lock(self->_mutex);
+  while (!self->_stop && (self->_next != self->_files.end())) {
+    if (self->_numRead >= self->_numTaken + self->_depth) {
+      g_cond_wait(self->_cond, self->_mutex);
+      continue;
+    }
+    std::string path = (*self->_next).fullPath();
+    ++self->_next;
+    ++self->_numRead;
+    g_mutex_unlock(self->_mutex);
+
+    FILE* file = g_fopen(path.c_str(), "rb");
+    if (file) {
+      while (fread(buffer, 1, copyBufferSize, file) == (size_t)copyBufferSize) {
+      }
+      fclose(file);
+    }
+
+    g_mutex_lock(self->_mutex);
+  }
+  g_mutex_unlock(self->_mutex);
+
+  delete[] buffer;
+  return 0;
+}
+
+WriteBehind::WriteBehind(int depth):
+  _depth(depth),
+  _moving(false),
+  _stop(false),
+  _mutex(newMutex()),
+  _cond(newCond()),
+  _thread(0) {
+  _thread = newThread(&WriteBehind::run, this);
+}
+
+WriteBehind::~WriteBehind() {
+  if (_thread != 0) {
+    finish();
+    g_mutex_lock(_mutex);
+    _stop = true;
+    g_cond_broadcast(_cond);
+    g_mutex_unlock(_mutex);
+    g_thread_join(_thread);
+  }
+  freeCond(_cond);
+  freeMutex(_mutex);
+}
+
+void
+WriteBehind::put(const std::string& from, const std::string& to, const Location& file,
+  bool overwrite) {
+  Move move;
+  move._from = from;
+  move._to = to;
+  move._file = file;
+  move._overwrite = overwrite;
+
+  if (_thread == 0) {
+    // no thread, do it now
+    bool ok = WriteBehind::move(from, to, overwrite);
+    _finished.push_back(std::make_pair(file, ok));
+    return;
+  }
+
+  g_mutex_lock(_mutex);
+  while ((int)_queue.size() >= _depth) {
+    g_cond_wait(_cond, _mutex);
+  }
+  _queue.push_back(move);
+  g_cond_broadcast(_cond);
+  g_mutex_unlock(_mutex);
+}
+
+bool
+WriteBehind::takeFinished(Location& file, bool& ok) {
+  g_mutex_lock(_mutex);
+  bool any = !_finished.empty();
+  if (any) {
+    file = _finished.front().first;
+    ok = _finished.front().second;
+    _finished.pop_front();
+  }
+  g_mutex_unlock(_mutex);
+  return any;
+}
+
+void
+WriteBehind::finish() {
+  g_mutex_lock(_mutex);
+  while (!_queue.empty() || _moving) {
+    g_cond_wait(_cond, _mutex);
+  }
+  g_mutex_unlock(_mutex);
+}
+
+gpointer
+WriteBehind::run(gpointer data) {
+  WriteBehind* self = static_cast<WriteBehind*>(data);
+
+  g_mutex_lock(self->_mutex);
+  while (true) {
+    if (self->_queue.empty()) {
+      if (self->_stop) {
+        break;
+      }
+      g_cond_wait(self->_cond, self->_mutex);
+      continue;
+    }
+    Move next = self->_queue.front();
+    self->_queue.pop_front();
+    self->_moving = true;
+    g_cond_broadcast(self->_cond);
+    g_mutex_unlock(self->_mutex);
+
+    bool ok = move(next._from, next._to, next._overwrite);
+
+    g_mutex_lock(self->_mutex);
+    self->_finished.push_back(std::make_pair(next._file, ok));
+    self->_moving = false;
+    g_cond_broadcast(self->_cond);
+  }
+  g_mutex_unlock(self->_mutex);
+  return 0;
+}
+
+// Renames if it can, otherwise copies to a temporary name beside the
+// destination and renames that, so a half-written file never has the
+// final name. Won't overwrite, any more than OutputOp does, unless
+// told to - then the old file is there until the new one replaces it.
+bool
+WriteBehind::move(const std::string& from, const std::string& to,
+  bool overwrite) {
+  if (exists(to)) {
+    if (! overwrite) {
+      g_remove(from.c_str());
+      return false;
+    }
+#ifdef G_OS_WIN32
+    // won't rename over an existing file
+    g_remove(to.c_str());
+#endif
+  }
+  if (g_rename(from.c_str(), to.c_str()) == 0) {
+    return true;
+  }
+
+  std::string part = to + ".part";
+  bool ok = false;
+  FILE* in = g_fopen(from.c_str(), "rb");
+  FILE* out = in ? g_fopen(part.c_str(), "wb") : 0;
+  if (out) {
+    char* buffer = new char[copyBufferSize];
+    ok = true;
+    size_t n;
+    while (ok && (n = fread(buffer, 1, copyBufferSize, in)) > 0) {
+      ok = (fwrite(buffer, 1, n, out) == n);
+    }
+    ok = ok && !ferror(in);
+    delete[] buffer;
+    ok = (fclose(out) == 0) && ok;
+  }
+  if (in) {
+    fclose(in);
+  }
+
+  ok = ok && (overwrite || !exists(to)) && (g_rename(part.c_str(), to.c_str()) == 0);
+  if (!ok) {
+    g_remove(part.c_str());
+  }
+  g_remove(from.c_str());
+  return ok;
+}
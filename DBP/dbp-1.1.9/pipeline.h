@@ -0,0 +1,112 @@
+/* DBP (Dave's Batch Processor)
+ * A simple batch processor for the GIMP
+ * Copyright (C) 2001 - 2008 David Hodson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _DBP_PIPELINE_H_
+#define _DBP_PIPELINE_H_
+
+#include <string>
+#include <list>
+#include "op.h"
+
+// The first and last stages of the processing, on threads of their own.
+//
+// Only one call into Gimp can be going at a time, so loading, the ops
+// and saving all have to wait for each other. What can go on beside
+// them is the disk: ReadAhead reads the next files, so that the loader
+// finds them in the system's file cache, and WriteBehind moves saved
+// files from the staging directory to where they belong. Neither
+// thread calls Gimp.
+
+namespace Dbp {
+
+class ReadAhead {
+
+public:
+
+  // how many files past the current one to read
+  ReadAhead(int depth);
+  ~ReadAhead();
+
+  void start(const InputOp::FileList& files);
+  // the next file has been taken for loading
+  void advance();
+  void stop();
+
+private:
+
+  int _depth;
+  InputOp::FileList _files;
+  InputOp::FileList::const_iterator _next;
+  int _numTaken;
+  int _numRead;
+  bool _stop;
+
+  GMutex* _mutex;
+  GCond* _cond;
+  GThread* _thread;
+
+  static gpointer run(gpointer data);
+};
+
+class WriteBehind {
+
+public:
+
+  // how many saved files may wait to be moved
+  WriteBehind(int depth);
+  ~WriteBehind();
+
+  // blocks while the queue is full
+  // overwrite replaces an existing file, otherwise the move fails
+  void put(const std::string& from, const std::string& to, const Location& file,
+    bool overwrite);
+  // one file moved since the last call, and whether it went OK
+  bool takeFinished(Location& file, bool& ok);
+  // blocks until everything put has been moved
+  void finish();
+
+  // the move itself, in whichever thread
+  static bool move(const std::string& from, const std::string& to,
+    bool overwrite);
+
+private:
+
+  struct Move {
+    std::string _from;
+    std::string _to;
+    Location _file;
+    bool _overwrite;
+  };
+
+  int _depth;
+  std::list<Move> _queue;
+  bool _moving;
+  std::list<std::pair<Location, bool> > _finished;
+  bool _stop;
+
+  GMutex* _mutex;
+  GCond* _cond;
+  GThread* _thread;
+
+  static gpointer run(gpointer data);
+};
+
+} // namespace Dbp
+
+#endif // _DBP_PIPELINE_H_
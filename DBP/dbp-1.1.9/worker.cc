@@ -0,0 +1,453 @@
+/* DBP (Dave's Batch Processor)
+ * A simple batch processor for the GIMP
+ * Copyright (C) 2001 - 2008 David Hodson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "worker.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+using namespace Dbp;
+
+// what a gimp-console takes before it loads anything, roughly
+static const double workerBaseBytes = 128.0 * 1024.0 * 1024.0;
+// size of a loaded image against the size of its file - allows for
+// compression, the alpha channel and the copy a filter works on
+static const double imageBytesPerFileByte = 12.0;
+// the rest of the memory is left to everything else
+static const double memoryShare = 0.5;
+
+// paths in the list and results files are escaped, a line each
+static std::string
+escaped(const std::string& s) {
+  gchar* e = g_strescape(s.c_str(), 0);
+  std::string result(e);
+  g_free(e);
+  return result;
+}
+
+static std::string
+unescaped(const gchar* s) {
+  gchar* u = g_strcompress(s);
+  std::string result(u);
+  g_free(u);
+  return result;
+}
+
+static int
+numProcessors() {
+#if GLIB_CHECK_VERSION(2, 36, 0)
+  return g_get_num_processors();
+#elif defined(_SC_NPROCESSORS_ONLN)
+  return std::max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+#else
+  return 1;
+#endif
+}
+
+// 0 if unknown
+static double
+physicalMemory() {
+#if defined(G_OS_WIN32)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status)) {
+    return (double)status.ullTotalPhys;
+  }
+  return 0.0;
+#elif defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  return (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGESIZE);
+#else
+  return 0.0;
+#endif
+}
+
+// the console version if there is one, it starts faster
+static std::string
+findGimp() {
+  std::vector<std::string> names;
+  gchar* versioned =
+    g_strdup_printf("gimp-console-%d.%d", GIMP_MAJOR_VERSION, GIMP_MINOR_VERSION);
+  names.push_back(versioned);
+  g_free(versioned);
+  names.push_back("gimp-console");
+  versioned = g_strdup_printf("gimp-%d.%d", GIMP_MAJOR_VERSION, GIMP_MINOR_VERSION);
+  names.push_back(versioned);
+  g_free(versioned);
+  names.push_back("gimp");
+
+  std::string result;
+  for (unsigned int i = 0; (i < names.size()) && result.empty(); ++i) {
+    gchar* path = g_find_program_in_path(names[i].c_str());
+    if (path) {
+      result = path;
+      g_free(path);
+    }
+  }
+  return result;
+}
+
+static std::string
+schemeString(const std::string& s) {
+  std::string result("\"");
+  for (std::string::size_type i = 0; i < s.length(); ++i) {
+    if ((s[i] == '"') || (s[i] == '\\')) {
+      result += '\\';
+    }
+    result += s[i];
+  }
+  result += '"';
+  return result;
+}
+
+WorkerPool::WorkerPool():
+  _numFiles(0),
+  _numFinished(0) {
+}
+
+WorkerPool::~WorkerPool() {
+  clear();
+}
+
+void
+WorkerPool::clear() {
+  cancel();
+  for (unsigned int i = 0; i < _workers.size(); ++i) {
+    Worker* worker = _workers[i];
+    if (worker->_watch != 0) {
+      g_source_remove(worker->_watch);
+      g_spawn_close_pid(worker->_pid);
+    }
+    g_remove(worker->_listFile.c_str());
+    g_remove(worker->_resultsFile.c_str());
+    delete worker;
+  }
+  _workers.clear();
+  if (! _baseName.empty()) {
+    g_remove(_settingsFile.c_str());
+    g_remove(_baseName.c_str());
+    _baseName.clear();
+  }
+  _failed.clear();
+  _numFiles = 0;
+  _numFinished = 0;
+}
+
+int
+WorkerPool::numWorkers(const InputOp::FileList& files) {
+  int n = numProcessors();
+
+  double largest = 0.0;
+  InputOp::FileList::const_iterator iter = files.begin();
+  while (iter != files.end()) {
+    struct stat info;
+    if (stat((*iter).fullPath().c_str(), &info) == 0) {
+      largest = std::max(largest, (double)info.st_size);
+    }
+    ++iter;
+  }
+  double memory = physicalMemory();
+  if (memory > 0.0) {
+    double perWorker = workerBaseBytes + largest * imageBytesPerFileByte;
+    n = std::min(n, (int)(memory * memoryShare / perWorker));
+  }
+
+  n = std::min(n, (int)files.size());
+  return std::max(n, 1);
+}
+
+bool
+WorkerPool::start(
+  const DbpData& data, const InputOp::FileList& files, int numWorkers) {
+
+  clear();
+  if (files.empty() || (numWorkers < 1)) {
+    return false;
+  }
+  std::string gimp = findGimp();
+  if (gimp.empty()) {
+    return false;
+  }
+
+  // all the other files are named after this one
+  gchar* name = 0;
+  int fd = g_file_open_tmp("dbp-XXXXXX", &name, 0);
+  if (fd == -1) {
+    return false;
+  }
+  close(fd);
+  _baseName = name;
+  g_free(name);
+
+  _settingsFile = _baseName + ".settings";
+  if (! data.saveSettings(_settingsFile)) {
+    clear();
+    return false;
+  }
+
+  // deal the files out in turn, so big and small ones are spread around
+  for (int i = 0; i < numWorkers; ++i) {
+    Worker* worker = new Worker;
+    worker->_pid = 0;
+    worker->_watch = 0;
+    worker->_running = false;
+    gchar* suffix = g_strdup_printf(".%d", i);
+    worker->_listFile = _baseName + suffix + ".list";
+    worker->_resultsFile = _baseName + suffix + ".results";
+    g_free(suffix);
+    worker->_offset = 0;
+    worker->_finished = 0;
+    _workers.push_back(worker);
+  }
+  int next = 0;
+  InputOp::FileList::const_iterator iter = files.begin();
+  while (iter != files.end()) {
+    _workers[next]->_files.push_back(*iter);
+    next = (next + 1) % numWorkers;
+    ++iter;
+  }
+  _numFiles = files.size();
+
+  std::string procedure(WORKER_NAME);
+  std::replace(procedure.begin(), procedure.end(), '_', '-');
+
+  // all the lists first, so nothing is running if one can't be written;
+  // a line per file, "1 path" if its output may be replaced, "0 path"
+  // if not, see DbpData::filesToProcess
+  for (int i = 0; i < numWorkers; ++i) {
+    Worker& worker = *_workers[i];
+    std::string list;
+    InputOp::FileList::const_iterator file = worker._files.begin();
+    while (file != worker._files.end()) {
+      list += (data.mayReplace(*file) ? "1 " : "0 ") +
+        escaped((*file).fullPath()) + "\n";
+      ++file;
+    }
+    if (! g_file_set_contents(worker._listFile.c_str(), list.c_str(), list.length(), 0)) {
+      clear();
+      return false;
+    }
+  }
+
+  for (int i = 0; i < numWorkers; ++i) {
+    Worker& worker = *_workers[i];
+
+    std::string script = "(" + procedure + " RUN-NONINTERACTIVE " +
+      schemeString(_settingsFile) + " " +
+      schemeString(worker._listFile) + " " +
+      schemeString(worker._resultsFile) + ")";
+    const gchar* argv[] = {
+      gimp.c_str(), "-i", "-d", "-f",
+      "-b", script.c_str(),
+      "-b", "(gimp-quit 0)",
+      0
+    };
+    GSpawnFlags flags = GSpawnFlags(
+      G_SPAWN_DO_NOT_REAP_CHILD |
+      G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL);
+    if (g_spawn_async(0, (gchar**)argv, 0, flags, 0, 0, &worker._pid, 0)) {
+      worker._running = true;
+      worker._watch = g_child_watch_add(worker._pid, &childExited, &worker);
+    } else if (i == 0) {
+      // nothing runs here, it's no use trying the others
+      clear();
+      return false;
+    }
+    // otherwise poll() writes off the files of a worker that didn't start
+  }
+  return true;
+}
+
+void
+WorkerPool::childExited(GPid pid, gint status, gpointer data) {
+  Worker* worker = static_cast<Worker*>(data);
+  worker->_running = false;
+  worker->_watch = 0;
+  g_spawn_close_pid(pid);
+}
+
+void
+WorkerPool::poll() {
+  for (unsigned int i = 0; i < _workers.size(); ++i) {
+    Worker& worker = *_workers[i];
+    // look before reading, so a worker's last lines aren't missed
+    bool running = worker._running;
+    readResults(worker);
+    int numFiles = worker._files.size();
+    if (!running && (worker._finished < numFiles)) {
+      // it died, or was cancelled, before doing these
+      InputOp::FileList::const_iterator iter = worker._files.begin();
+      while (iter != worker._files.end()) {
+        if (worker._finishedFiles.count((*iter).fullPath()) == 0) {
+          _failed.push_back(*iter);
+        }
+        ++iter;
+      }
+      _numFinished += numFiles - worker._finished;
+      worker._finished = numFiles;
+    }
+  }
+}
+
+// a line per file, "1 path" if it went OK, "0 path" if not, the path
+// escaped
+void
+WorkerPool::readResults(Worker& worker) {
+  FILE* results = g_fopen(worker._resultsFile.c_str(), "rb");
+  if (! results) {
+    return;
+  }
+  if (fseek(results, worker._offset, SEEK_SET) == 0) {
+    std::string line;
+    int c;
+    while ((c = getc(results)) != EOF) {
+      if (c != '\n') {
+        line += (char)c;
+        continue;
+      }
+      // only complete lines count, the rest is read next time
+      worker._offset += line.length() + 1;
+      if (line.length() > 2) {
+        std::string path = unescaped(line.c_str() + 2);
+        // a file is only counted once, whatever the worker writes
+        if (worker._finishedFiles.insert(path).second) {
+          if (line[0] != '1') {
+            _failed.push_back(Location(path));
+          }
+          ++worker._finished;
+          ++_numFinished;
+        }
+      }
+      line.clear();
+    }
+  }
+  fclose(results);
+}
+
+void
+WorkerPool::cancel() {
+  for (unsigned int i = 0; i < _workers.size(); ++i) {
+    Worker& worker = *_workers[i];
+    if (worker._running) {
+#ifdef G_OS_WIN32
+      TerminateProcess(worker._pid, 1);
+#else
+      kill(worker._pid, SIGTERM);
+#endif
+    }
+  }
+}
+
+bool
+WorkerPool::done() const {
+  return _numFinished >= _numFiles;
+}
+
+float
+WorkerPool::progress() const {
+  if (_numFiles == 0) {
+    return 0.0;
+  }
+  return (float)_numFinished / _numFiles;
+}
+
+int
+WorkerPool::numFiles() const {
+  return _numFiles;
+}
+
+int
+WorkerPool::numFinished() const {
+  return _numFinished;
+}
+
+int
+WorkerPool::numRunning() const {
+  int n = 0;
+  for (unsigned int i = 0; i < _workers.size(); ++i) {
+    if (_workers[i]->_running) {
+      ++n;
+    }
+  }
+  return n;
+}
+
+const InputOp::FileList&
+WorkerPool::failed() const {
+  return _failed;
+}
+
+bool
+WorkerPool::runWorker(const std::string& settingsFile,
+  const std::string& listFile, const std::string& resultsFile) {
+
+  DbpData data;
+  if (! data.loadSettings(settingsFile)) {
+    return false;
+  }
+
+  gchar* contents = 0;
+  if (! g_file_get_contents(listFile.c_str(), &contents, 0, 0)) {
+    return false;
+  }
+  InputOp::FileList files;
+  gchar** lines = g_strsplit(contents, "\n", -1);
+  for (gchar** line = lines; *line; ++line) {
+    if (strlen(*line) > 2) {
+      Location file(unescaped(*line + 2));
+      if (**line == '1') {
+        data.allowReplace(file);
+      }
+      files.push_back(file);
+    }
+  }
+  g_strfreev(lines);
+  g_free(contents);
+
+  FILE* results = g_fopen(resultsFile.c_str(), "ab");
+  if (! results) {
+    return false;
+  }
+
+  // carry on past a bad file, the pool reports it
+  data.start(files, false);
+  while (! data.done()) {
+    data.step();
+    DbpData::Results finished = data.takeResults();
+    DbpData::Results::const_iterator iter = finished.begin();
+    while (iter != finished.end()) {
+      fprintf(results, "%d %s\n",
+        (*iter)._ok ? 1 : 0, escaped((*iter)._file.fullPath()).c_str());
+      ++iter;
+    }
+    fflush(results);
+  }
+  fclose(results);
+  return true;
+}
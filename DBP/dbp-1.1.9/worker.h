@@ -0,0 +1,97 @@
+/* DBP (Dave's Batch Processor)
+ * A simple batch processor for the GIMP
+ * Copyright (C) 2001 - 2008 David Hodson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _DBP_WORKER_H_
+#define _DBP_WORKER_H_
+
+#include <string>
+#include <vector>
+#include <set>
+#include "op.h"
+
+#define WORKER_NAME "plug_in_dbp_worker"
+
+namespace Dbp {
+
+// Runs a batch in several Gimp processes at once.
+//
+// A plug-in only ever has one call into Gimp going, so more images in
+// this session wouldn't run any faster. Instead each worker is a
+// gimp-console of its own, which runs WORKER_NAME on its share of the
+// files. The settings and the file lists are passed in temporary
+// files, and each worker writes a line to its results file as it
+// finishes a file, which poll() picks up.
+class WorkerPool {
+
+public:
+
+  WorkerPool();
+  ~WorkerPool();
+
+  // how many workers the cores and memory allow for these files
+  static int numWorkers(const InputOp::FileList& files);
+
+  // false if the workers couldn't be started
+  bool start(const DbpData& data, const InputOp::FileList& files, int numWorkers);
+  void poll();
+  void cancel();
+
+  bool done() const;
+  float progress() const;
+  int numFiles() const;
+  int numFinished() const;
+  int numRunning() const;
+  // only valid after poll()
+  const InputOp::FileList& failed() const;
+
+  // the worker side, run from the plug-in
+  static bool runWorker(const std::string& settingsFile,
+    const std::string& listFile, const std::string& resultsFile);
+
+private:
+
+  struct Worker {
+    GPid _pid;
+    guint _watch;
+    bool _running;
+    std::string _listFile;
+    std::string _resultsFile;
+    long _offset;
+    InputOp::FileList _files;
+    int _finished;
+    // by path: the results come in the order the saves finish, which
+    // with write-behind isn't the order of the list
+    std::set<std::string> _finishedFiles;
+  };
+
+  std::vector<Worker*> _workers;
+  std::string _baseName;
+  std::string _settingsFile;
+  InputOp::FileList _failed;
+  int _numFiles;
+  int _numFinished;
+
+  void clear();
+  void readResults(Worker&);
+  static void childExited(GPid pid, gint status, gpointer data);
+};
+
+} // namespace Dbp
+
+#endif // _DBP_WORKER_H_
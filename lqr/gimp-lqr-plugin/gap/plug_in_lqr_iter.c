@@ -74,6 +74,7 @@ static void p_delta_gfloat(gfloat *val, gfloat val_from, gfloat val_to, gint32 t
 gint p_plug_in_lqr_iter(GimpRunMode run_mode, gint32 total_steps, gdouble current_step, gint32 len_struct)
 {
     PlugInVals  buf, buf_from, buf_to;
+    PlugInFrameVals frame;
 
     if(len_struct != sizeof(PlugInVals))
     {
@@ -106,6 +107,7 @@ gint p_plug_in_lqr_iter(GimpRunMode run_mode, gint32 total_steps, gdouble curren
     buf.scaleback = buf_to.scaleback;
     buf.scaleback_mode = buf_to.scaleback_mode;
     buf.no_disc_on_enlarge = buf_to.no_disc_on_enlarge;
+    buf.resize_all_layers = buf_to.resize_all_layers;
     g_strlcpy(buf.pres_layer_name, buf_to.pres_layer_name, VALS_MAX_NAME_LENGTH);
     g_strlcpy(buf.disc_layer_name, buf_to.disc_layer_name, VALS_MAX_NAME_LENGTH);
     g_strlcpy(buf.rigmask_layer_name, buf_to.rigmask_layer_name, VALS_MAX_NAME_LENGTH);
@@ -113,6 +115,12 @@ gint p_plug_in_lqr_iter(GimpRunMode run_mode, gint32 total_steps, gdouble curren
 
     gimp_set_data("plug_in_lqr", &buf, sizeof(buf));
 
+    /* lets the plug-in reuse the seams of the previous frame */
+    frame.pending = TRUE;
+    frame.total_steps = total_steps;
+    frame.current_step = current_step;
+    gimp_set_data(DATA_KEY_FRAME, &frame, sizeof(frame));
+
     return 0; /* OK */
 }
 MAIN ()
@@ -61,6 +61,8 @@ static void callback_interactive_button (GtkWidget * button, gpointer data);
 static void callback_set_disc_warning (GtkWidget * dummy, gpointer data);
 static void callback_size_changed (GtkWidget * size_entry, gpointer data);
 static void callback_res_order_changed (GtkWidget * res_order, gpointer data);
+static void callback_nrg_func_changed (GtkWidget * nrg_func, gpointer data);
+static void callback_carve_param_changed (GtkAdjustment * adj, gpointer data);
 static void callback_output_target_changed (GtkWidget * res_order, gpointer data);
 static void callback_scaleback_mode_changed (GtkWidget * res_order, gpointer data);
 static void callback_expander_changed (GtkWidget * expander, gpointer data);
@@ -158,6 +160,7 @@ dialog (PlugInImageVals * image_vals,
   GtkWidget *output_target_combo_box;
   GtkWidget *resize_canvas_button;
   GtkWidget *resize_aux_layers_button;
+  GtkWidget *resize_all_layers_button;
   GtkWidget *out_seams_hbox;
   GtkWidget *out_seams_button;
   GimpRGB *colour;
@@ -416,6 +419,7 @@ dialog (PlugInImageVals * image_vals,
   gtk_widget_show (coordinates);
 
   preview_data.coordinates = (gpointer) coordinates;
+  preview_carve (&preview_data);
 
   /* Aux buttons */
 
@@ -620,6 +624,29 @@ dialog (PlugInImageVals * image_vals,
 			   ("Resize the layers used as features or rigidity masks "
 			    "along with the active layer"), NULL);
 
+  resize_all_layers_button =
+    gtk_check_button_new_with_label (_("Resize all visible layers"));
+
+  gtk_box_pack_start (GTK_BOX (vbox), resize_all_layers_button, FALSE, FALSE,
+		      0);
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (resize_all_layers_button),
+				state->resize_all_layers);
+  gtk_widget_show (resize_all_layers_button);
+
+  gimp_help_set_help_data (resize_all_layers_button,
+			   _
+			   ("Carve the other visible layers along the same seams "
+			    "as the active layer, which is the only one used to "
+			    "find them. Only layers of the same size and position "
+			    "as the active one, and only when the output goes to "
+			    "the same layer"),
+			   NULL);
+
+  g_signal_connect (resize_all_layers_button, "toggled",
+		    G_CALLBACK
+		    (callback_status_button),
+		    (gpointer) (&state->resize_all_layers));
+
   out_seams_hbox = gtk_hbox_new (FALSE, 4);
   gtk_box_pack_start (GTK_BOX (vbox), out_seams_hbox, FALSE, FALSE, 0);
   gtk_widget_show (out_seams_hbox);
@@ -823,6 +850,7 @@ dialog (PlugInImageVals * image_vals,
 
   gtk_widget_destroy (dlg);
 
+  preview_proxy_free (&preview_data);
   g_object_unref (G_OBJECT (preview_data.pixbuf));
   g_free(state);
   g_free(ui_state);
@@ -934,6 +962,7 @@ callback_size_changed (GtkWidget * size_entry, gpointer data)
   p_data->vals->new_width = new_width;
   p_data->vals->new_height = new_height;
   callback_set_disc_warning (NULL, data);
+  preview_carve (p_data);
 }
 
 static void
@@ -944,6 +973,24 @@ callback_res_order_changed (GtkWidget * res_order, gpointer data)
   gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (res_order), &order);
   p_data->vals->res_order = order;
   callback_set_disc_warning (NULL, data);
+  preview_carve (p_data);
+}
+
+static void
+callback_nrg_func_changed (GtkWidget * nrg_func, gpointer data)
+{
+  gint func;
+  PreviewData *p_data = PREVIEW_DATA (data);
+  gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (nrg_func), &func);
+  p_data->vals->nrg_func = func;
+  preview_carve_later (p_data);
+}
+
+/* the preview is carved with these too, see preview_carve */
+static void
+callback_carve_param_changed (GtkAdjustment * adj, gpointer data)
+{
+  preview_carve_later (PREVIEW_DATA (data));
 }
 
 static void
@@ -1457,6 +1504,9 @@ features_page_new (gint32 image_ID, gint32 layer_ID)
   g_signal_connect (adj, "value_changed",
 		    G_CALLBACK (gimp_int_adjustment_update),
 		    &state->pres_coeff);
+  g_signal_connect (adj, "value_changed",
+		    G_CALLBACK (callback_carve_param_changed),
+		    (gpointer) & preview_data);
 
   gtk_widget_set_sensitive (GIMP_SCALE_ENTRY_LABEL (adj),
 			    (ui_state->pres_status
@@ -1722,6 +1772,9 @@ features_page_new (gint32 image_ID, gint32 layer_ID)
   g_signal_connect (adj, "value_changed",
 		    G_CALLBACK (gimp_int_adjustment_update),
 		    (gpointer) & (state->disc_coeff));
+  g_signal_connect (adj, "value_changed",
+		    G_CALLBACK (callback_carve_param_changed),
+		    (gpointer) & preview_data);
   g_signal_connect (adj, "value_changed",
 		    G_CALLBACK (callback_set_disc_warning),
 		    (gpointer) & preview_data);
@@ -1958,6 +2011,9 @@ advanced_page_new (gint32 image_ID, gint32 layer_ID)
 
   g_signal_connect (adj, "value_changed",
 		    G_CALLBACK (gimp_int_adjustment_update), &state->delta_x);
+  g_signal_connect (adj, "value_changed",
+		    G_CALLBACK (callback_carve_param_changed),
+		    (gpointer) & preview_data);
 
   /* Rigidity */
 
@@ -1971,6 +2027,9 @@ advanced_page_new (gint32 image_ID, gint32 layer_ID)
   g_signal_connect (adj, "value_changed",
 		    G_CALLBACK (gimp_float_adjustment_update),
 		    &state->rigidity);
+  g_signal_connect (adj, "value_changed",
+		    G_CALLBACK (callback_carve_param_changed),
+		    (gpointer) & preview_data);
 
 
   hbox = gtk_hbox_new (FALSE, 4);
@@ -2206,8 +2265,10 @@ advanced_page_new (gint32 image_ID, gint32 layer_ID)
                             _("Grad. norm (luma)"), LQR_EF_LUMA_GRAD_NORM,
 			    /* Null can be translated as Zero */
 			    _("Null"), LQR_EF_NULL, NULL);
-  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (nrg_func_combo_box),
-				 state->nrg_func);
+  gimp_int_combo_box_connect (GIMP_INT_COMBO_BOX (nrg_func_combo_box),
+			      state->nrg_func,
+			      G_CALLBACK (callback_nrg_func_changed),
+			      (gpointer) & preview_data);
 
   gtk_box_pack_start (GTK_BOX (hbox), nrg_func_combo_box, TRUE, TRUE, 0);
   gtk_widget_show (nrg_func_combo_box);
@@ -2253,6 +2314,9 @@ advanced_page_new (gint32 image_ID, gint32 layer_ID)
   g_signal_connect (adj, "value_changed",
 		    G_CALLBACK (gimp_float_adjustment_update),
 		    &state->enl_step);
+  g_signal_connect (adj, "value_changed",
+		    G_CALLBACK (callback_carve_param_changed),
+		    (gpointer) & preview_data);
 
   /* Resize order */
 
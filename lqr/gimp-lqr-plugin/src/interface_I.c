@@ -465,6 +465,8 @@ dialog_I (PlugInImageVals * image_vals,
 
 
   lqr_carver_destroy (carver_data->carver);
+  g_free (carver_data->extra_layer_IDs);
+  g_free (carver_data->extra_alpha_locks);
 
   switch (dialog_I_response)
     {
@@ -17,6 +17,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include <libgimp/gimp.h>
 #include <lqr.h>
@@ -26,6 +27,17 @@
 
 #include "io_functions.h"
 
+/* strips in flight between the plugin and a reading or writing thread */
+#define STRIP_COUNT (2)
+#define TRANSPOSE_BLOCK (32)
+
+typedef struct
+{
+  guchar *data;
+  gint start;                   /* first row, or column, of the strip */
+  gint count;                   /* rows, or columns, in it; 0 at the end */
+} Strip;
+
 guchar *
 rgb_buffer_from_layer (gint32 layer_ID)
 {
@@ -34,6 +46,7 @@ rgb_buffer_from_layer (gint32 layer_ID)
   GimpDrawable *drawable;
   GimpPixelRgn rgn_in;
   guchar *buffer;
+  gint strip_h;
   gint update_step;
 
   gimp_progress_init (_("Parsing layer..."));
@@ -49,14 +62,18 @@ rgb_buffer_from_layer (gint32 layer_ID)
 
   gimp_pixel_rgn_init (&rgn_in, drawable, 0, 0, w, h, FALSE, FALSE);
 
-  for (y = 0; y < h; y++)
+  /* a whole row of tiles at a time */
+  strip_h = gimp_tile_height ();
+  update_step = MAX (h / strip_h / 20, 1);
+
+  for (y = 0; y < h; y += strip_h)
     {
-      gimp_pixel_rgn_get_row (&rgn_in, buffer + y * w * bpp, 0, y, w);
+      gimp_pixel_rgn_get_rect (&rgn_in, buffer + (gsize) y * w * bpp, 0, y,
+                               w, MIN (strip_h, h - y));
 
-      update_step = MAX ((h - 1) / 20, 1);
-      if (y % update_step == 0)
+      if ((y / strip_h) % update_step == 0)
         {
-          gimp_progress_update ((gdouble) y / (h - 1));
+          gimp_progress_update ((gdouble) MIN (y + strip_h, h) / h);
         }
     }
 
@@ -67,124 +84,493 @@ rgb_buffer_from_layer (gint32 layer_ID)
   return buffer;
 }
 
-LqrRetVal
-update_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
-             gint base_x_off, gint base_y_off)
+/* The bias and rigidity layers are read a row of tiles at a time, and
+ * a thread adds each strip to the carver while the next one is read,
+ * so that no copy of the whole layer is needed. */
+
+typedef struct
 {
-  guchar *rgb;
-  gint w, h, bpp;
-  gint x_off, y_off;
+  LqrCarver *carver;
+  gint bias_factor;
+  gboolean rigmask;             /* set the rigidity mask instead */
+  gint width;
+  gint bpp;
+  gint x_off;
+  gint y_off;
+  LqrRetVal result;
+  GAsyncQueue *free_strips;
+  GAsyncQueue *full_strips;
+} StripAdder;
+
+static void
+strip_add (StripAdder * adder, Strip * strip)
+{
+  if (adder->result != LQR_OK)
+    {
+      return;
+    }
+  if (adder->rigmask)
+    {
+      adder->result = lqr_carver_rigmask_add_rgb_area
+        (adder->carver, strip->data, adder->bpp, adder->width, strip->count,
+         adder->x_off, adder->y_off + strip->start);
+    }
+  else
+    {
+      adder->result = lqr_carver_bias_add_rgb_area
+        (adder->carver, strip->data, adder->bias_factor, adder->bpp,
+         adder->width, strip->count, adder->x_off, adder->y_off + strip->start);
+    }
+}
 
-  if ((layer_ID == 0) || (bias_factor == 0))
+static gpointer
+strip_adder_thread (gpointer data)
+{
+  StripAdder *adder = data;
+  Strip *strip;
+
+  for (;;)
     {
-      return LQR_OK;
+      strip = g_async_queue_pop (adder->full_strips);
+      if (strip->count == 0)
+        {
+          break;
+        }
+      strip_add (adder, strip);
+      g_async_queue_push (adder->free_strips, strip);
     }
 
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
-  x_off -= base_x_off;
-  y_off -= base_y_off;
+  return NULL;
+}
 
-  w = gimp_drawable_width (layer_ID);
+static LqrRetVal
+add_layer_to_carver (LqrCarver * r, gint32 layer_ID, gint bias_factor,
+                     gboolean rigmask, gint base_x_off, gint base_y_off)
+{
+  GimpDrawable *drawable;
+  GimpPixelRgn rgn_in;
+  StripAdder adder;
+  Strip strips[STRIP_COUNT];
+  Strip end;
+  Strip *strip;
+  GThread *thread;
+  gint h, y;
+  gint strip_h;
+  gint i;
+
+  gimp_drawable_offsets (layer_ID, &adder.x_off, &adder.y_off);
+  adder.x_off -= base_x_off;
+  adder.y_off -= base_y_off;
+
+  adder.carver = r;
+  adder.bias_factor = bias_factor;
+  adder.rigmask = rigmask;
+  adder.width = gimp_drawable_width (layer_ID);
+  adder.bpp = gimp_drawable_bpp (layer_ID);
+  adder.result = LQR_OK;
   h = gimp_drawable_height (layer_ID);
+  strip_h = gimp_tile_height ();
 
-  bpp = gimp_drawable_bpp (layer_ID);
+  for (i = 0; i < STRIP_COUNT; i++)
+    {
+      strips[i].data =
+        g_try_new (guchar, (gsize) strip_h * adder.width * adder.bpp);
+      if (strips[i].data == NULL)
+        {
+          while (i--)
+            {
+              g_free (strips[i].data);
+            }
+          return LQR_NOMEM;
+        }
+    }
 
-  rgb = rgb_buffer_from_layer (layer_ID);
+  gimp_progress_init (_("Parsing layer..."));
+
+  drawable = gimp_drawable_get (layer_ID);
+  gimp_pixel_rgn_init (&rgn_in, drawable, 0, 0, adder.width, h, FALSE, FALSE);
 
-  CATCH (lqr_carver_bias_add_rgb_area
-         (r, rgb, bias_factor, bpp, w, h, x_off, y_off));
+  adder.free_strips = g_async_queue_new ();
+  adder.full_strips = g_async_queue_new ();
+  for (i = 0; i < STRIP_COUNT; i++)
+    {
+      g_async_queue_push (adder.free_strips, &strips[i]);
+    }
 
-  g_free(rgb);
+#if GLIB_CHECK_VERSION(2,32,0)
+  thread = g_thread_try_new ("lqr-bias", strip_adder_thread, &adder, NULL);
+#else
+  thread = g_thread_create (strip_adder_thread, &adder, TRUE, NULL);
+#endif
 
-  return LQR_OK;
+  for (y = 0; y < h; y += strip_h)
+    {
+      strip = thread ? g_async_queue_pop (adder.free_strips) : &strips[0];
+      strip->start = y;
+      strip->count = MIN (strip_h, h - y);
+      gimp_pixel_rgn_get_rect (&rgn_in, strip->data, 0, y, adder.width,
+                               strip->count);
+      if (thread)
+        {
+          g_async_queue_push (adder.full_strips, strip);
+        }
+      else
+        {
+          strip_add (&adder, strip);
+        }
+      gimp_progress_update ((gdouble) (y + strip->count) / h);
+    }
+
+  if (thread)
+    {
+      end.count = 0;
+      g_async_queue_push (adder.full_strips, &end);
+      g_thread_join (thread);
+    }
+  g_async_queue_unref (adder.free_strips);
+  g_async_queue_unref (adder.full_strips);
+  for (i = 0; i < STRIP_COUNT; i++)
+    {
+      g_free (strips[i].data);
+    }
+
+  gimp_drawable_detach (drawable);
+
+  gimp_progress_end();
+
+  return adder.result;
 }
 
 LqrRetVal
-set_rigmask (LqrCarver * r, gint32 layer_ID, gint base_x_off, gint base_y_off)
+update_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
+             gint base_x_off, gint base_y_off)
 {
-  guchar *rgb;
-  gint w, h, bpp;
-  gint x_off, y_off;
+  if ((layer_ID == 0) || (bias_factor == 0))
+    {
+      return LQR_OK;
+    }
+
+  return add_layer_to_carver (r, layer_ID, bias_factor, FALSE,
+                              base_x_off, base_y_off);
+}
 
+LqrRetVal
+set_rigmask (LqrCarver * r, gint32 layer_ID, gint base_x_off, gint base_y_off)
+{
   if (layer_ID == 0)
     {
       return LQR_OK;
     }
 
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
-  x_off -= base_x_off;
-  y_off -= base_y_off;
+  return add_layer_to_carver (r, layer_ID, 0, TRUE, base_x_off, base_y_off);
+}
 
-  w = gimp_drawable_width (layer_ID);
-  h = gimp_drawable_height (layer_ID);
 
-  bpp = gimp_drawable_bpp (layer_ID);
+/* The carver is read out in strips of a tile row (or, if it scans by
+ * column, a tile column) which are written with a single
+ * gimp_pixel_rgn_set_rect, so that each tile is sent once. A thread
+ * fills the next strips while the current one is being written; since
+ * it is started by carver_writer_start, the aux carvers can be read out
+ * while the layers before them are being written. */
 
-  rgb = rgb_buffer_from_layer (layer_ID);
+struct _CarverWriter
+{
+  LqrCarver *carver;
+  gint32 layer_ID;
+  GimpDrawable *drawable;
+  GimpPixelRgn rgn_out;
+  gint width;
+  gint height;
+  gboolean by_row;
+  gint length;                  /* pixels in a scan line */
+  gint lines;                   /* scan lines in a full strip */
+  gint bpp;
+  guchar *columns;              /* scan lines before the transposition */
+  Strip strips[STRIP_COUNT];
+  GAsyncQueue *free_strips;
+  GAsyncQueue *full_strips;
+  GThread *thread;
+};
+
+/* from count columns of length pixels each to length rows of count
+ * pixels, one block at a time so that both sides stay in the cache */
+static void
+transpose_columns (const guchar * columns, guchar * rows, gint count,
+                   gint length, gint bpp)
+{
+  gint c0, r0, c, r, k;
+  gint c1, r1;
+  const guchar *src;
+  guchar *dest;
 
-  CATCH (lqr_carver_rigmask_add_rgb_area
-         (r, rgb, bpp, w, h, x_off, y_off));
+  for (r0 = 0; r0 < length; r0 += TRANSPOSE_BLOCK)
+    {
+      r1 = MIN (r0 + TRANSPOSE_BLOCK, length);
+      for (c0 = 0; c0 < count; c0 += TRANSPOSE_BLOCK)
+        {
+          c1 = MIN (c0 + TRANSPOSE_BLOCK, count);
+          for (c = c0; c < c1; c++)
+            {
+              src = columns + ((gsize) c * length + r0) * bpp;
+              dest = rows + ((gsize) r0 * count + c) * bpp;
+              for (r = r0; r < r1; r++)
+                {
+                  for (k = 0; k < bpp; k++)
+                    {
+                      dest[k] = src[k];
+                    }
+                  src += bpp;
+                  dest += (gsize) count * bpp;
+                }
+            }
+        }
+    }
+}
 
-  g_free(rgb);
+/* reads the next strip out of the carver, returns the lines read */
+static gint
+strip_fill (CarverWriter * writer, Strip * strip)
+{
+  gint n;
+  gint line;
+  guchar *line_data;
+  guchar *dest;
+  gsize line_size;
 
-  return LQR_OK;
+  line_size = (gsize) writer->length * writer->bpp;
+  dest = writer->by_row ? strip->data : writer->columns;
+  strip->count = 0;
+
+  for (n = 0; n < writer->lines; n++)
+    {
+      if (!lqr_carver_scan_line (writer->carver, &line, &line_data))
+        {
+          break;
+        }
+      if (n == 0)
+        {
+          strip->start = line;
+        }
+      memcpy (dest + n * line_size, line_data, line_size);
+    }
+
+  if ((!writer->by_row) && (n > 0))
+    {
+      transpose_columns (writer->columns, strip->data, n, writer->length,
+                         writer->bpp);
+    }
+  strip->count = n;
+
+  return n;
 }
 
+static gpointer
+strip_reader_thread (gpointer data)
+{
+  CarverWriter *writer = data;
+  Strip *strip;
 
-LqrRetVal
-write_carver_to_layer (LqrCarver * r, gint32 layer_ID)
+  do
+    {
+      strip = g_async_queue_pop (writer->free_strips);
+      strip_fill (writer, strip);
+      g_async_queue_push (writer->full_strips, strip);
+    }
+  while (strip->count > 0);
+
+  return NULL;
+}
+
+static void
+carver_writer_free (CarverWriter * writer)
 {
-  GimpDrawable * drawable;
-  gint y;
-  gint w, h;
-  GimpPixelRgn rgn_out;
-  guchar *out_line;
-  gint update_step;
+  gint i;
 
-  gimp_progress_init (_("Applying changes..."));
-  update_step = MAX ((lqr_carver_get_height(r) - 1) / 20, 1);
+  if (writer->free_strips)
+    {
+      g_async_queue_unref (writer->free_strips);
+      g_async_queue_unref (writer->full_strips);
+    }
+  for (i = 0; i < STRIP_COUNT; i++)
+    {
+      g_free (writer->strips[i].data);
+    }
+  g_free (writer->columns);
+  if (writer->drawable)
+    {
+      gimp_drawable_detach (writer->drawable);
+    }
+  g_free (writer);
+}
 
-  drawable = gimp_drawable_get (layer_ID);
+/* the layer must already have the size of the carver */
+CarverWriter *
+carver_writer_start (LqrCarver * r, gint32 layer_ID)
+{
+  CarverWriter *writer;
+  gsize strip_size;
+  gint i;
+
+  LQR_TRY_N_N (writer = g_try_new0 (CarverWriter, 1));
+
+  writer->carver = r;
+  writer->layer_ID = layer_ID;
+  writer->width = gimp_drawable_width (layer_ID);
+  writer->height = gimp_drawable_height (layer_ID);
+  writer->by_row = lqr_carver_scan_by_row (r);
+  writer->length = writer->by_row ? writer->width : writer->height;
+  writer->lines = writer->by_row ? gimp_tile_height () : gimp_tile_width ();
+  writer->bpp = lqr_carver_get_channels (r);
+
+  strip_size = (gsize) writer->lines * writer->length * writer->bpp;
+  for (i = 0; i < STRIP_COUNT; i++)
+    {
+      writer->strips[i].data = g_try_new (guchar, strip_size);
+      if (writer->strips[i].data == NULL)
+        {
+          carver_writer_free (writer);
+          return NULL;
+        }
+    }
+  if (!writer->by_row)
+    {
+      writer->columns = g_try_new (guchar, strip_size);
+      if (writer->columns == NULL)
+        {
+          carver_writer_free (writer);
+          return NULL;
+        }
+    }
 
-  w = gimp_drawable_width (layer_ID);
-  h = gimp_drawable_height (layer_ID);
+  writer->drawable = gimp_drawable_get (layer_ID);
+  gimp_pixel_rgn_init (&writer->rgn_out, writer->drawable, 0, 0,
+                       writer->width, writer->height, TRUE, TRUE);
 
-  gimp_pixel_rgn_init (&rgn_out, drawable, 0, 0, w, h, TRUE, TRUE);
+  writer->free_strips = g_async_queue_new ();
+  writer->full_strips = g_async_queue_new ();
+  for (i = 0; i < STRIP_COUNT; i++)
+    {
+      g_async_queue_push (writer->free_strips, &writer->strips[i]);
+    }
+
+#if GLIB_CHECK_VERSION(2,32,0)
+  writer->thread = g_thread_try_new ("lqr-strips", strip_reader_thread, writer, NULL);
+#else
+  writer->thread = g_thread_create (strip_reader_thread, writer, TRUE, NULL);
+#endif
+
+  return writer;
+}
+
+/* writes the strips as they come, then frees the writer */
+LqrRetVal
+carver_writer_finish (CarverWriter * writer)
+{
+  Strip *strip;
+  gint lines_total;
+  gint lines_done;
 
+  gimp_progress_init (_("Applying changes..."));
 
-  while (lqr_carver_scan_line (r, &y, &out_line))
+  lines_total = writer->by_row ? writer->height : writer->width;
+  lines_done = 0;
+  for (;;)
     {
-      if (lqr_carver_scan_by_row(r))
+      if (writer->thread)
         {
-          gimp_pixel_rgn_set_row (&rgn_out, out_line, 0, y, w);
+          strip = g_async_queue_pop (writer->full_strips);
         }
       else
         {
-          gimp_pixel_rgn_set_col (&rgn_out, out_line, y, 0, h);
+          strip = &writer->strips[0];
+          strip_fill (writer, strip);
+        }
+      if (strip->count == 0)
+        {
+          break;
         }
 
-      if (y % update_step == 0)
+      if (writer->by_row)
+        {
+          gimp_pixel_rgn_set_rect (&writer->rgn_out, strip->data, 0,
+                                   strip->start, writer->width, strip->count);
+        }
+      else
         {
-          gimp_progress_update ((gdouble) y / (lqr_carver_get_height(r) - 1));
+          gimp_pixel_rgn_set_rect (&writer->rgn_out, strip->data,
+                                   strip->start, 0, strip->count,
+                                   writer->height);
         }
+      lines_done += strip->count;
+      gimp_progress_update ((gdouble) lines_done / lines_total);
 
+      if (writer->thread)
+        {
+          g_async_queue_push (writer->free_strips, strip);
+        }
     }
 
-  gimp_drawable_flush (drawable);
-  gimp_drawable_merge_shadow (layer_ID, TRUE);
-  gimp_drawable_update (layer_ID, 0, 0, w, h);
+  if (writer->thread)
+    {
+      g_thread_join (writer->thread);
+    }
 
-  gimp_drawable_detach (drawable);
+  gimp_drawable_flush (writer->drawable);
+  gimp_drawable_merge_shadow (writer->layer_ID, TRUE);
+  gimp_drawable_update (writer->layer_ID, 0, 0, writer->width, writer->height);
+
+  carver_writer_free (writer);
 
   gimp_progress_end();
 
   return LQR_OK;
 }
 
+LqrRetVal
+write_carver_to_layer (LqrCarver * r, gint32 layer_ID)
+{
+  CarverWriter *writer;
+
+  CATCH_MEM (writer = carver_writer_start (r, layer_ID));
+
+  return carver_writer_finish (writer);
+}
+
+/* the colour of each visibility level, 0 (never carved) being
+ * transparent; the entries hold the RGBA bytes in memory order */
+static guint32 *
+vmap_palette_new (gint depth, GimpRGB col_start, GimpRGB col_end)
+{
+  guint32 *palette;
+  guchar rgba[4];
+  gdouble value;
+  gint vs;
+
+  palette = g_try_new (guint32, depth + 1);
+  if (palette == NULL)
+    {
+      return NULL;
+    }
+
+  memset (rgba, 0, sizeof (rgba));
+  memcpy (&palette[0], rgba, sizeof (rgba));
+  for (vs = 1; vs <= depth; vs++)
+    {
+      value = (double) (depth + 1 - vs) / (depth + 1);
+      rgba[0] = 255 * (value * col_start.r + (1 - value) * col_end.r);
+      rgba[1] = 255 * (value * col_start.g + (1 - value) * col_end.g);
+      rgba[2] = 255 * (value * col_start.b + (1 - value) * col_end.b);
+      rgba[3] = 255 * (0.5 * (1 + value));
+      memcpy (&palette[vs], rgba, sizeof (rgba));
+    }
+
+  return palette;
+}
+
 LqrRetVal
 write_vmap_to_layer (LqrVMap * vmap, gpointer data)
 {
-  gint w, h, bpp;
+  gint w, h;
   gint depth;
   gint *buffer;
   gint32 seam_layer_ID;
@@ -195,9 +581,13 @@ write_vmap_to_layer (LqrVMap * vmap, gpointer data)
   gchar *name;
   GimpRGB col_start, col_end;
   GimpPixelRgn rgn_out;
-  guchar *outrow;
-  gdouble value, rd, gr, bl, al;
-  gint vs, y, x, k;
+  guint32 *palette;
+  guint32 *strip;
+  const gint *src;
+  guint vs;
+  gint strip_h, rows;
+  gint y;
+  gsize i, n;
   gint update_step;
 
   image_ID = VMAP_FUNC_ARG (data)->image_ID;
@@ -218,8 +608,17 @@ write_vmap_to_layer (LqrVMap * vmap, gpointer data)
   buffer = lqr_vmap_get_data(vmap);
   depth = lqr_vmap_get_depth(vmap);
 
+  CATCH_MEM (palette = vmap_palette_new (depth, col_start, col_end));
+  strip_h = gimp_tile_height ();
+  strip = g_try_new (guint32, (gsize) w * strip_h);
+  if (strip == NULL)
+    {
+      g_free (palette);
+      return LQR_NOMEM;
+    }
+
   gimp_progress_init (_("Drawing seam map..."));
-  update_step = MAX ((h - 1) / 20, 1);
+  update_step = MAX (h / strip_h / 20, 1);
 
   if (!gimp_drawable_is_valid (seam_layer_ID))
     {
@@ -240,44 +639,30 @@ write_vmap_to_layer (LqrVMap * vmap, gpointer data)
     }
   drawable = gimp_drawable_get (seam_layer_ID);
 
-  bpp = 4;
-
   gimp_pixel_rgn_init (&rgn_out, drawable, 0, 0, w, h, TRUE, TRUE);
 
-  CATCH_MEM (outrow = g_try_new (guchar, w * bpp));
-
-  for (y = 0; y < h; y++)
+  /* a row of tiles at a time, each pixel a lookup in the palette */
+  for (y = 0; y < h; y += strip_h)
     {
-      for (x = 0; x < w; x++)
+      rows = MIN (strip_h, h - y);
+      src = buffer + (gsize) y * w;
+      n = (gsize) rows * w;
+      for (i = 0; i < n; i++)
         {
-          vs = buffer[y * w + x];
-          if (vs == 0)
-            {
-              for (k = 0; k < bpp; k++)
-                {
-                  outrow[x * bpp + k] = 0;
-                }
-            }
-          else
-            {
-              value = (double) (depth + 1 - vs) / (depth + 1);
-              rd = value * col_start.r + (1 - value) * col_end.r;
-              gr = value * col_start.g + (1 - value) * col_end.g;
-              bl = value * col_start.b + (1 - value) * col_end.b;
-              al = 0.5 * (1 + value);
-              outrow[x * bpp] = 255 * rd;
-              outrow[x * bpp + 1] = 255 * gr;
-              outrow[x * bpp + 2] = 255 * bl;
-              outrow[x * bpp + 3] = 255 * al;
-            }
+          vs = src[i];
+          strip[i] = palette[(vs <= (guint) depth) ? vs : 0];
         }
-      gimp_pixel_rgn_set_row (&rgn_out, outrow, 0, y, w);
-      if (y % update_step == 0)
+      gimp_pixel_rgn_set_rect (&rgn_out, (guchar *) strip, 0, y, w, rows);
+
+      if ((y / strip_h) % update_step == 0)
         {
-          gimp_progress_update ((gdouble) y / (h - 1));
+          gimp_progress_update ((gdouble) (y + rows) / h);
         }
     }
 
+  g_free (strip);
+  g_free (palette);
+
   gimp_drawable_flush (drawable);
   gimp_drawable_merge_shadow (seam_layer_ID, TRUE);
   gimp_drawable_update (seam_layer_ID, 0, 0, w, h);
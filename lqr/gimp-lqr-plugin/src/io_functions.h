@@ -40,6 +40,10 @@ struct _VMapFuncArg
 
 #define VMAP_FUNC_ARG(data) ((VMapFuncArg*)(data))
 
+/* writes a carver to a layer, reading it out in a thread of its own
+ * from carver_writer_start until carver_writer_finish is done */
+typedef struct _CarverWriter CarverWriter;
+
 /* INPUT/OUTPUT FUNCTIONS */
 
 guchar *rgb_buffer_from_layer (gint32 layer_ID);
@@ -47,6 +51,8 @@ LqrRetVal update_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
                        gint base_x_off, gint base_y_off);
 LqrRetVal set_rigmask (LqrCarver * r, gint32 layer_ID, gint base_x_off, gint base_y_off);
 LqrRetVal write_carver_to_layer (LqrCarver * r, gint32 layer_ID);
+CarverWriter *carver_writer_start (LqrCarver * r, gint32 layer_ID);
+LqrRetVal carver_writer_finish (CarverWriter * writer);
 LqrRetVal write_vmap_to_layer (LqrVMap * vmap, gpointer data);
 LqrRetVal write_all_vmaps (LqrVMapList * list, gint32 image_ID,
                            gchar * orig_name, gint x_off, gint y_off,
@@ -123,6 +123,7 @@ combo_get_active (GtkWidget * combo, PreviewData * p_data,
     }
   preview_build_pixbuf (p_data);
   gtk_widget_queue_draw (p_data->area);
+  preview_carve (p_data);
 }
 
 
@@ -43,6 +43,7 @@ static void set_aux_layer_name(gint layer_ID, gboolean status, gchar * name);
 static void save_vals (void);
 static void retrieve_vals (void);
 static void retrieve_vals_use_aux_layers_names (gint32 image_ID);
+static void retrieve_frame_vals (void);
 static void noninteractive_read_vals (const GimpParam * param);
 static void install_custom_signals();
 static void cancel_work_on_aux_layer(void);
@@ -80,6 +81,7 @@ const PlugInVals default_vals = {
   FALSE,                        /* scaleback */
   SCALEBACK_MODE_LQRBACK,       /* scaleback mode */
   TRUE,                         /* no disc upon enlarging */
+  FALSE,                        /* resize all layers */
   "",	                        /* pres_layer_name */
   "",                           /* disc_layer_name */
   "",                           /* rigmask_layer_name */
@@ -96,7 +98,9 @@ const PlugInColVals default_col_vals = {
 };
 
 const PlugInImageVals default_image_vals = {
-  0             /* image ID */
+  0,            /* image ID */
+  FALSE,        /* in sequence */
+  0             /* frame step */
 };
 
 const PlugInDrawableVals default_drawable_vals = {
@@ -239,6 +243,20 @@ static void query (void)
                           GIMP_PLUGIN, args_num, 0, args, NULL);
 
   gimp_plugin_menu_register (PLUG_IN_NAME, "<Image>/Layer/");
+
+  /* the same, carving all the visible layers along the seams of the
+   * given one; a procedure of its own, so that the arguments of the
+   * first one stay as they are */
+  gimp_install_procedure (PLUG_IN_ALL_LAYERS_NAME,
+                          "scaling of all visible layers along the seams of one",
+                          "Resize all the visible layers of an image along the "
+                          "seams computed for one of them (the drawable, or "
+                          "selected_layer_name). The other arguments are those of "
+                          PLUG_IN_NAME ".",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>", "2010",
+                          NULL, "RGB*, GRAY*",
+                          GIMP_PLUGIN, args_num, 0, args, NULL);
 }
 
 
@@ -276,6 +294,15 @@ run (const gchar * name,
 #endif
   textdomain (GETTEXT_PACKAGE);
 
+#if !GLIB_CHECK_VERSION(2,32,0)
+  /* the dialog preview is carved by a thread, and the layers are
+   * read out of the carvers by another */
+  if (!g_thread_supported ())
+    {
+      g_thread_init (NULL);
+    }
+#endif
+
   args_num = G_N_ELEMENTS (args);
 
   run_mode = param[0].data.d_int32;
@@ -302,7 +329,23 @@ run (const gchar * name,
   image_vals.image_ID = image_ID;
   drawable_vals.layer_ID = layer_ID;
 
-  if (strcmp (name, PLUG_IN_NAME) == 0)
+  if ((strcmp (name, PLUG_IN_ALL_LAYERS_NAME) == 0) &&
+      (run_mode == GIMP_RUN_NONINTERACTIVE))
+    {
+      if (n_params != args_num)
+        {
+          fprintf(stderr, "gimp-lqr-plugin: error: wrong number of arguments\n");
+          fflush(stderr);
+          status = GIMP_PDB_CALLING_ERROR;
+        }
+      else
+        {
+          noninteractive_read_vals (param);
+          vals.resize_all_layers = TRUE;
+          layer_ID = drawable_vals.layer_ID;
+        }
+    }
+  else if (strcmp (name, PLUG_IN_NAME) == 0)
     {
       switch (run_mode)
         {
@@ -388,6 +431,7 @@ run (const gchar * name,
 
         case GIMP_RUN_WITH_LAST_VALS:
           retrieve_vals_use_aux_layers_names(image_ID);
+          retrieve_frame_vals();
           break;
 
         default:
@@ -430,6 +474,8 @@ run (const gchar * name,
                   gimp_image_undo_group_start (image_ID);
                 }
               render_success = render_noninteractive (&vals, &col_vals, carver_data);
+              g_free (carver_data->extra_layer_IDs);
+              g_free (carver_data->extra_alpha_locks);
             }
         }
 
@@ -517,6 +563,30 @@ retrieve_vals_use_aux_layers_names (gint32 image_ID)
   vals.rigmask_layer_ID = layer_from_name(image_ID, vals.rigmask_layer_name);
 }
 
+/* GAP runs the plug-in with the last values on each frame, after
+ * the iterator has told which frame it is */
+static void
+retrieve_frame_vals (void)
+{
+  PlugInFrameVals frame_vals;
+
+  if (gimp_get_data_size (DATA_KEY_FRAME) != sizeof (frame_vals))
+    {
+      return;
+    }
+  gimp_get_data (DATA_KEY_FRAME, &frame_vals);
+  if (!frame_vals.pending)
+    {
+      return;
+    }
+
+  image_vals.in_sequence = TRUE;
+  image_vals.frame_step = frame_vals.current_step;
+
+  frame_vals.pending = FALSE;
+  gimp_set_data (DATA_KEY_FRAME, &frame_vals, sizeof (frame_vals));
+}
+
 static void
 noninteractive_read_vals (const GimpParam * param)
 {
@@ -44,6 +44,8 @@ typedef enum
 typedef struct
 {
   gint32 image_ID;
+  gboolean in_sequence;         /* a frame of a GAP animation */
+  gdouble frame_step;
 } PlugInImageVals;
 
 typedef struct
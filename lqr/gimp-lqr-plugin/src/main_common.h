@@ -22,11 +22,13 @@
 /*  Constants  */
 
 #define PLUG_IN_NAME   "plug-in-lqr"
+#define PLUG_IN_ALL_LAYERS_NAME "plug-in-lqr-all-layers"
 
 #define DATA_KEY_VALS    "plug_in_lqr"
 #define DATA_KEY_UI_VALS "plug_in_lqr_ui"
 #define DATA_KEY_COL_VALS "plug_in_lqr_col"
 #define PARASITE_KEY     "plug_in_lqr_options"
+#define DATA_KEY_FRAME   "plug_in_lqr_frame"
 
 #define VALS_MAX_NAME_LENGTH (1024)
 #define MAX_STRING_SIZE   (2048)
@@ -53,10 +55,20 @@ typedef struct
   gboolean scaleback;
   gint scaleback_mode;
   gboolean no_disc_on_enlarge;
+  gboolean resize_all_layers;
   gchar pres_layer_name[VALS_MAX_NAME_LENGTH];
   gchar disc_layer_name[VALS_MAX_NAME_LENGTH];
   gchar rigmask_layer_name[VALS_MAX_NAME_LENGTH];
   gchar selected_layer_name[VALS_MAX_NAME_LENGTH];
 } PlugInVals;
 
+/* Set by the GAP iterator before each frame, and cleared by the
+ * plug-in once read */
+typedef struct
+{
+  gboolean pending;
+  gint32 total_steps;
+  gdouble current_step;
+} PlugInFrameVals;
+
 #endif /* __MAIN_COMMON_H__ */
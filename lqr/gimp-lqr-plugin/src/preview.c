@@ -18,20 +18,90 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
 
+#include <lqr.h>
+
 #include "plugin-intl.h"
 
 #include "main.h"
+#include "render.h"
 #include "preview.h"
 
+/***  Preview carving  ***/
+
+/* While the size is being changed, the preview shows the thumbnail
+ * carved to the new size (scaled down like the thumbnail), with the
+ * same energy function and parameters, and the aux layer thumbnails
+ * as bias and rigidity masks. The carving is done by a thread, one job
+ * at a time; a size asked for while a job runs is carved when it
+ * ends. The carver is kept between jobs, so that changing the size
+ * along one direction only resizes it, and it is built anew when the
+ * parameters change, once they have settled (see preview_carve_later). */
+
+typedef struct
+{
+  gint32 pres_layer_ID;
+  gint32 disc_layer_ID;
+  gint32 rigmask_layer_ID;
+  gint pres_coeff;
+  gint disc_coeff;
+  gfloat rigidity;
+  gint delta_x;
+  gint nrg_func;
+  gint res_order;
+  gfloat enl_step;
+} ProxySettings;
+
+typedef struct
+{
+  guchar *buffer;
+  gint bpp;
+  SizeInfo size_info;
+} ProxyAux;
+
+struct _PreviewProxy
+{
+  gboolean busy;
+  gboolean pending;
+  GThread *thread;
+  LqrCarver *carver;
+  ProxySettings settings;
+  /* input of a new carver, owned by the job */
+  guchar *rgb;
+  gint rgb_width;
+  gint rgb_height;
+  gint rgb_bpp;
+  ProxyAux pres;
+  ProxyAux disc;
+  ProxyAux rigmask;
+  /* size asked of the job, and its result */
+  gint width;
+  gint height;
+  guchar *result;
+  gint result_width;
+  gint result_height;
+  gint result_bpp;
+};
+
 /***  Local functions declarations ***/
 
 static gboolean preview_has_pres_buffer(PreviewData * p_data);
 static gboolean preview_has_disc_buffer(PreviewData * p_data);
 static gboolean preview_has_rigmask_buffer(PreviewData * p_data);
 void preview_composite(PreviewData * p_data, GdkPixbuf * src_pixbuf, SizeInfo * size_info);
+static GdkPixbuf * preview_fit_pixbuf (GdkPixbuf * pixbuf);
+static guchar * pixbuf_to_buffer (GdkPixbuf * pixbuf, gint * bpp);
+static void proxy_settings_get (PreviewData * p_data, ProxySettings * settings);
+static void proxy_aux_set (ProxyAux * aux, GdkPixbuf * pixbuf, SizeInfo * size_info, gboolean used);
+static void proxy_input_free (PreviewProxy * proxy);
+static LqrCarver * proxy_carver_new (PreviewProxy * proxy);
+static gpointer proxy_thread (gpointer data);
+static gboolean proxy_done (gpointer data);
+static gboolean preview_carve_timeout (gpointer data);
 
 /***  Functions definitions ***/
 
@@ -50,6 +120,7 @@ callback_pres_combo_set_sensitive_preview (GtkWidget * button, gpointer data)
     }
   preview_build_pixbuf (p_data);
   gtk_widget_queue_draw (p_data->area);
+  preview_carve (p_data);
 }
 
 void
@@ -67,6 +138,7 @@ callback_disc_combo_set_sensitive_preview (GtkWidget * button, gpointer data)
     }
   preview_build_pixbuf (p_data);
   gtk_widget_queue_draw (p_data->area);
+  preview_carve (p_data);
 }
 
 void
@@ -85,6 +157,7 @@ callback_rigmask_combo_set_sensitive_preview (GtkWidget * button,
     }
   preview_build_pixbuf (p_data);
   gtk_widget_queue_draw (p_data->area);
+  preview_carve (p_data);
 }
 
 
@@ -98,6 +171,9 @@ preview_init_mem (PreviewData * p_data)
   p_data->disc_pixbuf = NULL;
   p_data->rigmask_pixbuf = NULL;
   p_data->pixbuf = NULL;
+  p_data->carved_pixbuf = NULL;
+  p_data->proxy = NULL;
+  p_data->carve_source = 0;
 }
 
 void
@@ -168,6 +244,12 @@ preview_build_pixbuf (PreviewData * p_data)
       g_object_unref (G_OBJECT (p_data->pixbuf));
     }
 
+  if (p_data->carved_pixbuf)
+    {
+      p_data->pixbuf = preview_fit_pixbuf (p_data->carved_pixbuf);
+      return;
+    }
+
   p_data->pixbuf = gdk_pixbuf_copy(p_data->base_pixbuf);
 
   if (preview_has_pres_buffer(p_data))
@@ -184,6 +266,140 @@ preview_build_pixbuf (PreviewData * p_data)
     }
 }
 
+/* Carve the preview to the size in vals, see PreviewProxy */
+void
+preview_carve (PreviewData * p_data)
+{
+  PreviewProxy *proxy;
+  ProxySettings settings;
+  PlugInVals *vals = p_data->vals;
+
+  if (p_data->proxy == NULL)
+    {
+      p_data->proxy = g_new0 (PreviewProxy, 1);
+    }
+  proxy = p_data->proxy;
+
+  if (proxy->busy)
+    {
+      proxy->pending = TRUE;
+      return;
+    }
+
+  if ((vals->new_width == p_data->old_width) && (vals->new_height == p_data->old_height))
+    {
+      if (p_data->carved_pixbuf)
+        {
+          g_object_unref (G_OBJECT (p_data->carved_pixbuf));
+          p_data->carved_pixbuf = NULL;
+          preview_build_pixbuf (p_data);
+          gtk_widget_queue_draw (p_data->area);
+        }
+      return;
+    }
+
+  proxy_settings_get (p_data, &settings);
+  if ((proxy->carver) && (memcmp (&settings, &proxy->settings, sizeof (ProxySettings)) != 0))
+    {
+      lqr_carver_destroy (proxy->carver);
+      proxy->carver = NULL;
+    }
+
+  if (proxy->carver == NULL)
+    {
+      proxy->settings = settings;
+      proxy->rgb = pixbuf_to_buffer (p_data->base_pixbuf, &proxy->rgb_bpp);
+      if (proxy->rgb == NULL)
+        {
+          return;
+        }
+      proxy->rgb_width = gdk_pixbuf_get_width (p_data->base_pixbuf);
+      proxy->rgb_height = gdk_pixbuf_get_height (p_data->base_pixbuf);
+      proxy_aux_set (&proxy->pres, p_data->pres_pixbuf, &p_data->pres_size_info,
+                     settings.pres_layer_ID != 0);
+      proxy_aux_set (&proxy->disc, p_data->disc_pixbuf, &p_data->disc_size_info,
+                     settings.disc_layer_ID != 0);
+      proxy_aux_set (&proxy->rigmask, p_data->rigmask_pixbuf, &p_data->rigmask_size_info,
+                     settings.rigmask_layer_ID != 0);
+    }
+
+  /* the thumbnail is scaled down by about p_data->factor */
+  proxy->width = MAX (ROUND ((gdouble) vals->new_width * p_data->width / p_data->old_width), 1);
+  proxy->height = MAX (ROUND ((gdouble) vals->new_height * p_data->height / p_data->old_height), 1);
+
+  proxy->busy = TRUE;
+#if GLIB_CHECK_VERSION(2,32,0)
+  proxy->thread = g_thread_try_new ("lqr-preview", proxy_thread, p_data, NULL);
+#else
+  proxy->thread = g_thread_create (proxy_thread, p_data, TRUE, NULL);
+#endif
+  if (proxy->thread == NULL)
+    {
+      /* it is small enough to be carved right away */
+      proxy_thread (p_data);
+    }
+}
+
+/* Carve the preview once the parameters have not changed for
+ * PREVIEW_CARVE_DELAY ms: a change of parameters builds the carver
+ * anew, which is not worth doing for each step of a slider */
+void
+preview_carve_later (PreviewData * p_data)
+{
+  if (p_data->carve_source)
+    {
+      g_source_remove (p_data->carve_source);
+    }
+  p_data->carve_source = g_timeout_add (PREVIEW_CARVE_DELAY, preview_carve_timeout, p_data);
+}
+
+static gboolean
+preview_carve_timeout (gpointer data)
+{
+  PreviewData *p_data = PREVIEW_DATA (data);
+
+  p_data->carve_source = 0;
+  preview_carve (p_data);
+
+  return FALSE;
+}
+
+/* Wait for the job running, if any, and free the carver */
+void
+preview_proxy_free (PreviewData * p_data)
+{
+  PreviewProxy *proxy = p_data->proxy;
+
+  if (p_data->carve_source)
+    {
+      g_source_remove (p_data->carve_source);
+      p_data->carve_source = 0;
+    }
+
+  if (proxy)
+    {
+      if (proxy->thread)
+        {
+          g_thread_join (proxy->thread);
+        }
+      g_idle_remove_by_data (p_data);
+      if (proxy->carver)
+        {
+          lqr_carver_destroy (proxy->carver);
+        }
+      proxy_input_free (proxy);
+      g_free (proxy->result);
+      g_free (proxy);
+      p_data->proxy = NULL;
+    }
+
+  if (p_data->carved_pixbuf)
+    {
+      g_object_unref (G_OBJECT (p_data->carved_pixbuf));
+      p_data->carved_pixbuf = NULL;
+    }
+}
+
 void
 callback_preview_expose_event (GtkWidget * preview_area,
 			       GdkEventExpose * event, gpointer data)
@@ -192,8 +408,8 @@ callback_preview_expose_event (GtkWidget * preview_area,
 
   gdk_draw_pixbuf (gtk_widget_get_window(p_data->area), NULL,
 		   p_data->pixbuf, 0, 0,
-		   (PREVIEW_MAX_WIDTH - p_data->width) / 2,
-		   (PREVIEW_MAX_HEIGHT - p_data->height) / 2,
+		   (PREVIEW_MAX_WIDTH - gdk_pixbuf_get_width (p_data->pixbuf)) / 2,
+		   (PREVIEW_MAX_HEIGHT - gdk_pixbuf_get_height (p_data->pixbuf)) / 2,
 		   -1, -1, GDK_RGB_DITHER_NORMAL, 0, 0);
 
   update_info_aux_use_icons(p_data->vals, p_data->ui_vals, p_data->pres_use_image, p_data->disc_use_image, p_data->rigmask_use_image);
@@ -260,3 +476,256 @@ update_info_aux_use_icons(PlugInVals *vals, PlugInUIVals *ui_vals, GtkWidget *pr
     }
 }
 
+/* Preview carving */
+
+/* fit into the preview area, as enlarging may not */
+static GdkPixbuf *
+preview_fit_pixbuf (GdkPixbuf * pixbuf)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gdouble scale;
+
+  if ((width <= PREVIEW_MAX_WIDTH) && (height <= PREVIEW_MAX_HEIGHT))
+    {
+      return gdk_pixbuf_copy (pixbuf);
+    }
+
+  scale = MIN ((gdouble) PREVIEW_MAX_WIDTH / width, (gdouble) PREVIEW_MAX_HEIGHT / height);
+  return gdk_pixbuf_scale_simple (pixbuf, MAX (ROUND (width * scale), 1),
+                                  MAX (ROUND (height * scale), 1),
+                                  GDK_INTERP_BILINEAR);
+}
+
+/* the pixels without the row padding, as liblqr wants them */
+static guchar *
+pixbuf_to_buffer (GdkPixbuf * pixbuf, gint * bpp)
+{
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  guchar *buffer;
+  gint y;
+
+  *bpp = gdk_pixbuf_get_n_channels (pixbuf);
+  buffer = g_try_new (guchar, width * height * *bpp);
+  if (buffer == NULL)
+    {
+      return NULL;
+    }
+
+  for (y = 0; y < height; y++)
+    {
+      memcpy (buffer + y * width * *bpp, pixels + y * rowstride, width * *bpp);
+    }
+
+  return buffer;
+}
+
+/* what the carver depends on, other than the thumbnails */
+static void
+proxy_settings_get (PreviewData * p_data, ProxySettings * settings)
+{
+  PlugInVals *vals = p_data->vals;
+
+  memset (settings, 0, sizeof (ProxySettings));
+
+  if (preview_has_pres_buffer (p_data))
+    {
+      settings->pres_layer_ID = vals->pres_layer_ID;
+      settings->pres_coeff = vals->pres_coeff;
+    }
+  if ((preview_has_disc_buffer (p_data)) &&
+      (!compute_ignore_disc_mask (vals, p_data->old_width, p_data->old_height,
+                                  vals->new_width, vals->new_height)))
+    {
+      settings->disc_layer_ID = vals->disc_layer_ID;
+      settings->disc_coeff = vals->disc_coeff;
+    }
+  if (preview_has_rigmask_buffer (p_data))
+    {
+      settings->rigmask_layer_ID = vals->rigmask_layer_ID;
+    }
+  settings->rigidity = vals->rigidity;
+  settings->delta_x = vals->delta_x;
+  settings->nrg_func = vals->nrg_func;
+  settings->res_order = vals->res_order;
+  settings->enl_step = vals->enl_step;
+}
+
+static void
+proxy_aux_set (ProxyAux * aux, GdkPixbuf * pixbuf, SizeInfo * size_info, gboolean used)
+{
+  aux->buffer = NULL;
+  if ((!used) || (pixbuf == NULL))
+    {
+      return;
+    }
+
+  aux->buffer = pixbuf_to_buffer (pixbuf, &aux->bpp);
+  aux->size_info = *size_info;
+  aux->size_info.width = gdk_pixbuf_get_width (pixbuf);
+  aux->size_info.height = gdk_pixbuf_get_height (pixbuf);
+}
+
+static void
+proxy_input_free (PreviewProxy * proxy)
+{
+  g_free (proxy->rgb);
+  g_free (proxy->pres.buffer);
+  g_free (proxy->disc.buffer);
+  g_free (proxy->rigmask.buffer);
+  proxy->rgb = NULL;
+  proxy->pres.buffer = NULL;
+  proxy->disc.buffer = NULL;
+  proxy->rigmask.buffer = NULL;
+}
+
+/* As render_init_carver, from the thumbnails. Called by the job */
+static LqrCarver *
+proxy_carver_new (PreviewProxy * proxy)
+{
+  LqrCarver *carver;
+  ProxySettings *settings = &proxy->settings;
+  gfloat rigidity;
+  LqrRetVal ret;
+
+  carver = lqr_carver_new (proxy->rgb, proxy->rgb_width, proxy->rgb_height, proxy->rgb_bpp);
+  if (carver == NULL)
+    {
+      proxy_input_free (proxy);
+      return NULL;
+    }
+  /* the carver owns it now */
+  proxy->rgb = NULL;
+
+  rigidity = settings->rigidity;
+  if (settings->rigmask_layer_ID != 0)
+    {
+      rigidity *= 3;
+    }
+
+  ret = lqr_carver_init (carver, settings->delta_x, rigidity);
+  if ((ret == LQR_OK) && (proxy->pres.buffer))
+    {
+      ret = lqr_carver_bias_add_rgb_area (carver, proxy->pres.buffer, settings->pres_coeff,
+                                          proxy->pres.bpp, proxy->pres.size_info.width,
+                                          proxy->pres.size_info.height,
+                                          proxy->pres.size_info.x_off,
+                                          proxy->pres.size_info.y_off);
+    }
+  if ((ret == LQR_OK) && (proxy->disc.buffer))
+    {
+      ret = lqr_carver_bias_add_rgb_area (carver, proxy->disc.buffer, -settings->disc_coeff,
+                                          proxy->disc.bpp, proxy->disc.size_info.width,
+                                          proxy->disc.size_info.height,
+                                          proxy->disc.size_info.x_off,
+                                          proxy->disc.size_info.y_off);
+    }
+  if ((ret == LQR_OK) && (proxy->rigmask.buffer))
+    {
+      ret = lqr_carver_rigmask_add_rgb_area (carver, proxy->rigmask.buffer,
+                                             proxy->rigmask.bpp,
+                                             proxy->rigmask.size_info.width,
+                                             proxy->rigmask.size_info.height,
+                                             proxy->rigmask.size_info.x_off,
+                                             proxy->rigmask.size_info.y_off);
+    }
+  proxy_input_free (proxy);
+
+  if (ret != LQR_OK)
+    {
+      lqr_carver_destroy (carver);
+      return NULL;
+    }
+
+  lqr_carver_set_energy_function_builtin (carver, settings->nrg_func);
+  lqr_carver_set_resize_order (carver, settings->res_order);
+  lqr_carver_set_side_switch_frequency (carver, 2);
+  lqr_carver_set_enl_step (carver, settings->enl_step / 100);
+
+  return carver;
+}
+
+/* The job: no GIMP or GTK+ calls in here */
+static gpointer
+proxy_thread (gpointer data)
+{
+  PreviewData *p_data = PREVIEW_DATA (data);
+  PreviewProxy *proxy = p_data->proxy;
+  gint x, y, bpp;
+  guchar *rgb;
+
+  if (proxy->carver == NULL)
+    {
+      proxy->carver = proxy_carver_new (proxy);
+    }
+
+  if ((proxy->carver) &&
+      (lqr_carver_resize (proxy->carver, proxy->width, proxy->height) == LQR_OK))
+    {
+      proxy->result_width = lqr_carver_get_width (proxy->carver);
+      proxy->result_height = lqr_carver_get_height (proxy->carver);
+      proxy->result_bpp = bpp = lqr_carver_get_channels (proxy->carver);
+      proxy->result = g_try_new (guchar, proxy->result_width * proxy->result_height * bpp);
+      if (proxy->result)
+        {
+          lqr_carver_scan_reset (proxy->carver);
+          while (lqr_carver_scan (proxy->carver, &x, &y, &rgb))
+            {
+              memcpy (proxy->result + (y * proxy->result_width + x) * bpp, rgb, bpp);
+            }
+        }
+    }
+
+  g_idle_add (proxy_done, p_data);
+
+  return NULL;
+}
+
+/* Back in the main loop: show the result, and carve to the size asked
+ * for meanwhile, if any */
+static gboolean
+proxy_done (gpointer data)
+{
+  PreviewData *p_data = PREVIEW_DATA (data);
+  PreviewProxy *proxy = p_data->proxy;
+
+  if (proxy->thread)
+    {
+      g_thread_join (proxy->thread);
+      proxy->thread = NULL;
+    }
+  proxy->busy = FALSE;
+
+  if (proxy->result)
+    {
+      if (p_data->carved_pixbuf)
+        {
+          g_object_unref (G_OBJECT (p_data->carved_pixbuf));
+        }
+      p_data->carved_pixbuf =
+        gdk_pixbuf_new_from_data (proxy->result, GDK_COLORSPACE_RGB, (proxy->result_bpp == 4),
+                                  8, proxy->result_width, proxy->result_height,
+                                  proxy->result_width * proxy->result_bpp,
+                                  (GdkPixbufDestroyNotify) g_free, NULL);
+      proxy->result = NULL;
+      preview_build_pixbuf (p_data);
+      gtk_widget_queue_draw (p_data->area);
+    }
+  else if (proxy->carver)
+    {
+      /* start afresh next time */
+      lqr_carver_destroy (proxy->carver);
+      proxy->carver = NULL;
+    }
+
+  if (proxy->pending)
+    {
+      proxy->pending = FALSE;
+      preview_carve (p_data);
+    }
+
+  return FALSE;
+}
@@ -25,6 +25,7 @@
 
 #define PREVIEW_MAX_WIDTH  300
 #define PREVIEW_MAX_HEIGHT 200
+#define PREVIEW_CARVE_DELAY (300)
 
 typedef struct
 {
@@ -34,6 +35,10 @@ typedef struct
   gint height;
 } SizeInfo;
 
+/*  Carving of the preview, see preview_carve */
+
+typedef struct _PreviewProxy PreviewProxy;
+
 /*  Preview data struct */
 
 typedef struct
@@ -59,6 +64,9 @@ typedef struct
   GdkPixbuf *disc_pixbuf;
   GdkPixbuf *rigmask_pixbuf;
   GdkPixbuf *pixbuf;
+  GdkPixbuf *carved_pixbuf;
+  PreviewProxy *proxy;
+  guint carve_source;
   GtkWidget *dlg;
   GtkWidget *area;
   GtkWidget *pres_combo;
@@ -93,6 +101,9 @@ void preview_init_mem (PreviewData * preview_data);
 void preview_data_create(gint32 image_ID, gint32 layer_ID, PreviewData * p_data);
 GtkWidget * preview_area_create(PreviewData * p_data);
 void preview_build_pixbuf (PreviewData * preview_data);
+void preview_carve (PreviewData * preview_data);
+void preview_carve_later (PreviewData * preview_data);
+void preview_proxy_free (PreviewData * preview_data);
 
 void
 callback_preview_expose_event (GtkWidget * preview_area,
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 
 #include "io_functions.h"
+#include "vmap_cache.h"
+#include "vmap_frames.h"
 
 #include "plugin-intl.h"
 
@@ -45,6 +47,9 @@
 #define MEM_CHECK(x) if ((x) == NULL) { g_message(_("Not enough memory")); return FALSE; }
 #define MEM_CHECK1(x) if ((x) == LQR_NOMEM) { g_message(_("Not enough memory")); return FALSE; }
 #define MEM_CHECK2(x) if ((x) == FALSE) { g_message(_("Not enough memory")); return FALSE; }
+/* in render_init_carver, once the layers carved along are listed */
+#define MEM_CHECK_EXTRA_N(x) if ((x) == NULL) { g_free (extra_layer_IDs); g_free (extra_alpha_locks); g_message(_("Not enough memory")); return NULL; }
+#define MEM_CHECK1_EXTRA_N(x) if ((x) == LQR_NOMEM) { g_free (extra_layer_IDs); g_free (extra_alpha_locks); g_message(_("Not enough memory")); return NULL; }
 
 #define BPP_CHECK(layer_ID, carver) G_STMT_START { \
   if (gimp_drawable_bpp(layer_ID) != lqr_carver_get_channels(carver)) \
@@ -91,13 +96,16 @@
 static gboolean my_progress_end (const gchar * message);
 static LqrProgress * progress_init (void);
 static gfloat rigidity_init (PlugInVals * vals);
-static gboolean compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gint new_width, gint new_height);
-static void set_tiles (gint width);
+static gboolean vmap_shrink_direction (gint old_width, gint old_height, gint new_width, gint new_height, gint * orientation, gint * seams);
+static gboolean use_vmap_cache (PlugInVals * vals);
+static void set_tiles (gint width, gint height);
 static gboolean check_aux_layer_bpp (LqrCarverList ** carver_list_p, gint32 layer_ID);
 static gboolean copy_aux_layer_to_new_image (gint32 image_ID, gint32 * layer_ID, gint x_off, gint y_off);
 static gboolean resize_unlock_aux_layer (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off);
 static LqrCarver* attach_aux_carver (LqrCarver * carver, gint32 layer_ID, gint width, gint height);
-static gboolean write_aux_carver (LqrCarverList ** carver_list_p, gint32 layer_ID, gint width, gint height);
+static gboolean start_aux_writer (LqrCarverList ** carver_list_p, gint32 layer_ID, gint width, gint height, CarverWriter ** writer_p);
+static gboolean write_carvers (CarverData * carver_data, gint32 layer_ID, PlugInVals * vals, gint width, gint height);
+static gint32 *layers_to_carve (gint32 image_ID, gint32 layer_ID, PlugInVals * vals, gint * n_layers_p);
 static void scale_layer_translated (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off);
 
 /* render functions */
@@ -124,6 +132,16 @@ render_init_carver (PlugInImageVals * image_vals,
   gint x_off, y_off;
   gboolean ignore_disc_mask = FALSE;
   LqrProgress *progress;
+  gchar *cache_key = NULL;
+  LqrVMap *vmap = NULL;
+  gint cache_orientation = 0;
+  gint cache_seams = 0;
+  gint32 source_layer_ID;
+  FrameState *frame_state = NULL;
+  gint32 *extra_layer_IDs = NULL;
+  gboolean *extra_alpha_locks = NULL;
+  gint n_extra_layers = 0;
+  gint i;
 #ifdef __CLOCK_IT__
   double clock1, clock2;
 #endif /* __CLOCK_IT__ */
@@ -155,6 +173,9 @@ render_init_carver (PlugInImageVals * image_vals,
   gimp_drawable_offsets (layer_ID, &x_off, &y_off);
   bpp = gimp_drawable_bpp (layer_ID);
 
+  /* the layer keeps its contents, and so the seam maps stay valid for it */
+  source_layer_ID = (vals->output_target != OUTPUT_TARGET_SAME_LAYER) ? layer_ID : 0;
+
   new_width = vals->new_width;
   new_height = vals->new_height;
   rigidity = rigidity_init(vals);
@@ -207,7 +228,7 @@ render_init_carver (PlugInImageVals * image_vals,
       alpha_lock_rigmask = resize_unlock_aux_layer (vals->rigmask_layer_ID, old_width, old_height, x_off, y_off);
     }
 
-  set_tiles (old_width);
+  set_tiles (old_width, old_height);
 
   progress = progress_init();
   MEM_CHECK_N (progress);
@@ -220,32 +241,114 @@ render_init_carver (PlugInImageVals * image_vals,
   /* lqr carver initialization */
   rgb_buffer = rgb_buffer_from_layer (layer_ID);
   MEM_CHECK_N (rgb_buffer);
-  carver = lqr_carver_new (rgb_buffer, old_width, old_height, bpp);
-  MEM_CHECK_N (carver);
-  MEM_CHECK1_N (lqr_carver_init (carver, vals->delta_x, rigidity));
-  MEM_CHECK1_N (update_bias
-               (carver, vals->pres_layer_ID, vals->pres_coeff, x_off, y_off));
-  if (!ignore_disc_mask)
-    {
-      MEM_CHECK1_N (update_bias
-                 (carver, vals->disc_layer_ID, -vals->disc_coeff, x_off, y_off));
-    }
-  MEM_CHECK1_N (set_rigmask
-               (carver, vals->rigmask_layer_ID, x_off, y_off));
-  lqr_carver_set_energy_function_builtin (carver, vals->nrg_func);
-  lqr_carver_set_resize_order (carver, vals->res_order);
-  lqr_carver_set_progress (carver, progress);
-  lqr_carver_set_side_switch_frequency (carver, 2);
-  lqr_carver_set_enl_step (carver, vals->enl_step / 100);
-  if ((!interactive) && (vals->output_seams))
-    {
-      lqr_carver_set_dump_vmaps (carver);
+  if ((!interactive) &&
+      vmap_shrink_direction (old_width, old_height, new_width, new_height, &cache_orientation, &cache_seams))
+    {
+      if ((use_vmap_cache (vals)) && (image_vals->in_sequence))
+        {
+          /* the frames of an animation go by the previous frame
+           * instead of the cache, which they would only fill */
+          frame_state = frame_state_new (image_ID, rgb_buffer, old_width, old_height, bpp, vals,
+                                         image_vals->frame_step, cache_orientation, cache_seams);
+          vmap = frame_state_reuse (frame_state);
+        }
+      else if (use_vmap_cache (vals))
+        {
+          cache_key = vmap_cache_key (rgb_buffer, old_width, old_height, bpp, vals,
+                                      ignore_disc_mask, x_off, y_off);
+          if (source_layer_ID)
+            {
+              vmap = vmap_parasite_lookup (source_layer_ID, cache_key, old_width, old_height,
+                                           cache_orientation, cache_seams);
+            }
+          if ((vmap == NULL) && vmap_cache_enabled ())
+            {
+              vmap = vmap_cache_lookup (cache_key, old_width, old_height, cache_orientation, cache_seams);
+            }
+        }
+      else if ((vals->output_seams) && (source_layer_ID))
+        {
+          cache_key = vmap_cache_key (rgb_buffer, old_width, old_height, bpp, vals,
+                                      ignore_disc_mask, x_off, y_off);
+        }
     }
-  if (vals->resize_aux_layers)
+  else if ((interactive) && (source_layer_ID))
     {
-      attach_aux_carver (carver, vals->pres_layer_ID, old_width, old_height);
-      attach_aux_carver (carver, vals->disc_layer_ID, old_width, old_height);
-      attach_aux_carver (carver, vals->rigmask_layer_ID, old_width, old_height);
+      /* for render_dump_vmap */
+      cache_key = vmap_cache_key (rgb_buffer, old_width, old_height, bpp, vals,
+                                  ignore_disc_mask, x_off, y_off);
+    }
+  /* the other layers follow the seams of this one, after the
+   * auxiliary layers in the list of attached carvers */
+  if ((vals->resize_all_layers) && (vals->output_target == OUTPUT_TARGET_SAME_LAYER))
+    {
+      extra_layer_IDs = layers_to_carve (image_ID, layer_ID, vals, &n_extra_layers);
+      extra_alpha_locks = g_new (gboolean, MAX (n_extra_layers, 1));
+      for (i = 0; i < n_extra_layers; i++)
+        {
+          extra_alpha_locks[i] = resize_unlock_aux_layer (extra_layer_IDs[i], old_width, old_height, x_off, y_off);
+        }
+    }
+
+  /* with a stored map, the energy and the seams need not be computed;
+   * if the map does not load, they are, on a new carver */
+  while (TRUE)
+    {
+      carver = lqr_carver_new (rgb_buffer, old_width, old_height, bpp);
+      MEM_CHECK_EXTRA_N (carver);
+      if (vmap == NULL)
+        {
+          MEM_CHECK1_EXTRA_N (lqr_carver_init (carver, vals->delta_x, rigidity));
+          MEM_CHECK1_EXTRA_N (update_bias
+                       (carver, vals->pres_layer_ID, vals->pres_coeff, x_off, y_off));
+          if (!ignore_disc_mask)
+            {
+              MEM_CHECK1_EXTRA_N (update_bias
+                         (carver, vals->disc_layer_ID, -vals->disc_coeff, x_off, y_off));
+            }
+          MEM_CHECK1_EXTRA_N (set_rigmask
+                       (carver, vals->rigmask_layer_ID, x_off, y_off));
+          if (frame_state)
+            {
+              MEM_CHECK1_EXTRA_N (frame_state_bias (frame_state, carver));
+            }
+          lqr_carver_set_energy_function_builtin (carver, vals->nrg_func);
+        }
+      lqr_carver_set_resize_order (carver, vals->res_order);
+      lqr_carver_set_progress (carver, progress);
+      lqr_carver_set_side_switch_frequency (carver, 2);
+      lqr_carver_set_enl_step (carver, vals->enl_step / 100);
+      if ((!interactive) && (vals->output_seams))
+        {
+          lqr_carver_set_dump_vmaps (carver);
+        }
+      if (vals->resize_aux_layers)
+        {
+          attach_aux_carver (carver, vals->pres_layer_ID, old_width, old_height);
+          attach_aux_carver (carver, vals->disc_layer_ID, old_width, old_height);
+          attach_aux_carver (carver, vals->rigmask_layer_ID, old_width, old_height);
+        }
+      for (i = 0; i < n_extra_layers; i++)
+        {
+          attach_aux_carver (carver, extra_layer_IDs[i], old_width, old_height);
+        }
+      if (vmap == NULL)
+        {
+          break;
+        }
+      if (lqr_vmap_load (carver, vmap) == LQR_OK)
+        {
+          /* vmap is left set, as a sign that the map was not computed */
+          lqr_vmap_destroy (vmap);
+          break;
+        }
+
+      /* the carver took the buffer with it */
+      lqr_vmap_destroy (vmap);
+      vmap = NULL;
+      lqr_carver_destroy (carver);
+      rgb_buffer = rgb_buffer_from_layer (layer_ID);
+      MEM_CHECK_EXTRA_N (rgb_buffer);
     }
 
 #ifdef __CLOCK_IT__
@@ -253,7 +356,7 @@ render_init_carver (PlugInImageVals * image_vals,
   printf ("[ read: %g ]\n", clock2 - clock1);
 #endif /* __CLOCK_IT__ */
 
-  MEM_CHECK_N(carver_data = calloc(1, sizeof(CarverData)));
+  MEM_CHECK_EXTRA_N(carver_data = calloc(1, sizeof(CarverData)));
 
   carver_data->carver = carver;
   carver_data->image_ID = image_ID;
@@ -270,6 +373,22 @@ render_init_carver (PlugInImageVals * image_vals,
   carver_data->depth = 0;
   carver_data->enl_step = vals->enl_step / 100;
 
+  /* only a freshly computed map goes to the cache */
+  if (vmap == NULL)
+    {
+      carver_data->cache_key = cache_key;
+      carver_data->cache_seams = cache_seams;
+      carver_data->source_layer_ID = source_layer_ID;
+    }
+  else
+    {
+      g_free (cache_key);
+    }
+  carver_data->frame_state = frame_state;
+  carver_data->extra_layer_IDs = extra_layer_IDs;
+  carver_data->extra_alpha_locks = extra_alpha_locks;
+  carver_data->n_extra_layers = n_extra_layers;
+
   return carver_data;
 }
 
@@ -279,7 +398,6 @@ render_noninteractive (PlugInVals * vals,
         CarverData * carver_data)
 {
   LqrCarver *carver;
-  LqrCarverList *carver_list;
   gint32 image_ID;
   gint32 layer_ID;
   gchar layer_name[LQR_MAX_NAME_LENGTH];
@@ -289,7 +407,9 @@ render_noninteractive (PlugInVals * vals,
   gint new_width, new_height;
   gint sb_width, sb_height;
   gint x_off, y_off;
+  gint i;
   GimpRGB colour_start, colour_end;
+  LqrRetVal resize_result;
 #ifdef __CLOCK_IT__
   double clock1, clock2, clock3;
 #endif /* __CLOCK_IT__ */
@@ -316,7 +436,32 @@ render_noninteractive (PlugInVals * vals,
   clock1 = (double) clock () / CLOCKS_PER_SEC;
 #endif /* __CLOCK_IT__ */
 
-  MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+  MEM_CHECK1 (resize_result = lqr_carver_resize (carver, new_width, new_height));
+
+  if ((carver_data->cache_key) && (resize_result == LQR_OK))
+    {
+      LqrVMap *vmap;
+
+      vmap = lqr_vmap_dump (carver);
+      if (vmap != NULL)
+        {
+          vmap_cache_store (carver_data->cache_key, vmap, carver_data->cache_seams);
+          if ((vals->output_seams) && (carver_data->source_layer_ID))
+            {
+              vmap_parasite_attach (carver_data->source_layer_ID, carver_data->cache_key,
+                                    vmap, carver_data->cache_seams);
+            }
+          lqr_vmap_destroy (vmap);
+        }
+    }
+  if ((carver_data->frame_state) && (resize_result == LQR_OK))
+    {
+      frame_state_store (carver_data->frame_state, carver);
+    }
+  frame_state_free (carver_data->frame_state);
+  carver_data->frame_state = NULL;
+  g_free (carver_data->cache_key);
+  carver_data->cache_key = NULL;
 
   if (vals->scaleback)
     {
@@ -362,17 +507,9 @@ render_noninteractive (PlugInVals * vals,
   fflush (stdout);
 #endif /* __CLOCK_IT__ */
 
-  set_tiles (new_width);
-
-  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
+  set_tiles (new_width, new_height);
 
-  if (vals->resize_aux_layers)
-    {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, new_width, new_height));
-    }
+  MEM_CHECK2 (write_carvers (carver_data, layer_ID, vals, new_width, new_height));
 
   lqr_carver_destroy (carver);
 
@@ -427,6 +564,10 @@ render_noninteractive (PlugInVals * vals,
                   scale_layer_translated (vals->rigmask_layer_ID, sb_width, sb_height, x_off, y_off);
                 }
             }
+          for (i = 0; i < carver_data->n_extra_layers; i++)
+            {
+              scale_layer_translated (carver_data->extra_layer_IDs[i], sb_width, sb_height, x_off, y_off);
+            }
           break;
         default:
           g_message ("error: unknown mode");
@@ -459,6 +600,10 @@ render_noninteractive (PlugInVals * vals,
           gimp_layer_set_lock_alpha (vals->rigmask_layer_ID, alpha_lock_rigmask);
         }
     }
+  for (i = 0; i < carver_data->n_extra_layers; i++)
+    {
+      gimp_layer_set_lock_alpha (carver_data->extra_layer_IDs[i], carver_data->extra_alpha_locks[i]);
+    }
 
   return TRUE;
 }
@@ -475,6 +620,7 @@ render_interactive (PlugInVals * vals,
   gint old_width, old_height;
   gint new_width, new_height;
   gint x_off, y_off;
+  gint i;
 #ifdef __CLOCK_IT__
   double clock1, clock2, clock3;
 #endif /* __CLOCK_IT__ */
@@ -522,6 +668,10 @@ render_interactive (PlugInVals * vals,
       resize_unlock_aux_layer (vals->disc_layer_ID, old_width, old_height, x_off, y_off);
       resize_unlock_aux_layer (vals->rigmask_layer_ID, old_width, old_height, x_off, y_off);
     }
+  for (i = 0; i < carver_data->n_extra_layers; i++)
+    {
+      resize_unlock_aux_layer (carver_data->extra_layer_IDs[i], old_width, old_height, x_off, y_off);
+    }
 
 #ifdef __CLOCK_IT__
   clock1 = (double) clock () / CLOCKS_PER_SEC;
@@ -551,17 +701,9 @@ render_interactive (PlugInVals * vals,
   carver_data->depth = lqr_carver_get_depth (carver);
   carver_data->enl_step = lqr_carver_get_enl_step (carver);
 
-  set_tiles (new_width);
-
-  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
+  set_tiles (new_width, new_height);
 
-  if (vals->resize_aux_layers)
-    {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, new_width, new_height));
-    }
+  MEM_CHECK2 (write_carvers (carver_data, layer_ID, vals, new_width, new_height));
 
 #ifdef __CLOCK_IT__
   clock3 = (double) clock () / CLOCKS_PER_SEC;
@@ -585,6 +727,7 @@ render_flatten (PlugInVals * vals,
   gchar layer_name[LQR_MAX_NAME_LENGTH];
   gint old_width, old_height;
   gint x_off, y_off;
+  gint i;
 #ifdef __CLOCK_IT__
   double clock1, clock2, clock3;
 #endif /* __CLOCK_IT__ */
@@ -629,6 +772,10 @@ render_flatten (PlugInVals * vals,
       resize_unlock_aux_layer (vals->disc_layer_ID, old_width, old_height, x_off, y_off);
       resize_unlock_aux_layer (vals->rigmask_layer_ID, old_width, old_height, x_off, y_off);
     }
+  for (i = 0; i < carver_data->n_extra_layers; i++)
+    {
+      resize_unlock_aux_layer (carver_data->extra_layer_IDs[i], old_width, old_height, x_off, y_off);
+    }
 
 #ifdef __CLOCK_IT__
   clock1 = (double) clock () / CLOCKS_PER_SEC;
@@ -636,6 +783,11 @@ render_flatten (PlugInVals * vals,
 
   MEM_CHECK1 (lqr_carver_flatten (carver));
 
+  /* the carver no longer starts from the source layer, so its seams
+   * must not be stored under the source's key */
+  g_free (carver_data->cache_key);
+  carver_data->cache_key = NULL;
+
   if (vals->resize_canvas == TRUE)
     {
       gimp_image_resize (image_ID, old_width, old_height, -x_off, -y_off);
@@ -658,17 +810,9 @@ render_flatten (PlugInVals * vals,
   carver_data->depth = lqr_carver_get_depth (carver);
   carver_data->enl_step = lqr_carver_get_enl_step (carver);
 
-  set_tiles (old_width);
+  set_tiles (old_width, old_height);
 
-  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
-
-  if (vals->resize_aux_layers)
-    {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, old_width, old_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, old_width, old_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, old_width, old_height));
-    }
+  MEM_CHECK2 (write_carvers (carver_data, layer_ID, vals, old_width, old_height));
 
 #ifdef __CLOCK_IT__
   clock3 = (double) clock () / CLOCKS_PER_SEC;
@@ -697,6 +841,8 @@ render_dump_vmap (PlugInVals * vals,
   gint old_width, old_height;
   gint x_off, y_off;
   GimpRGB colour_start, colour_end;
+  LqrRetVal resize_result;
+  gint orientation, seams;
 #ifdef __CLOCK_IT__
   double clock1, clock2, clock3;
 #endif /* __CLOCK_IT__ */
@@ -749,10 +895,27 @@ render_dump_vmap (PlugInVals * vals,
   vmap_data.colour_end = colour_end;
   vmap_data.vmap_layer_ID_p = vmap_layer_ID_p;
 
-  set_tiles (lqr_vmap_get_width(vmap));
+  set_tiles (lqr_vmap_get_width (vmap), lqr_vmap_get_height (vmap));
 
   MEM_CHECK1 (write_vmap_to_layer (vmap, (gpointer) (&vmap_data)));
 
+  /* keep the map with the layer it was computed from, if the carver
+   * was only shrunk along one side */
+  if ((carver_data->cache_key) && (carver_data->source_layer_ID) &&
+      (gimp_drawable_is_valid (carver_data->source_layer_ID)) &&
+      (lqr_carver_get_ref_width (carver) == gimp_drawable_width (carver_data->source_layer_ID)) &&
+      (lqr_carver_get_ref_height (carver) == gimp_drawable_height (carver_data->source_layer_ID)) &&
+      vmap_shrink_direction (lqr_carver_get_ref_width (carver), lqr_carver_get_ref_height (carver),
+                             lqr_carver_get_width (carver), lqr_carver_get_height (carver),
+                             &orientation, &seams) &&
+      (orientation == lqr_vmap_get_orientation (vmap)))
+    {
+      if (!vmap_parasite_attach (carver_data->source_layer_ID, carver_data->cache_key, vmap, seams))
+        {
+          vmap_cache_store (carver_data->cache_key, vmap, seams);
+        }
+    }
+
 #ifdef __CLOCK_IT__
   clock3 = (double) clock () / CLOCKS_PER_SEC;
   printf ("[ finish: %g ]\n\n", clock3 - clock2);
@@ -797,7 +960,7 @@ rigidity_init (PlugInVals * vals)
     }
 }
 
-static gboolean
+gboolean
 compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gint new_width, gint new_height)
 {
   if (!vals->no_disc_on_enlarge)
@@ -826,10 +989,41 @@ compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gi
   return FALSE;
 }
 
+/* A stored map can only shrink the layer, along the direction it was
+ * computed for; this tells which direction and by how many seams */
+static gboolean
+vmap_shrink_direction (gint old_width, gint old_height, gint new_width, gint new_height, gint * orientation, gint * seams)
+{
+  if ((new_width < old_width) && (new_height == old_height))
+    {
+      *orientation = 0;
+      *seams = old_width - new_width;
+      return TRUE;
+    }
+  if ((new_height < old_height) && (new_width == old_width))
+    {
+      *orientation = 1;
+      *seams = old_height - new_height;
+      return TRUE;
+    }
+  return FALSE;
+}
+
+/* The seams output and the liquid scaleback need a carver which
+ * computes its own maps */
+static gboolean
+use_vmap_cache (PlugInVals * vals)
+{
+  return !((vals->output_seams) ||
+           ((vals->scaleback) && (vals->scaleback_mode == SCALEBACK_MODE_LQRBACK)));
+}
+
+/* enough for a strip of tiles along either side, as read and written
+ * by io_functions.c, with their shadow tiles */
 static void
-set_tiles (gint width)
+set_tiles (gint width, gint height)
 {
-  gint ntiles = width / gimp_tile_width () + 1;
+  gint ntiles = MAX (width / gimp_tile_width (), height / gimp_tile_height ()) + 1;
   gimp_tile_cache_size ((gimp_tile_width () * gimp_tile_height () * ntiles *
                          4 * 2) / 1024 + 1);
 }
@@ -908,21 +1102,148 @@ attach_aux_carver (LqrCarver * carver, gint32 layer_ID, gint width, gint height)
 }
 
 static gboolean
-write_aux_carver (LqrCarverList ** carver_list_p, gint32 layer_ID, gint width, gint height)
+start_aux_writer (LqrCarverList ** carver_list_p, gint32 layer_ID, gint width, gint height, CarverWriter ** writer_p)
 {
   LqrCarver * aux_carver;
   LqrCarverList * carver_list = *carver_list_p;
+  *writer_p = NULL;
   if (!layer_ID)
     {
       return TRUE;
     }
   gimp_layer_resize (layer_ID, width, height, 0, 0);
   aux_carver = lqr_carver_list_current (carver_list);
-  MEM_CHECK1 (write_carver_to_layer (aux_carver, layer_ID));
+  *writer_p = carver_writer_start (aux_carver, layer_ID);
+  if (*writer_p == NULL)
+    {
+      return FALSE;
+    }
   *carver_list_p = lqr_carver_list_next (carver_list);
   return TRUE;
 }
 
+/* The aux carvers, and those of the other layers carved along, are
+ * read out by their own threads while the layer, and the layers
+ * before them, are being written */
+static gboolean
+write_carvers (CarverData * carver_data, gint32 layer_ID, PlugInVals * vals, gint width, gint height)
+{
+  LqrCarver * carver = carver_data->carver;
+  LqrCarverList * carver_list;
+  CarverWriter ** aux_writers;
+  gint n_writers = 3 + carver_data->n_extra_layers;
+  gboolean ok = TRUE;
+  gint i;
+
+  aux_writers = g_new0 (CarverWriter *, n_writers);
+  carver_list = lqr_carver_list_start (carver);
+  if (vals->resize_aux_layers)
+    {
+      ok = start_aux_writer (&carver_list, vals->pres_layer_ID, width, height, &aux_writers[0]) &&
+        start_aux_writer (&carver_list, vals->disc_layer_ID, width, height, &aux_writers[1]) &&
+        start_aux_writer (&carver_list, vals->rigmask_layer_ID, width, height, &aux_writers[2]);
+    }
+  for (i = 0; (ok) && (i < carver_data->n_extra_layers); i++)
+    {
+      ok = start_aux_writer (&carver_list, carver_data->extra_layer_IDs[i], width, height, &aux_writers[3 + i]);
+    }
+
+  if ((ok) && (write_carver_to_layer (carver, layer_ID) == LQR_NOMEM))
+    {
+      ok = FALSE;
+    }
+
+  /* the writers which were started must be finished anyway, to stop
+   * their threads */
+  for (i = 0; i < n_writers; i++)
+    {
+      if (aux_writers[i])
+        {
+          carver_writer_finish (aux_writers[i]);
+        }
+    }
+  g_free (aux_writers);
+
+  return ok;
+}
+
+/* The visible layers other than the active one and the auxiliary
+ * ones, to be carved along the seams of the active one: those within
+ * its bounds, and not groups. A smaller layer is padded to the bounds
+ * by the caller, as the auxiliary layers are, with an alpha channel
+ * so that the padding is transparent; a layer reaching beyond them
+ * would have to be cropped, so it is left alone, and named in a
+ * message. */
+static gint32 *
+layers_to_carve (gint32 image_ID, gint32 layer_ID, PlugInVals * vals, gint * n_layers_p)
+{
+  gint32 *layers;
+  gint32 *result;
+  gint n_layers;
+  gint i, n;
+  gint x_off, y_off;
+  gint width, height;
+  gint layer_x_off, layer_y_off;
+  gint layer_width, layer_height;
+  GString *skipped;
+  gchar *name;
+
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+  width = gimp_drawable_width (layer_ID);
+  height = gimp_drawable_height (layer_ID);
+  skipped = g_string_new (NULL);
+
+  layers = gimp_image_get_layers (image_ID, &n_layers);
+  result = g_new (gint32, MAX (n_layers, 1));
+  n = 0;
+  for (i = 0; i < n_layers; i++)
+    {
+      if ((layers[i] == layer_ID) || (layers[i] == vals->pres_layer_ID) ||
+          (layers[i] == vals->disc_layer_ID) || (layers[i] == vals->rigmask_layer_ID) ||
+          (!gimp_drawable_get_visible (layers[i])) ||
+          (gimp_layer_is_floating_sel (layers[i])))
+        {
+          continue;
+        }
+#if GIMP_CHECK_VERSION(2,8,0)
+      /* a group has no pixels of its own to carve */
+      if (gimp_item_is_group (layers[i]))
+        {
+          continue;
+        }
+#endif
+      gimp_drawable_offsets (layers[i], &layer_x_off, &layer_y_off);
+      layer_width = gimp_drawable_width (layers[i]);
+      layer_height = gimp_drawable_height (layers[i]);
+      if ((layer_x_off < x_off) || (layer_y_off < y_off) ||
+          (layer_x_off + layer_width > x_off + width) ||
+          (layer_y_off + layer_height > y_off + height))
+        {
+          name = gimp_drawable_get_name (layers[i]);
+          g_string_append_printf (skipped, "%s%s", skipped->len ? ", " : "", name);
+          g_free (name);
+          continue;
+        }
+      if (((layer_width != width) || (layer_height != height)) &&
+          (!gimp_drawable_has_alpha (layers[i])))
+        {
+          gimp_layer_add_alpha (layers[i]);
+        }
+      UNMASK (layers[i]);
+      result[n++] = layers[i];
+    }
+  g_free (layers);
+
+  if (skipped->len)
+    {
+      g_message (_("These layers extend beyond the active layer, "
+                   "and were not resized along with it: %s"), skipped->str);
+    }
+  g_string_free (skipped, TRUE);
+
+  *n_layers_p = n;
+  return result;
+}
 
 static void
 scale_layer_translated (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off)
@@ -34,6 +34,13 @@ typedef struct
   gint orientation;
   gint depth;
   gfloat enl_step;
+  gchar * cache_key;
+  gint cache_seams;
+  gint32 source_layer_ID;
+  struct _FrameState * frame_state;   /* see vmap_frames.h */
+  gint32 * extra_layer_IDs;     /* other layers carved along */
+  gboolean * extra_alpha_locks;
+  gint n_extra_layers;
 } CarverData;
 
 #define CARVER_DATA(data) ((CarverData*)data)
@@ -66,4 +73,7 @@ render_dump_vmap (PlugInVals * vals,
         CarverData * carver_data,
         gint32 * vmap_layer_ID_p);
 
+gboolean
+compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gint new_width, gint new_height);
+
 #endif /* __RENDER_H__ */
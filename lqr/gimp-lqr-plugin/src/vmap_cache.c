@@ -0,0 +1,624 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <libgimp/gimp.h>
+#include <lqr.h>
+
+#include "main_common.h"
+#include "vmap_cache.h"
+
+/* bump this when the seams computed by the plug-in change, so that
+ * old entries are no longer found */
+#define VMAP_CACHE_VERSION "lqr-vmap-1"
+#define VMAP_CACHE_SUFFIX ".vmap"
+
+/* The compact format of a map, used by the cache entries and by the
+ * parasites, and the same on every platform:
+ *
+ *   "LQRVMAP2", then width, height, depth, orientation and the number
+ *   of seams as variable length integers (7 bits per byte, least
+ *   significant first, the high bit set on all bytes but the last);
+ *
+ *   then the width * height levels row by row, each zigzag encoded
+ *   (0, -1, 1, -2... as 0, 1, 2, 3...) as a variable length integer,
+ *   except for runs of zeros, which are a 0 followed by the length of
+ *   the run.
+ *
+ * Most pixels of a map are never carved and have level 0, and the
+ * others are below the width, so that a map takes one or two bytes a
+ * pixel at most instead of four, and much less for few seams. */
+#define VMAP_MAGIC "LQRVMAP2"
+#define VMAP_MAGIC_LENGTH (8)
+
+typedef struct
+{
+  gchar *path;
+  guint64 size;
+  time_t mtime;
+} VMapCacheEntry;
+
+/* static functions declarations */
+
+static void put_uint (GByteArray * bytes, guint32 value);
+static gboolean get_uint (const guchar ** p, const guchar * end, guint32 * value);
+static gsize cache_size_limit (void);
+static gchar *cache_dir (void);
+static gchar *cache_path (const gchar * key, gint orientation);
+static gchar *parasite_name (gint orientation);
+static gint compare_entries (gconstpointer a, gconstpointer b);
+static void cache_trim (gsize limit);
+
+#if GLIB_CHECK_VERSION(2,16,0)
+static void checksum_layer (GChecksum * checksum, gint32 layer_ID,
+                            gint base_x_off, gint base_y_off);
+#endif
+
+/* public functions */
+
+gboolean
+vmap_cache_enabled (void)
+{
+#if GLIB_CHECK_VERSION(2,16,0)
+  return (cache_size_limit () > 0);
+#else
+  return FALSE;
+#endif
+}
+
+/* The checksum covers the layer, the layers added to its bias or
+ * rigidity mask, and the parameters of the energy; the size asked
+ * for is left out, so that the same entry serves any smaller size. */
+gchar *
+vmap_cache_key (guchar * rgb_buffer, gint width, gint height, gint bpp,
+                PlugInVals * vals, gboolean ignore_disc_mask,
+                gint base_x_off, gint base_y_off)
+{
+#if GLIB_CHECK_VERSION(2,16,0)
+  GChecksum *checksum;
+  gchar *params;
+  gchar *key;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+  params = g_strdup_printf ("%s %d %d %d %d %g %d", VMAP_CACHE_VERSION,
+                            width, height, bpp, vals->delta_x,
+                            vals->rigidity, vals->nrg_func);
+  g_checksum_update (checksum, (guchar *) params, strlen (params) + 1);
+  g_free (params);
+  g_checksum_update (checksum, rgb_buffer, (gsize) width * height * bpp);
+
+  /* same conditions as in update_bias and set_rigmask */
+  if ((vals->pres_layer_ID != 0) && (vals->pres_coeff != 0))
+    {
+      g_checksum_update (checksum, (guchar *) "pres", 5);
+      g_checksum_update (checksum, (guchar *) &vals->pres_coeff,
+                         sizeof (vals->pres_coeff));
+      checksum_layer (checksum, vals->pres_layer_ID, base_x_off, base_y_off);
+    }
+  if ((!ignore_disc_mask) && (vals->disc_layer_ID != 0)
+      && (vals->disc_coeff != 0))
+    {
+      g_checksum_update (checksum, (guchar *) "disc", 5);
+      g_checksum_update (checksum, (guchar *) &vals->disc_coeff,
+                         sizeof (vals->disc_coeff));
+      checksum_layer (checksum, vals->disc_layer_ID, base_x_off, base_y_off);
+    }
+  if (vals->rigmask_layer_ID != 0)
+    {
+      g_checksum_update (checksum, (guchar *) "rigmask", 8);
+      checksum_layer (checksum, vals->rigmask_layer_ID, base_x_off,
+                      base_y_off);
+    }
+
+  key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+#else
+  return NULL;
+#endif
+}
+
+/* Returns the map stored under key if it was computed along the given
+ * orientation for a layer of width x height, with at least the given
+ * number of seams, NULL otherwise. */
+LqrVMap *
+vmap_cache_lookup (const gchar * key, gint width, gint height,
+                   gint orientation, gint seams)
+{
+  gchar *path;
+  gchar *contents;
+  gsize length;
+  LqrVMap *vmap;
+
+  if (key == NULL)
+    {
+      return NULL;
+    }
+
+  path = cache_path (key, orientation);
+  if (!g_file_get_contents (path, &contents, &length, NULL))
+    {
+      g_free (path);
+      return NULL;
+    }
+
+  vmap = vmap_decode ((guchar *) contents, length, width, height,
+                      orientation, seams);
+  g_free (contents);
+
+  /* cache_trim goes by the modification time, so that a hit makes
+   * the entry the newest */
+  if (vmap != NULL)
+    {
+      g_utime (path, NULL);
+    }
+  g_free (path);
+
+  return vmap;
+}
+
+/* Stores the map under key, unless there is already an entry with at
+ * least as many seams; seams is how far the carver was resized when
+ * the map was dumped. g_file_set_contents writes the entry under a
+ * temporary name and then renames it, so that another run of the
+ * plug-in never reads half of it. */
+gboolean
+vmap_cache_store (const gchar * key, LqrVMap * vmap, gint seams)
+{
+  GByteArray *bytes;
+  LqrVMap *old_vmap;
+  gchar *dir;
+  gchar *path;
+  gsize limit;
+  gboolean written;
+
+  limit = cache_size_limit ();
+  if ((key == NULL) || (limit == 0))
+    {
+      return FALSE;
+    }
+
+  /* keep a deeper map */
+  old_vmap = vmap_cache_lookup (key, lqr_vmap_get_width (vmap),
+                                lqr_vmap_get_height (vmap),
+                                lqr_vmap_get_orientation (vmap), seams);
+  if (old_vmap != NULL)
+    {
+      lqr_vmap_destroy (old_vmap);
+      return TRUE;
+    }
+
+  bytes = vmap_encode_into (g_byte_array_new (), vmap, seams);
+  if (bytes->len > limit)
+    {
+      g_byte_array_free (bytes, TRUE);
+      return FALSE;
+    }
+
+  dir = cache_dir ();
+  g_mkdir_with_parents (dir, 0700);
+  g_free (dir);
+
+  path = cache_path (key, lqr_vmap_get_orientation (vmap));
+  written = g_file_set_contents (path, (gchar *) bytes->data, bytes->len, NULL);
+  g_free (path);
+  g_byte_array_free (bytes, TRUE);
+
+  cache_trim (limit);
+
+  return written;
+}
+
+/* Attaches the map to the layer it was computed from, in the compact
+ * format after the key and a nul, so that it is saved with the image
+ * and can be loaded again as long as the key matches. A map larger than
+ * VMAP_PARASITE_MAX_SIZE is not attached, and an older parasite of the
+ * same orientation is removed, since it no longer describes the layer;
+ * returns FALSE then, for the caller to keep the map in the cache. */
+gboolean
+vmap_parasite_attach (gint32 layer_ID, const gchar * key, LqrVMap * vmap,
+                      gint seams)
+{
+  GByteArray *bytes;
+  GimpParasite *parasite;
+  gchar *name;
+
+  if (key == NULL)
+    {
+      return FALSE;
+    }
+
+  bytes = g_byte_array_new ();
+  g_byte_array_append (bytes, (guchar *) key, strlen (key) + 1);
+  vmap_encode_into (bytes, vmap, seams);
+
+  name = parasite_name (lqr_vmap_get_orientation (vmap));
+  if (bytes->len > VMAP_PARASITE_MAX_SIZE)
+    {
+      gimp_drawable_parasite_detach (layer_ID, name);
+      g_free (name);
+      g_byte_array_free (bytes, TRUE);
+      return FALSE;
+    }
+  parasite = gimp_parasite_new (name, GIMP_PARASITE_PERSISTENT | GIMP_PARASITE_UNDOABLE,
+                                bytes->len, bytes->data);
+  gimp_drawable_parasite_attach (layer_ID, parasite);
+  gimp_parasite_free (parasite);
+  g_free (name);
+  g_byte_array_free (bytes, TRUE);
+
+  return TRUE;
+}
+
+/* As vmap_cache_lookup, from the parasite of the layer */
+LqrVMap *
+vmap_parasite_lookup (gint32 layer_ID, const gchar * key, gint width,
+                      gint height, gint orientation, gint seams)
+{
+  GimpParasite *parasite;
+  const guchar *data;
+  gsize size, key_size;
+  gchar *name;
+  LqrVMap *vmap = NULL;
+
+  if (key == NULL)
+    {
+      return NULL;
+    }
+
+  name = parasite_name (orientation);
+  parasite = gimp_drawable_parasite_find (layer_ID, name);
+  g_free (name);
+  if (parasite == NULL)
+    {
+      return NULL;
+    }
+
+  data = gimp_parasite_data (parasite);
+  size = gimp_parasite_data_size (parasite);
+  key_size = strlen (key) + 1;
+  if ((size > key_size) && (memcmp (data, key, key_size) == 0))
+    {
+      vmap = vmap_decode (data + key_size, size - key_size, width, height,
+                          orientation, seams);
+    }
+  gimp_parasite_free (parasite);
+
+  return vmap;
+}
+
+/* appends the map to bytes in the compact format */
+GByteArray *
+vmap_encode_into (GByteArray * bytes, LqrVMap * vmap, gint seams)
+{
+  gint *buffer = lqr_vmap_get_data (vmap);
+  gsize size, i, run;
+  guint32 value;
+
+  size = (gsize) lqr_vmap_get_width (vmap) * lqr_vmap_get_height (vmap);
+
+  g_byte_array_append (bytes, (guchar *) VMAP_MAGIC, VMAP_MAGIC_LENGTH);
+  put_uint (bytes, lqr_vmap_get_width (vmap));
+  put_uint (bytes, lqr_vmap_get_height (vmap));
+  put_uint (bytes, lqr_vmap_get_depth (vmap));
+  put_uint (bytes, lqr_vmap_get_orientation (vmap));
+  put_uint (bytes, seams);
+
+  for (i = 0; i < size; )
+    {
+      if (buffer[i] == 0)
+        {
+          for (run = 0; (i < size) && (buffer[i] == 0); i++)
+            {
+              run++;
+            }
+          put_uint (bytes, 0);
+          put_uint (bytes, run);
+        }
+      else
+        {
+          value = ((guint32) buffer[i] << 1) ^ (guint32) (buffer[i] >> 31);
+          put_uint (bytes, value);
+          i++;
+        }
+    }
+
+  return bytes;
+}
+
+/* Returns the map if data holds one computed along orientation for a
+ * layer of width x height, with at least the given number of seams */
+LqrVMap *
+vmap_decode (const guchar * data, gsize size, gint width, gint height,
+             gint orientation, gint seams)
+{
+  const guchar *p = data + VMAP_MAGIC_LENGTH;
+  const guchar *end = data + size;
+  guint32 header[5];
+  guint32 value, run;
+  gint *buffer;
+  gsize length, i;
+  gint k;
+
+  if ((size < VMAP_MAGIC_LENGTH) || (memcmp (data, VMAP_MAGIC, VMAP_MAGIC_LENGTH) != 0))
+    {
+      return NULL;
+    }
+  for (k = 0; k < 5; k++)
+    {
+      if (!get_uint (&p, end, &header[k]))
+        {
+          return NULL;
+        }
+    }
+
+  /* maps are row by row in the layer's own dimensions, whatever the
+   * orientation */
+  if (((gint) header[0] != width) || ((gint) header[1] != height) ||
+      ((gint) header[3] != orientation) || ((gint) header[4] < seams))
+    {
+      return NULL;
+    }
+
+  length = (gsize) width * height;
+  buffer = g_try_new (gint, length);
+  if (buffer == NULL)
+    {
+      return NULL;
+    }
+
+  for (i = 0; i < length; )
+    {
+      if (!get_uint (&p, end, &value))
+        {
+          break;
+        }
+      if (value == 0)
+        {
+          if ((!get_uint (&p, end, &run)) || (run > length - i))
+            {
+              break;
+            }
+          memset (buffer + i, 0, run * sizeof (gint));
+          i += run;
+        }
+      else
+        {
+          buffer[i++] = (gint) (value >> 1) ^ -(gint) (value & 1);
+        }
+    }
+
+  if (i < length)
+    {
+      g_free (buffer);
+      return NULL;
+    }
+
+  return lqr_vmap_new (buffer, width, height, header[2], orientation);
+}
+
+/* static functions */
+
+/* variable length integers, see VMAP_MAGIC */
+static void
+put_uint (GByteArray * bytes, guint32 value)
+{
+  guint8 byte;
+
+  do
+    {
+      byte = value & 0x7f;
+      value >>= 7;
+      if (value)
+        {
+          byte |= 0x80;
+        }
+      g_byte_array_append (bytes, &byte, 1);
+    }
+  while (value);
+}
+
+static gboolean
+get_uint (const guchar ** p, const guchar * end, guint32 * value)
+{
+  gint shift = 0;
+
+  *value = 0;
+  while ((*p < end) && (shift < 32))
+    {
+      *value |= (guint32) (**p & 0x7f) << shift;
+      if (!(*(*p)++ & 0x80))
+        {
+          return TRUE;
+        }
+      shift += 7;
+    }
+
+  return FALSE;
+}
+
+/* in bytes, from the gimprc (in megabytes) */
+static gsize
+cache_size_limit (void)
+{
+  gchar *value;
+  gint megabytes = VMAP_CACHE_DEFAULT_SIZE;
+
+  value = gimp_gimprc_query (VMAP_CACHE_SIZE_TOKEN);
+  if (value != NULL)
+    {
+      megabytes = MAX (atoi (value), 0);
+      g_free (value);
+    }
+
+  return (gsize) megabytes << 20;
+}
+
+static gchar *
+cache_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), PLUGIN_NAME, "vmaps",
+                           NULL);
+}
+
+/* one entry per key and orientation, since the same layer may be
+ * resized along either */
+static gchar *
+cache_path (const gchar * key, gint orientation)
+{
+  gchar *dir;
+  gchar *name;
+  gchar *path;
+
+  dir = cache_dir ();
+  name = g_strdup_printf ("%s-%c%s", key, orientation ? 'v' : 'h',
+                          VMAP_CACHE_SUFFIX);
+  path = g_build_filename (dir, name, NULL);
+  g_free (name);
+  g_free (dir);
+
+  return path;
+}
+
+/* one parasite per orientation, as for the cache entries */
+static gchar *
+parasite_name (gint orientation)
+{
+  return g_strdup_printf ("%s-%c", VMAP_PARASITE_NAME, orientation ? 'v' : 'h');
+}
+
+static gint
+compare_entries (gconstpointer a, gconstpointer b)
+{
+  const VMapCacheEntry *entry_a = a;
+  const VMapCacheEntry *entry_b = b;
+
+  return (entry_a->mtime > entry_b->mtime) - (entry_a->mtime < entry_b->mtime);
+}
+
+/* remove the least recently used entries until the cache fits into
+ * limit */
+static void
+cache_trim (gsize limit)
+{
+  GDir *dir;
+  gchar *dir_name;
+  const gchar *name;
+  GSList *entries = NULL;
+  GSList *list;
+  VMapCacheEntry *entry;
+  struct stat st;
+  guint64 total = 0;
+
+  dir_name = cache_dir ();
+  dir = g_dir_open (dir_name, 0, NULL);
+  if (dir == NULL)
+    {
+      g_free (dir_name);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *path;
+
+      if (!g_str_has_suffix (name, VMAP_CACHE_SUFFIX))
+        {
+          continue;
+        }
+      path = g_build_filename (dir_name, name, NULL);
+      if (g_stat (path, &st) != 0)
+        {
+          g_free (path);
+          continue;
+        }
+      entry = g_new (VMapCacheEntry, 1);
+      entry->path = path;
+      entry->size = st.st_size;
+      entry->mtime = st.st_mtime;
+      entries = g_slist_prepend (entries, entry);
+      total += st.st_size;
+    }
+  g_dir_close (dir);
+  g_free (dir_name);
+
+  entries = g_slist_sort (entries, compare_entries);
+  for (list = entries; list != NULL; list = list->next)
+    {
+      entry = list->data;
+      if ((total > limit) && (g_unlink (entry->path) == 0))
+        {
+          total -= entry->size;
+        }
+      g_free (entry->path);
+      g_free (entry);
+    }
+  g_slist_free (entries);
+}
+
+#if GLIB_CHECK_VERSION(2,16,0)
+/* the offsets, size and pixels of the layer, a tile at a time */
+static void
+checksum_layer (GChecksum * checksum, gint32 layer_ID,
+                gint base_x_off, gint base_y_off)
+{
+  GimpDrawable *drawable;
+  GimpPixelRgn rgn;
+  gpointer pr;
+  gint32 geometry[5];
+  gint x_off, y_off;
+  gint y;
+
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+
+  drawable = gimp_drawable_get (layer_ID);
+
+  geometry[0] = x_off - base_x_off;
+  geometry[1] = y_off - base_y_off;
+  geometry[2] = drawable->width;
+  geometry[3] = drawable->height;
+  geometry[4] = drawable->bpp;
+  g_checksum_update (checksum, (guchar *) geometry, sizeof (geometry));
+
+  gimp_pixel_rgn_init (&rgn, drawable, 0, 0, drawable->width,
+                       drawable->height, FALSE, FALSE);
+
+  for (pr = gimp_pixel_rgns_register (1, &rgn); pr != NULL;
+       pr = gimp_pixel_rgns_process (pr))
+    {
+      for (y = 0; y < rgn.h; y++)
+        {
+          g_checksum_update (checksum, rgn.data + y * rgn.rowstride,
+                             rgn.w * rgn.bpp);
+        }
+    }
+
+  gimp_drawable_detach (drawable);
+}
+#endif
@@ -0,0 +1,67 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+
+#ifndef __VMAP_CACHE_H__
+#define __VMAP_CACHE_H__
+
+#ifndef __LQR_H__
+#error "lqr/lqr.h must be included prior to vmap_cache.h"
+#endif /* __LQR_H__ */
+
+/* Visibility maps are kept on disk between runs of the plug-in, so
+ * that resizing the same layer again (e.g. to several sizes from a
+ * script) only has to load the map and resize, instead of computing
+ * the energy and the seams again. Entries are named after a checksum
+ * of everything the map depends on: the layer contents, the bias and
+ * rigidity layers and the energy parameters.
+ *
+ * When the seams are output, the map is also attached to the layer as
+ * a parasite, in the same compact format, so that it is saved with the
+ * image and found by later runs on any machine. A map too large to
+ * carry in the image is only kept in the cache. */
+
+/* gimprc token holding the size limit of the cache in megabytes,
+ * 0 turns the cache off */
+#define VMAP_CACHE_SIZE_TOKEN "lqr-vmap-cache-size"
+#define VMAP_CACHE_DEFAULT_SIZE (256)
+
+/* followed by -h or -v for the orientation */
+#define VMAP_PARASITE_NAME "lqr-vmap"
+/* largest parasite in bytes, key included */
+#define VMAP_PARASITE_MAX_SIZE (16 << 20)
+
+gboolean vmap_cache_enabled (void);
+gchar *vmap_cache_key (guchar * rgb_buffer, gint width, gint height, gint bpp,
+                       PlugInVals * vals, gboolean ignore_disc_mask,
+                       gint base_x_off, gint base_y_off);
+LqrVMap *vmap_cache_lookup (const gchar * key, gint width, gint height,
+                            gint orientation, gint seams);
+gboolean vmap_cache_store (const gchar * key, LqrVMap * vmap, gint seams);
+gboolean vmap_parasite_attach (gint32 layer_ID, const gchar * key,
+                               LqrVMap * vmap, gint seams);
+LqrVMap *vmap_parasite_lookup (gint32 layer_ID, const gchar * key,
+                               gint width, gint height, gint orientation,
+                               gint seams);
+
+/* the compact format of the entries and parasites */
+GByteArray *vmap_encode_into (GByteArray * bytes, LqrVMap * vmap, gint seams);
+LqrVMap *vmap_decode (const guchar * data, gsize size, gint width,
+                      gint height, gint orientation, gint seams);
+
+#endif /* __VMAP_CACHE_H__ */
@@ -0,0 +1,444 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <libgimp/gimp.h>
+#include <lqr.h>
+
+#include "main_common.h"
+#include "vmap_cache.h"
+#include "vmap_frames.h"
+
+/* bump this when the format below changes */
+#define FRAME_VERSION "lqr-frame-2"
+
+/* bytes of the signature per block: the mean and the detail */
+#define FRAME_SIGNATURE_BYTES (2)
+
+/* The state file holds a line with the parameters, a line with the
+ * step of the frame, the signature (FRAME_SIGNATURE_BYTES per block,
+ * row by row)
+ * and the map in the compact format of vmap_cache.c. There is one per
+ * sequence, see frame_path. */
+#define FRAME_FILE_SUFFIX ".vmap"
+
+struct _FrameState
+{
+  gchar *params;
+  gchar *path;
+  gint width;
+  gint height;
+  gint orientation;
+  gint seams;
+  gdouble step;
+  gint threshold;
+  gint blocks_x;
+  gint blocks_y;
+  guchar *signature;
+
+  /* the previous frame, if it can serve this one */
+  gchar *prev_contents;
+  const guchar *prev_signature;
+  const guchar *prev_vmap;
+  gsize prev_vmap_size;
+  guchar *changed;              /* per block */
+  gint changed_blocks;
+
+  gboolean reused;
+};
+
+/* static functions declarations */
+
+static gint gimprc_int (const gchar * token, gint default_value);
+static gchar *frame_path (gint32 image_ID, const gchar * params);
+static guchar *frame_signature (guchar * rgb_buffer, gint width, gint height,
+                                gint bpp, gint blocks_x, gint blocks_y);
+static gboolean frame_load_previous (FrameState * state);
+
+/* public functions */
+
+/* step is the position of the frame in the sequence, as given to the
+ * iterator; the previous map is only used if it belongs to a
+ * neighbouring frame */
+FrameState *
+frame_state_new (gint32 image_ID, guchar * rgb_buffer, gint width, gint height, gint bpp,
+                 PlugInVals * vals, gdouble step, gint orientation, gint seams)
+{
+  FrameState *state;
+
+  state = g_new0 (FrameState, 1);
+
+  /* the contents of the bias layers change with the frames, their
+   * coefficients should not */
+  state->params = g_strdup_printf ("%s %d %d %d %d %d %g %d %d %d %d",
+                                   FRAME_VERSION, width, height, bpp,
+                                   orientation, vals->delta_x,
+                                   vals->rigidity, vals->nrg_func,
+                                   vals->pres_layer_ID ? vals->pres_coeff : 0,
+                                   vals->disc_layer_ID ? vals->disc_coeff : 0,
+                                   vals->rigmask_layer_ID != 0);
+  state->path = frame_path (image_ID, state->params);
+  state->width = width;
+  state->height = height;
+  state->orientation = orientation;
+  state->seams = seams;
+  state->step = step;
+  state->threshold = gimprc_int (FRAME_THRESHOLD_TOKEN, FRAME_DEFAULT_THRESHOLD);
+  state->blocks_x = (width + FRAME_BLOCK_SIZE - 1) / FRAME_BLOCK_SIZE;
+  state->blocks_y = (height + FRAME_BLOCK_SIZE - 1) / FRAME_BLOCK_SIZE;
+  state->signature = frame_signature (rgb_buffer, width, height, bpp,
+                                      state->blocks_x, state->blocks_y);
+
+  if (!frame_load_previous (state))
+    {
+      g_free (state->prev_contents);
+      state->prev_contents = NULL;
+    }
+
+  return state;
+}
+
+/* The previous map, if no block changed by more than the threshold */
+LqrVMap *
+frame_state_reuse (FrameState * state)
+{
+  LqrVMap *vmap;
+
+  if ((state->prev_contents == NULL) || (state->changed_blocks > 0))
+    {
+      return NULL;
+    }
+
+  vmap = vmap_decode (state->prev_vmap, state->prev_vmap_size, state->width,
+                      state->height, state->orientation, state->seams);
+  state->reused = (vmap != NULL);
+
+  return vmap;
+}
+
+/* Biases the pixels which the first seams of the previous frame went
+ * through towards removal, in the blocks which did not change. To be
+ * called on an initialized carver, before it is resized. */
+LqrRetVal
+frame_state_bias (FrameState * state, LqrCarver * carver)
+{
+  LqrVMap *vmap;
+  gint *buffer;
+  gint coherence;
+  gint x, y, vs;
+  gint block_row;
+
+  coherence = gimprc_int (FRAME_COHERENCE_TOKEN, FRAME_DEFAULT_COHERENCE);
+  if ((state->prev_contents == NULL) || (coherence == 0))
+    {
+      return LQR_OK;
+    }
+
+  /* any number of seams will do */
+  vmap = vmap_decode (state->prev_vmap, state->prev_vmap_size, state->width,
+                      state->height, state->orientation, 0);
+  if (vmap == NULL)
+    {
+      return LQR_OK;
+    }
+  buffer = lqr_vmap_get_data (vmap);
+
+  for (y = 0; y < state->height; y++)
+    {
+      block_row = (y / FRAME_BLOCK_SIZE) * state->blocks_x;
+      for (x = 0; x < state->width; x++)
+        {
+          vs = buffer[(gsize) y * state->width + x];
+          if ((vs > 0) && (vs <= state->seams) &&
+              (!state->changed[block_row + x / FRAME_BLOCK_SIZE]))
+            {
+              CATCH (lqr_carver_bias_add_xy (carver, -coherence, x, y));
+            }
+        }
+    }
+
+  lqr_vmap_destroy (vmap);
+
+  return LQR_OK;
+}
+
+/* Keeps the map of this frame for the next one. A reused map is kept
+ * with the signature of the frame it was computed on, so that slow
+ * changes add up until the seams are computed again. */
+gboolean
+frame_state_store (FrameState * state, LqrCarver * carver)
+{
+  GByteArray *bytes;
+  LqrVMap *vmap;
+  gchar step_string[G_ASCII_DTOSTR_BUF_SIZE];
+  gsize signature_size;
+  gchar *header;
+  gchar *dir;
+  gboolean written;
+
+  signature_size = (gsize) state->blocks_x * state->blocks_y * FRAME_SIGNATURE_BYTES;
+  g_ascii_formatd (step_string, sizeof (step_string), "%.6f", state->step);
+  header = g_strdup_printf ("%s\n%s\n", state->params, step_string);
+
+  bytes = g_byte_array_new ();
+  g_byte_array_append (bytes, (guchar *) header, strlen (header));
+  g_free (header);
+
+  if (state->reused)
+    {
+      g_byte_array_append (bytes, state->prev_signature, signature_size);
+      g_byte_array_append (bytes, state->prev_vmap, state->prev_vmap_size);
+    }
+  else
+    {
+      vmap = lqr_vmap_dump (carver);
+      if (vmap == NULL)
+        {
+          g_byte_array_free (bytes, TRUE);
+          return FALSE;
+        }
+      g_byte_array_append (bytes, state->signature, signature_size);
+      vmap_encode_into (bytes, vmap, state->seams);
+      lqr_vmap_destroy (vmap);
+    }
+
+  dir = g_path_get_dirname (state->path);
+  g_mkdir_with_parents (dir, 0700);
+  written = g_file_set_contents (state->path, (gchar *) bytes->data, bytes->len, NULL);
+  g_free (dir);
+  g_byte_array_free (bytes, TRUE);
+
+  return written;
+}
+
+void
+frame_state_free (FrameState * state)
+{
+  if (state == NULL)
+    {
+      return;
+    }
+  g_free (state->params);
+  g_free (state->path);
+  g_free (state->signature);
+  g_free (state->prev_contents);
+  g_free (state->changed);
+  g_free (state);
+}
+
+/* static functions */
+
+static gint
+gimprc_int (const gchar * token, gint default_value)
+{
+  gchar *value;
+  gint result = default_value;
+
+  value = gimp_gimprc_query (token);
+  if (value != NULL)
+    {
+      result = MAX (atoi (value), 0);
+      g_free (value);
+    }
+
+  return result;
+}
+
+/* The file of the sequence the image belongs to, named after a hash
+ * of the parameters and of the file name of the image without the
+ * frame number: GAP names the frames <basename><number>.<ext>. Two
+ * sequences carved at once, or one after the other, do not mix up
+ * their maps this way. */
+static gchar *
+frame_path (gint32 image_ID, const gchar * params)
+{
+  GChecksum *checksum;
+  gchar *filename;
+  gchar *name;
+  gchar *path;
+  gchar *dot;
+  gsize length;
+
+  filename = gimp_image_get_filename (image_ID);
+  if (filename == NULL)
+    {
+      filename = g_strdup ("");
+    }
+  dot = strrchr (filename, '.');
+  if ((dot != NULL) && (strchr (dot, G_DIR_SEPARATOR) == NULL))
+    {
+      *dot = '\0';
+    }
+  length = strlen (filename);
+  while ((length > 0) && (g_ascii_isdigit (filename[length - 1])))
+    {
+      length--;
+    }
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (guchar *) params, strlen (params) + 1);
+  g_checksum_update (checksum, (guchar *) filename, length);
+  name = g_strconcat (g_checksum_get_string (checksum), FRAME_FILE_SUFFIX, NULL);
+  path = g_build_filename (g_get_user_cache_dir (), PLUGIN_NAME, "frames",
+                           name, NULL);
+  g_checksum_free (checksum);
+  g_free (name);
+  g_free (filename);
+
+  return path;
+}
+
+/* For each block, the mean brightness and the detail, the mean of the
+ * differences in brightness to the pixels on the left and above, both
+ * 0 to 255. The detail tells apart blocks of the same mean, e.g. when
+ * a texture moves or a region is blurred. */
+static guchar *
+frame_signature (guchar * rgb_buffer, gint width, gint height, gint bpp,
+                 gint blocks_x, gint blocks_y)
+{
+  guint32 *sums;
+  guint32 *details;
+  gint *above;
+  guchar *signature;
+  guchar *p;
+  gint colours;
+  gint x, y, b, k;
+  gint block_w, block_h;
+  gint value, left;
+
+  colours = (bpp >= 3) ? 3 : 1;
+  sums = g_new0 (guint32, blocks_x * blocks_y);
+  details = g_new0 (guint32, blocks_x * blocks_y);
+  above = g_new (gint, width);
+
+  for (y = 0; y < height; y++)
+    {
+      p = rgb_buffer + (gsize) y * width * bpp;
+      left = 0;
+      for (x = 0; x < width; x++)
+        {
+          b = (y / FRAME_BLOCK_SIZE) * blocks_x + x / FRAME_BLOCK_SIZE;
+          value = 0;
+          for (k = 0; k < colours; k++)
+            {
+              value += p[k];
+            }
+          sums[b] += value;
+          if (x > 0)
+            {
+              details[b] += abs (value - left);
+            }
+          if (y > 0)
+            {
+              details[b] += abs (value - above[x]);
+            }
+          above[x] = left = value;
+          p += bpp;
+        }
+    }
+
+  signature = g_new (guchar, blocks_x * blocks_y * FRAME_SIGNATURE_BYTES);
+  for (y = 0; y < blocks_y; y++)
+    {
+      block_h = MIN (FRAME_BLOCK_SIZE, height - y * FRAME_BLOCK_SIZE);
+      for (x = 0; x < blocks_x; x++)
+        {
+          block_w = MIN (FRAME_BLOCK_SIZE, width - x * FRAME_BLOCK_SIZE);
+          b = y * blocks_x + x;
+          signature[b * FRAME_SIGNATURE_BYTES] = sums[b] / (block_w * block_h * colours);
+          signature[b * FRAME_SIGNATURE_BYTES + 1] =
+            MIN (details[b] / (2 * block_w * block_h * colours), 255);
+        }
+    }
+  g_free (sums);
+  g_free (details);
+  g_free (above);
+
+  return signature;
+}
+
+/* Reads the state of the previous frame, and compares it with this
+ * one; FALSE if it is missing or does not belong to this sequence */
+static gboolean
+frame_load_previous (FrameState * state)
+{
+  gsize length;
+  gsize params_length;
+  gsize signature_size;
+  const gchar *p;
+  gchar *end;
+  gdouble prev_step;
+  gint b, k, diff;
+
+  if (!g_file_get_contents (state->path, &state->prev_contents, &length, NULL))
+    {
+      return FALSE;
+    }
+
+  params_length = strlen (state->params);
+  if ((length <= params_length) ||
+      (memcmp (state->prev_contents, state->params, params_length) != 0) ||
+      (state->prev_contents[params_length] != '\n'))
+    {
+      return FALSE;
+    }
+
+  p = state->prev_contents + params_length + 1;
+  prev_step = g_ascii_strtod (p, &end);
+  if ((end == p) || (end >= state->prev_contents + length) || (*end != '\n'))
+    {
+      return FALSE;
+    }
+  if (fabs (prev_step - state->step) > 1.0 + 1e-6)
+    {
+      return FALSE;
+    }
+
+  signature_size = (gsize) state->blocks_x * state->blocks_y * FRAME_SIGNATURE_BYTES;
+  p = end + 1;
+  if ((gsize) (state->prev_contents + length - p) < signature_size)
+    {
+      return FALSE;
+    }
+  state->prev_signature = (const guchar *) p;
+  state->prev_vmap = state->prev_signature + signature_size;
+  state->prev_vmap_size = state->prev_contents + length - (const gchar *) state->prev_vmap;
+
+  state->changed = g_new0 (guchar, state->blocks_x * state->blocks_y);
+  state->changed_blocks = 0;
+  for (b = 0; b < state->blocks_x * state->blocks_y; b++)
+    {
+      for (k = 0; k < FRAME_SIGNATURE_BYTES; k++)
+        {
+          diff = abs ((gint) state->signature[b * FRAME_SIGNATURE_BYTES + k] -
+                      (gint) state->prev_signature[b * FRAME_SIGNATURE_BYTES + k]);
+          state->changed[b] |= (diff > state->threshold);
+        }
+      state->changed_blocks += state->changed[b];
+    }
+
+  return TRUE;
+}
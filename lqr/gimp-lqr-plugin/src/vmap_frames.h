@@ -0,0 +1,65 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+
+#ifndef __VMAP_FRAMES_H__
+#define __VMAP_FRAMES_H__
+
+#ifndef __LQR_H__
+#error "lqr/lqr.h must be included prior to vmap_frames.h"
+#endif /* __LQR_H__ */
+
+/* Consecutive frames of an animation look alike, and so should their
+ * seams. When GAP runs the plug-in over the frames, the map of each
+ * frame is kept on disk for the next one of the same sequence,
+ * together with a coarse signature of the frame it was computed on
+ * (the mean brightness and the detail of each block of FRAME_BLOCK_SIZE
+ * pixels).
+ *
+ * If no block of the next frame differs from the signature by more
+ * than the threshold, the map is loaded as it is, and the energy is
+ * not computed at all. Otherwise the frame is carved afresh, but the
+ * pixels which the previous seams went through are biased towards
+ * removal in the blocks which did not change, so that the seams keep
+ * their places there and only move where the picture moved. */
+
+#define FRAME_BLOCK_SIZE (16)
+
+/* gimprc token holding the largest change of the mean or the detail of
+ * a block, in levels out of 255, for which the previous map is still
+ * used; with 0 only the map of an identical frame is */
+#define FRAME_THRESHOLD_TOKEN "lqr-frame-threshold"
+#define FRAME_DEFAULT_THRESHOLD (6)
+
+/* gimprc token holding the strength of the bias along the previous
+ * seams, on the scale of the preservation coefficient; 0 turns it off */
+#define FRAME_COHERENCE_TOKEN "lqr-frame-coherence"
+#define FRAME_DEFAULT_COHERENCE (300)
+
+typedef struct _FrameState FrameState;
+
+FrameState *frame_state_new (gint32 image_ID, guchar * rgb_buffer,
+                             gint width, gint height, gint bpp,
+                             PlugInVals * vals, gdouble step,
+                             gint orientation, gint seams);
+LqrVMap *frame_state_reuse (FrameState * state);
+LqrRetVal frame_state_bias (FrameState * state, LqrCarver * carver);
+gboolean frame_state_store (FrameState * state, LqrCarver * carver);
+void frame_state_free (FrameState * state);
+
+#endif /* __VMAP_FRAMES_H__ */
@@ -28,6 +28,7 @@ License:
 '''
 
 from gimpfu import *
+import struct
 
 gettext.install("resynthesizer", gimp.locale_directory, unicode=True)
 
@@ -115,6 +116,13 @@ def heal_selection(timg, tdrawable, samplingRadiusParam=50, directionParam=0, or
   newHeight = min(pdb.gimp_image_height(tempImage) - newLLY, newHeight)
   pdb.gimp_image_crop(tempImage, newWidth, newHeight, newLLX, newLLY)
   
+  # Tell the resynthesizer where the cropped corpus lies in the target drawable,
+  # so it can heal incrementally when the user grows the selection and heals again.
+  corpusOriginX = work_drawable.offsets[0] + newLLX - tdrawable.offsets[0]
+  corpusOriginY = work_drawable.offsets[1] + newLLY - tdrawable.offsets[1]
+  work_drawable.attach_new_parasite("resynthesizer-corpus-origin", 0, 
+    struct.pack("=ii", corpusOriginX, corpusOriginY))
+  
   # Encode two script params into one resynthesizer param.
   # use border 1 means fill target in random order
   # use border 0 is for texture mapping operations, not used by this script
@@ -34,6 +34,7 @@ will not use static global vars so it is reentrant.
 */
 
 #include <stdlib.h>
+#include <string.h> // memcpy
 
 /*
 Adapt pixmap that is row padded to pixmap:
@@ -56,8 +57,7 @@ adaptImage(
   guint col;
   guint pixelel;
   
-  guint srcPixel;
-  guint destPixel;
+  size_t srcPixel;
   
   /* 
   Copy SOME of the pixels from img sequence to our pixmap (optionally exclude alpha).
@@ -67,30 +67,23 @@ adaptImage(
   /* 
   Note the src and dest pixel indices are incremented differently, ie pixel strides different. 
   src: row padded: row stride greater than pixels*pixelelsperpixel
-  dest: not row padded 
+  dest: addressed by coordinates, since it may be out-of-core i.e. tiled (see mapIndex.h)
   */
-  destPixel = offset; // dest pixel index starts at offset
   guint srcPixelStride = pixelel_count;
-  guint destPixelStride = pixelel_count + offset; // dest is offset
   
   for(row=0; row<image->height; row++) 
   { 
-    srcPixel = row * image->rowBytes; // srcPixel index computed for START of each row
-    // dest pixel index continues at next byte
+    srcPixel = (size_t) row * image->rowBytes; // srcPixel index computed for START of each row
     for(col=0; col<image->width; col++) 
     {
+      Coordinates coords = {col, row};
+      Pixelel * destPixel = pixmap_index(pixmap, coords) + offset; // dest is offset
+      
       for (pixelel=0; pixelel < pixelel_count; pixelel++)
         // Copy one pixelel, but possibly offset in destination
-        g_array_index(
-          pixmap->data, 
-          Pixelel, 
-          destPixel+pixelel
-          )
-          = 
-          image->data[srcPixel+pixelel];  // src data is array of uchar
+        destPixel[pixelel] = image->data[srcPixel+pixelel];  // src data is array of uchar
           
       srcPixel += srcPixelStride;
-      destPixel += destPixelStride;
     }
   }
 }
@@ -121,8 +114,7 @@ antiAdaptImage(
   guint pixelel;
   
   // Indexes that move by pixel strides, but might point offset inside a pixel
-  guint srcPixel;
-  guint destPixel;
+  size_t destPixel;
   
   /* 
   Copy ALL of the pixels from our pixmap to buffer(including alpha which is unaltered.)
@@ -131,7 +123,7 @@ antiAdaptImage(
   */
   /* 
   Note the src and dest pixel indices are incremented differently, ie pixel strides different. 
-  src: NOT row padded
+  src: addressed by coordinates, since it may be out-of-core i.e. tiled (see mapIndex.h)
   dest: row padded 
   */
   
@@ -140,28 +132,21 @@ antiAdaptImage(
   The data can be unitialized, or valid image data to be overwritten here.
   */
   
-  srcPixel = offset;
-  // source stride is offset plus pixels moved
-  guint srcPixelStride = pixelel_count + offset;  
   guint destPixelStride = pixelel_count;
   
   for(row=0; row<imageBuffer->height; row++) 
   { 
-    destPixel = row * imageBuffer->rowBytes; // destPixel index computed for START of each row
+    destPixel = (size_t) row * imageBuffer->rowBytes; // destPixel index computed for START of each row
     // dest pixel index continues at next byte
     for(col=0; col<imageBuffer->width; col++) 
     {
+      Coordinates coords = {col, row};
+      Pixelel * srcPixel = pixmap_index(pixmap, coords) + offset; // src is offset
+      
       for (pixelel=0; pixelel < pixelel_count; pixelel++)
         // Copy one pixelel, but offset in src
-        imageBuffer->data[destPixel+pixelel]
-        = 
-        g_array_index(
-          pixmap->data, 
-          Pixelel,
-          srcPixel+pixelel
-          );
+        imageBuffer->data[destPixel+pixelel] = srcPixel[pixelel];
           
-       srcPixel += srcPixelStride;
        destPixel += destPixelStride;
      }
    }
@@ -228,14 +213,18 @@ adaptImageAndMask(
   ImageBuffer *   mask,   // IN 
   Map *imagePixmap,       // OUT our color pixmap of drawable, w/ interleaved mask
   Map *maskPixmap,        // OUT our selection bytemap (only one channel ie pixelel ie byte ie depth)
-  guint pixelelPerPixel    // IN pixelels in the image e.g. 4 for RGBA
+  guint pixelelPerPixel,   // IN pixelels in the image e.g. 4 for RGBA
+  gboolean isCorpus       // IN whether imagePixmap may be out-of-core
   ) 
 {
   // Note our internal map includes mask pixelel so +1
   
   // Both OUT pixmaps same 2D dimensions.  
   // imagePixmap includes a mask byte.
-  new_pixmap(imagePixmap, image->width, image->height, pixelelPerPixel+1 );
+  if (isCorpus)
+    new_corpus_pixmap(imagePixmap, image->width, image->height, pixelelPerPixel+1 );
+  else
+    new_pixmap(imagePixmap, image->width, image->height, pixelelPerPixel+1 );
   
   // Get color, alpha channels.  Offset them past mask byte. 4 bytes of RGBA.
   adaptImage(image, imagePixmap, FIRST_PIXELEL_INDEX, pixelelPerPixel);
@@ -276,7 +265,8 @@ adaptSimpleAPI(
     maskBuffer,
     targetMap, 
     &targetMaskMap, 
-    pixelelPerPixel
+    pixelelPerPixel,
+    FALSE
     );
   
   // For performance (cache memory locality), interleave mask into pixmap.
@@ -292,7 +282,8 @@ adaptSimpleAPI(
     maskBuffer,
     corpusMap,
     &corpusMaskMap,
-    pixelelPerPixel
+    pixelelPerPixel,
+    TRUE
     );
   
   // !!!! 
@@ -308,3 +299,144 @@ adaptSimpleAPI(
 
 
 
+
+
+/*
+Adapt for imageSynthBatch().
+
+The corpus is the image outside the union of all masks, so no target is healed from another target.
+The union is taken as the greatest mask value at each pixel, then inverted as in adaptSimpleAPI().
+*/
+void
+adaptSimpleBatchCorpus(
+  ImageBuffer * imageBuffer,
+  ImageBuffer * maskBuffers,  // IN array of maskCount
+  int * isMaskValid,          // IN array of maskCount: whether to include in union
+  guint maskCount,
+  Map * corpusMap,            // OUT
+  guint pixelelPerPixel
+  )
+{
+  ImageBuffer unionMask;
+  Map corpusMaskMap;
+  guint i;
+  guint row;
+  guint col;
+  
+  unionMask.width = imageBuffer->width;
+  unionMask.height = imageBuffer->height;
+  unionMask.rowBytes = imageBuffer->width;
+  unionMask.data = calloc(unionMask.rowBytes * unionMask.height, 1);
+  g_assert(unionMask.data);
+  
+  for (i=0; i<maskCount; i++)
+  {
+    if ( ! isMaskValid[i] ) continue;
+    for(row=0; row<unionMask.height; row++)
+      for(col=0; col<unionMask.width; col++)
+      {
+        unsigned char value = maskBuffers[i].data[row * maskBuffers[i].rowBytes + col];
+        unsigned char * unionValue = &unionMask.data[row * unionMask.rowBytes + col];
+        if (value > *unionValue) *unionValue = value;
+      }
+  }
+  
+  adaptImageAndMask(imageBuffer, &unionMask, corpusMap, &corpusMaskMap, pixelelPerPixel, TRUE);
+  invert_bytemap(&corpusMaskMap);
+  interleave_mask(corpusMap, &corpusMaskMap);
+  free_map(&corpusMaskMap);
+  free(unionMask.data);
+}
+
+
+/*
+Bounding box of the selected pixels of mask, expanded by margin and clipped to the mask.
+Returns FALSE if nothing selected.
+*/
+gboolean
+getMaskWindow(
+  ImageBuffer * mask,
+  guint margin,
+  Coordinates * origin,   // OUT
+  Coordinates * size      // OUT
+  )
+{
+  guint row;
+  guint col;
+  gint minX = G_MAXINT, minY = G_MAXINT, maxX = -1, maxY = -1;
+  
+  for(row=0; row<mask->height; row++)
+    for(col=0; col<mask->width; col++)
+      if (mask->data[row * mask->rowBytes + col] != MASK_UNSELECTED)
+      {
+        if ((gint) col < minX) minX = col;
+        if ((gint) col > maxX) maxX = col;
+        if ((gint) row < minY) minY = row;
+        if ((gint) row > maxY) maxY = row;
+      }
+  if (maxX < 0) return FALSE;
+  
+  origin->x = MAX(minX - (gint) margin, 0);
+  origin->y = MAX(minY - (gint) margin, 0);
+  size->x = MIN(maxX + (gint) margin, (gint) mask->width - 1) - origin->x + 1;
+  size->y = MIN(maxY + (gint) margin, (gint) mask->height - 1) - origin->y + 1;
+  return TRUE;
+}
+
+
+/*
+Target of one mask of a batch: a window of the image around the mask.
+Colors come from the corpus pixmap (which is the whole, unaltered image),
+not from imageBuffer, which the results of other masks may have overwritten.
+*/
+void
+adaptSimpleBatchTarget(
+  Map * corpusMap,      // IN
+  ImageBuffer * mask,   // IN
+  Coordinates origin,   // IN window
+  Coordinates size,
+  Map * targetMap       // OUT
+  )
+{
+  gint x;
+  gint y;
+  
+  new_pixmap(targetMap, size.x, size.y, corpusMap->depth);
+  for(y=0; y<size.y; y++)
+    for(x=0; x<size.x; x++)
+    {
+      Coordinates coords = {x, y};
+      Coordinates imageCoords = {x + origin.x, y + origin.y};
+      Pixelel * pixel = pixmap_index(targetMap, coords);
+      
+      memcpy(pixel, pixmap_index(corpusMap, imageCoords), corpusMap->depth);
+      pixel[MASK_PIXELEL_INDEX] = mask->data[imageCoords.y * mask->rowBytes + imageCoords.x];
+    }
+}
+
+
+/* Reverse of above: copy the selected (synthesized) pixels of the window to imageBuffer. */
+void
+antiAdaptSimpleBatchTarget(
+  ImageBuffer * imageBuffer,  // OUT
+  Map * targetMap,            // IN
+  Coordinates origin,         // IN window
+  guint pixelel_count
+  )
+{
+  guint x;
+  guint y;
+  
+  for(y=0; y<targetMap->height; y++)
+    for(x=0; x<targetMap->width; x++)
+    {
+      Coordinates coords = {x, y};
+      Pixelel * pixel = pixmap_index(targetMap, coords);
+      
+      if (pixel[MASK_PIXELEL_INDEX] != MASK_UNSELECTED)
+        memcpy(
+          &imageBuffer->data[(y + origin.y) * imageBuffer->rowBytes + (x + origin.x) * pixelel_count],
+          &pixel[FIRST_PIXELEL_INDEX],
+          pixelel_count);
+    }
+}
@@ -0,0 +1,255 @@
+/*
+Batch synthesis: many targets from one corpus.
+
+A caller that heals many small selections in one image (say every blemish)
+would otherwise call the engine once per selection, each call preparing the same corpus,
+the same metric tables, and starting its own threads for tiny targets,
+where threads hardly pay (see ChangeLog.)
+
+Here the corpus and metric tables are prepared once by engineBatch(),
+and a pool of threads takes jobs (targets) from a shared counter until none are left.
+Each job is synthesized by one thread, start to finish.
+So throughput scales with the count of threads, even though each target is small.
+
+Jobs share only what is read-only during synthesis: the corpus, corpusPoints, and metric tables.
+Each job has its own prng (seeded the same), so the result of a job does not depend on
+which thread synthesizes it, nor on the other jobs.
+Jobs do not share recentProberMap (it is indexed by target point index, which jobs duplicate):
+heuristic 2 is per target point instead, as for deterministic synthesis (see synthesize.h.)
+
+  Copyright (C) 2010, 2011  Lloyd Konneker
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+// What the threads of a batch share
+typedef struct {
+  TImageSynthParameters *parameters;
+  TFormatIndices* indices;
+  Map* corpusMap;
+  pointVector corpusPoints;
+  gushort * corpusTargetMetric;   // array pointers TPixelelMetricFunc
+  guint * mapsMetric;             // TMapPixelelMetricFunc
+  TSynthJob* jobs;
+  guint jobCount;
+  guint nextJob;        // Index of next job to take, atomically incremented
+  guint doneJobCount;   // For progress
+  void (*progressCallback)(int, void*);
+  void *contextInfo;
+#ifdef SYNTH_THREADED
+  GMutex *mutexProgress;  // Calls to the progress callback, which is probably a GUI
+#endif
+  int *cancelFlag;
+} TBatch;
+
+
+/* Jobs report progress when done, not from inside synthesize(). */
+static void
+ignoreDeepProgress(ProgressRecordT* progressRecord) { }
+
+
+/*
+Passes over one target, in this thread.
+Same as refiner.h, except for the stride (one thread) and no recentProberMap.
+*/
+static void
+refineJob(
+  TBatch* batch,
+  Map* targetMap,
+  Map* hasValueMap,
+  Map* sourceOfMap,
+  pointVector targetPoints,
+  pointVector sortedOffsets,
+  GRand *prng
+  )
+{
+  guint pass;
+  TRepetionParameters repetition_params;
+
+  prepare_repetition_parameters(repetition_params, targetPoints->len);
+
+  for (pass=0; pass<MAX_PASSES; pass++)
+  {
+    gulong betters = synthesize(
+      batch->parameters,
+      0,      // This thread is the only one synthesizing this target
+      1,
+      0,
+      repetition_params[pass][1],
+      batch->indices,
+      targetMap,
+      batch->corpusMap,
+      (Map*) NULL,  // recentProberMap, see above
+      hasValueMap,
+      sourceOfMap,
+      targetPoints,
+      batch->corpusPoints,
+      sortedOffsets,
+      prng,
+      batch->corpusTargetMetric,
+      batch->mapsMetric,
+      ignoreDeepProgress,
+      (ProgressRecordT*) NULL,
+      batch->cancelFlag,
+      (TSynthPhase*) NULL
+      );
+
+    if ( *batch->cancelFlag ) break;
+    // Same termination as refiner()
+    if ( (float) betters / targetPoints->len < (IMAGE_SYNTH_TERMINATE_FRACTION) )
+      break;
+  }
+}
+
+
+/*
+Synthesize one job.
+Same preparation of the target as engineIncremental(), the corpus is already prepared.
+Returns error.
+*/
+static int
+synthesizeJob(
+  TBatch* batch,
+  Map* targetMap
+  )
+{
+  Map hasValueMap;
+  Map sourceOfMap;
+  pointVector targetPoints;
+  pointVector sortedOffsets;
+  GRand *prng;
+  int error;
+
+  prepareTargetPoints(batch->parameters->matchContextType, batch->indices, targetMap,
+    &hasValueMap,
+    &targetPoints);
+  if ( !targetPoints->len )
+  {
+    g_array_free(targetPoints, TRUE);
+    free_map(&hasValueMap);
+    return IMAGE_SYNTH_ERROR_EMPTY_TARGET;
+  }
+  prepare_target_sources(targetMap, &sourceOfMap);
+  prepareSortedOffsets(targetMap, batch->corpusMap, &sortedOffsets);
+
+  prng = g_rand_new_with_seed(IMAGE_SYNTH_SEED);
+  error = orderTargetPoints(batch->parameters, targetPoints, prng);
+  if ( ! error )
+    refineJob(batch, targetMap, &hasValueMap, &sourceOfMap, targetPoints, sortedOffsets, prng);
+
+  free_map(&hasValueMap);
+  free_map(&sourceOfMap);
+  g_array_free(targetPoints, TRUE);
+  g_array_free(sortedOffsets, TRUE);
+  #ifdef SYNTH_USE_GLIB
+  g_rand_free(prng);
+  #endif
+  return error;
+}
+
+
+/* Thread of the pool: take jobs until none left. */
+static void *
+batchThread(void * uncastBatch)
+{
+  TBatch* batch = (TBatch*) uncastBatch;
+
+  for (;;)
+  {
+    guint jobIndex = __sync_fetch_and_add(&batch->nextJob, 1);
+    guint done;
+
+    if ( jobIndex >= batch->jobCount ) break;
+    if ( *batch->cancelFlag )
+    {
+      batch->jobs[jobIndex].error = IMAGE_SYNTH_ERROR_CANCELED;
+      continue;
+    }
+    batch->jobs[jobIndex].error = synthesizeJob(batch, &batch->jobs[jobIndex].targetMap);
+    if ( *batch->cancelFlag && ! batch->jobs[jobIndex].error )
+      batch->jobs[jobIndex].error = IMAGE_SYNTH_ERROR_CANCELED;  // Partially synthesized
+
+    done = __sync_add_and_fetch(&batch->doneJobCount, 1);
+#ifdef SYNTH_THREADED
+    g_mutex_lock(batch->mutexProgress);
+#endif
+    batch->progressCallback((int) (done * 100 / batch->jobCount), batch->contextInfo);
+#ifdef SYNTH_THREADED
+    g_mutex_unlock(batch->mutexProgress);
+#endif
+  }
+  return NULL;
+}
+
+
+/* Run the pool of threads over the jobs of batch.  Unthreaded, run the jobs in turn. */
+static void
+runBatch(TBatch* batch)
+{
+#ifdef SYNTH_THREADED
+  #ifdef SYNTH_USE_GLIB_THREADS
+  GThread* threads[THREAD_LIMIT];
+  #else
+  pthread_t threads[THREAD_LIMIT];
+  #endif
+  gboolean started[THREAD_LIMIT];
+  GMutex mutexProgress;
+  guint threadCount = MIN(THREAD_LIMIT, batch->jobCount);
+  guint threadIndex;
+
+  g_mutex_init(&mutexProgress);
+  batch->mutexProgress = &mutexProgress;
+
+  for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+  {
+  #ifdef SYNTH_USE_GLIB_THREADS
+    GError* error = NULL;
+    threads[threadIndex] = g_thread_try_new(NULL, batchThread, batch, &error);
+    if (error != NULL)
+    {
+      // Other threads take the jobs of the thread not started
+      printf("Error creating thread: %s\n", error->message);
+      g_error_free(error);
+      threads[threadIndex] = NULL;
+    }
+    started[threadIndex] = (threads[threadIndex] != NULL);
+  #else
+    int error = pthread_create(&threads[threadIndex], NULL, batchThread, batch);
+    if (error != 0)
+      printf("Error creating thread: %d\n", error);
+    started[threadIndex] = (error == 0);
+  #endif
+  }
+
+  for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+  {
+    if (!started[threadIndex])
+      continue;
+  #ifdef SYNTH_USE_GLIB_THREADS
+    g_thread_join(threads[threadIndex]);
+  #else
+    pthread_join(threads[threadIndex], NULL);
+  #endif
+  }
+  // If no thread started at all
+  batchThread(batch);
+
+  batch->mutexProgress = NULL;
+  g_mutex_clear(&mutexProgress);
+#else
+  batchThread(batch);
+#endif
+}
@@ -60,6 +60,31 @@ then run >automake from the top directory.
 // #define ANIMATE    // Animate image while processing, for debugging.
 // #define DEBUG
 
+/*
+Prefetch the corpus patches of candidates for heuristic 1 before matching them. See synthesize.h.
+Off: benchSynth showed no gain in wall time. Define SYNTH_PREFETCH on the command line to compare.
+It changes the random probes, so the results differ from a build without it.
+*/
+#ifdef SYNTH_PREFETCH
+  #define SYNTH_PREFETCH_NEIGHBORS 8  // Nearest neighbors of a candidate patch to prefetch
+#endif
+
+/*
+Put a huge corpus out-of-core, in a memory mapped temporary file. See mapOps.h.
+Requires POSIX mmap.  Without it, all maps are in memory, as before.
+*/
+#ifndef _WIN32
+  #define SYNTH_TILED_CORPUS
+  // mkstemp, ftruncate and madvise are hidden by -std=c99 (Makefile.synth) unless asked for.
+  // This file is included before any system header.
+  #ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE
+  #endif
+  #ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+  #endif
+#endif
+
 // VECTORIZED requires SYMMETRIC_METRIC_TABLE
 // #define SYMMETRIC_METRIC_TABLE
 // #define VECTORIZED
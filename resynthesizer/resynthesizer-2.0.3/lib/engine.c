@@ -74,6 +74,7 @@ It doesn't make tiles in the target, it makes a target that is suitable as a til
 #include "buildSwitches.h"
 
 #include <math.h>
+#include <string.h> // memset
 
 #ifdef SYNTH_USE_GLIB
   #include "../config.h" // GNU buildtools local configuration
@@ -306,10 +307,12 @@ not_transparent_corpus(
 
 
 /*
-Array of index of most recent target point that probed this corpus point 
-(recentProberMap[corpus x,y] = target)
+Array of one plus the index of the most recent target point that probed this corpus point 
+(recentProberMap[corpus x,y] = target + 1)
 !!! Larger than necessary if the corpus has holes in it.  TODO very minor.
-!!! Note recentProberMap is unsigned, -1 == 0xFFFFFF should not match any target index.
+0 means never probed, so that it matches no target index.
+Out-of-core if the corpus is: it is the same size in pixels, and probed at the same points.
+A new temporary file reads as zeroes, so it is not written, and its pages stay holes until probed.
 */
 static void
 prepareRecentProber(Map* corpusMap, Map* recentProberMap)
@@ -317,12 +320,19 @@ prepareRecentProber(Map* corpusMap, Map* recentProberMap)
   guint x;
   guint y;
   
-  new_intmap(recentProberMap, corpusMap->width, corpusMap->height);
+  if (corpusMap->tiles)
+  {
+    new_tiled_intmap(recentProberMap, corpusMap->width, corpusMap->height);
+    if (recentProberMap->tiles)
+      return;
+  }
+  else
+    new_intmap(recentProberMap, corpusMap->width, corpusMap->height);
   for(y=0; y< (guint) corpusMap->height; y++)
     for(x=0; x< (guint) corpusMap->width; x++)
     {
       Coordinates coords = {x,y};
-      *intmap_index(recentProberMap, coords) = -1;
+      *intmap_index(recentProberMap, coords) = 0;
     } 
 }
 
@@ -396,7 +406,27 @@ prepareTargetPoints(
 /* 
 Scan corpus pixmap for selected && nottransparent pixels, create vector of coords.
 Used to sample corpus.
+
+A huge, out-of-core corpus has more points than we want in memory (8 bytes each.)
+Then keep a uniform sample of about IMAGE_SYNTH_MAX_CORPUS_POINTS.
+An in-memory corpus keeps every point, as before.
+The sample is by a hash of the point's ordinal, not by a stride, 
+which would alias with any periodic texture in the corpus.
 */
+static inline gboolean
+isSampledCorpusPoint(
+  guint ordinal,
+  guint sampleStride
+  )
+{
+  guint hash = ordinal * 2654435761u;  // Knuth multiplicative, then mix high bits down
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3b;
+  hash ^= hash >> 16;
+  return (hash % sampleStride) == 0;
+}
+
+
 void
 prepareCorpusPoints (
   TFormatIndices* indices,
@@ -404,13 +434,27 @@ prepareCorpusPoints (
   pointVector* corpusPoints
   ) 
 {
-  /* Reserve size of pixmap, but excess, includes unselected. */
-  *corpusPoints = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates),
-   corpusMap->height*corpusMap->width);
-  
-  {
   guint x;
   guint y;
+  guint count = 0;
+  guint ordinal = 0;
+  guint sampleStride;
+  
+  // First pass counts, to reserve only what is needed, and to size the sample
+  for(y=0; y<corpusMap->height; y++)
+    for(x=0; x<corpusMap->width; x++)
+    {
+      Coordinates coords = {x, y};
+      if (isSelectedCorpus(coords, corpusMap) && not_transparent_corpus(coords, indices, corpusMap))
+        count++;
+    }
+  if (corpusMap->tiles)
+    sampleStride = (count + IMAGE_SYNTH_MAX_CORPUS_POINTS - 1) / IMAGE_SYNTH_MAX_CORPUS_POINTS;
+  else
+    sampleStride = 1;
+  
+  *corpusPoints = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates),
+   MAX(count / MAX(sampleStride, 1), 1));
   
   for(y=0; y<corpusMap->height; y++)
     for(x=0; x<corpusMap->width; x++)
@@ -423,10 +467,11 @@ prepareCorpusPoints (
         && not_transparent_corpus(coords, indices, corpusMap) /* Exclude transparent from corpus */
         ) 
       {
-        g_array_append_val(*corpusPoints, coords);
+        if ( sampleStride <= 1 || isSampledCorpusPoint(ordinal, sampleStride) )
+          g_array_append_val(*corpusPoints, coords);
+        ordinal++;
       }
     }
-  }
   // Size is checked by caller. 
 }
 
@@ -443,6 +488,43 @@ randomCorpusPoint (
 }
 
 
+/*
+Random streams for deterministic synthesis, one per target point per pass.
+A stream is a SplitMix64 generator, seeded by hashing the pass seed and the target index,
+so it does not depend on which thread synthesizes the point nor when.
+Cheap to create, unlike a GRand.
+*/
+static inline guint64
+nextStreamValue(guint64 *state)
+{
+  guint64 z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static inline guint64
+newPointStream(
+  guint64 passSeed,
+  guint target_index
+  )
+{
+  guint64 state = passSeed ^ ((guint64) target_index << 32);
+  return nextStreamValue(&state);
+}
+
+static inline Coordinates
+randomCorpusPointFromStream (
+  pointVector corpusPoints,
+  guint64 *stream
+  )
+{
+  // Uniform enough: high 32 bits scaled to range, without the bias of modulo
+  guint index = (guint) (((nextStreamValue(stream) >> 32) * corpusPoints->len) >> 32);
+  return g_array_index(corpusPoints, Coordinates, index);
+}
+
+
 
 
 /*
@@ -522,6 +604,7 @@ clippedOrMaskedCorpus(
 // imageSynth()->engine()->refiner()->synthesize
 #include "passes.h"
 #include "progress.h"
+#include "incremental.h"
 #include "synthesize.h"
 // Both files define the same function refiner()
 #ifdef SYNTH_THREADED
@@ -529,11 +612,30 @@ clippedOrMaskedCorpus(
 #else
   #include "refiner.h"
 #endif
+#include "batch.h"
+
+/*
+Hand the sourceOfMap of this synthesis to the caller, for a later incremental synthesis.
+Frees any prior map the caller passed in.
+*/
+static void
+returnSourceOfMap(
+  Map* sourceOfMap,       // IN, ownership passes to caller
+  Map* callerSourceOfMap  // OUT
+  )
+{
+  if (callerSourceOfMap->data)
+    free_map(callerSourceOfMap);
+  *callerSourceOfMap = *sourceOfMap;
+}
+
 
 /*
 The engine.
 Independent of platform, calling app, and graphics libraries.
 This is mostly preparation: real work done by refiner() and synthesize().
+
+Same as engineIncremental(), but always synthesizes the whole target.
 */
 
 int
@@ -546,6 +648,35 @@ engine(
   void *contextInfo,
   int *cancelFlag
   )
+{
+  return engineIncremental(parameters, indices, targetMap, corpusMap, 
+    (Map*) NULL, 
+    progressCallback, contextInfo, cancelFlag);
+}
+
+
+/*
+The engine, optionally resynthesizing only what changed since a prior synthesis of the same target.
+
+callerSourceOfMap:
+- NULL: synthesize the whole target, don't return sources
+- data NULL: synthesize the whole target, return sources
+- else a prior result: reuse valid prior sources (see incremental.h), return new sources
+On return (except on error) callerSourceOfMap holds a coordmap the size of targetMap
+that the caller must free_map(), or pass again to a later call.
+*/
+
+int
+engineIncremental(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap,
+  Map* callerSourceOfMap,   // IN/OUT, see above
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
 {
   // Engine private data. On stack (and heap), not global, so engine is reentrant.
   
@@ -626,6 +757,24 @@ engine(
     return IMAGE_SYNTH_ERROR_EMPTY_CORPUS;
   }
   
+  // Incremental: shrink the target to what changed since a prior synthesis, plus a band.
+  if ( callerSourceOfMap && callerSourceOfMap->data )
+    (void) reusePriorSources(&parameters, indices, targetMap, corpusMap,
+      callerSourceOfMap, 
+      &hasValueMap, 
+      &sourceOfMap, 
+      targetPoints);
+  
+  // Nothing changed since the prior synthesis: done, and not an error.
+  if ( !targetPoints->len )
+  {
+    g_array_free(targetPoints, TRUE);
+    g_array_free(corpusPoints, TRUE);
+    free_map(&hasValueMap);
+    returnSourceOfMap(&sourceOfMap, callerSourceOfMap);
+    return 0;
+  }
+  
   // prep things not images
   prepareSortedOffsets(targetMap, corpusMap, &sortedOffsets); // Depends on image size
   quantizeMetricFuncs(
@@ -640,7 +789,7 @@ engine(
   TODO the seed should be a hash of the input or a user parameter.
   Then it would be repeatable, but changeable by the user.
   */
-  prng = g_rand_new_with_seed(1198472);
+  prng = g_rand_new_with_seed(IMAGE_SYNTH_SEED);
   
   int error = orderTargetPoints(&parameters, targetPoints, prng);
   // A programming error that we don't clean up.
@@ -676,7 +825,10 @@ engine(
   // Caller must free the IN pixmaps since the targetMap holds synthesis results
   free_map(&recentProberMap);
   free_map(&hasValueMap);
-  free_map(&sourceOfMap);
+  if ( callerSourceOfMap )
+    returnSourceOfMap(&sourceOfMap, callerSourceOfMap);
+  else
+    free_map(&sourceOfMap);
   
   g_array_free(targetPoints, TRUE);
   g_array_free(corpusPoints, TRUE);
@@ -690,3 +842,64 @@ engine(
 }
 
 
+/*
+The engine for a batch of targets sharing one corpus.  See batch.h.
+*/
+
+int
+engineBatch(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  TSynthJob* jobs,
+  guint jobCount,
+  Map* corpusMap,
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
+{
+  TBatch batch;
+  pointVector corpusPoints;
+  TPixelelMetricFunc corpusTargetMetric;
+  TMapPixelelMetricFunc mapMetric;
+  guint i;
+  
+  if ( parameters.patchSize > IMAGE_SYNTH_MAX_NEIGHBORS)
+    return IMAGE_SYNTH_ERROR_PATCH_SIZE_EXCEEDED;
+  
+  for (i=0; i<jobCount; i++)
+    jobs[i].error = IMAGE_SYNTH_SUCCESS;
+  
+  // Shared by all jobs
+  prepareCorpusPoints(indices, corpusMap, &corpusPoints);
+  if (!corpusPoints->len )
+  {
+    g_array_free(corpusPoints, TRUE);
+    return IMAGE_SYNTH_ERROR_EMPTY_CORPUS;
+  }
+  quantizeMetricFuncs(
+    parameters.sensitivityToOutliers, 
+    parameters.mapWeight,
+    corpusTargetMetric,
+    mapMetric
+    );
+  
+  batch.parameters = &parameters;
+  batch.indices = indices;
+  batch.corpusMap = corpusMap;
+  batch.corpusPoints = corpusPoints;
+  batch.corpusTargetMetric = corpusTargetMetric;
+  batch.mapsMetric = mapMetric;
+  batch.jobs = jobs;
+  batch.jobCount = jobCount;
+  batch.nextJob = 0;
+  batch.doneJobCount = 0;
+  batch.progressCallback = progressCallback;
+  batch.contextInfo = contextInfo;
+  batch.cancelFlag = cancelFlag;
+  
+  runBatch(&batch);
+  
+  g_array_free(corpusPoints, TRUE);
+  return 0;
+}
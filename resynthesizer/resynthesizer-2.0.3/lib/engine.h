@@ -10,3 +10,44 @@ engine(
   void *contextInfo,
   int * cancelFlag
   );
+
+/*
+Same as engine(), but reuses a prior synthesis of the same target, if any, 
+and returns sources for a later call.  See engine.c.
+*/
+extern int
+engineIncremental(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap,
+  Map* sourceOfMap,   // IN/OUT coordmap: prior sources or NULL data; OUT: sources of this synthesis
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int * cancelFlag
+  );
+
+/*
+A target of engineBatch(), synthesized from the corpus shared by all targets of the batch.
+*/
+typedef struct {
+  Map targetMap;  // IN/OUT
+  int error;      // OUT status of this target, IMAGE_SYNTH_SUCCESS or TImageSynthError
+} TSynthJob;
+
+/*
+Same as engine() for each of many targets, but preparing the corpus once,
+and synthesizing targets in parallel.  See batch.h.
+Returns an error common to all targets, else the status of each target is in its job.
+*/
+extern int
+engineBatch(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  TSynthJob* jobs,    // IN/OUT
+  guint jobCount,
+  Map* corpusMap,
+  void (*progressCallback)(int, void*),   // percent of targets done
+  void *contextInfo,
+  int * cancelFlag
+  );
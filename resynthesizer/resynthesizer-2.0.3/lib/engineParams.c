@@ -16,5 +16,6 @@ setDefaultParams(
   param->sensitivityToOutliers                = 0.117; // 30/256
   param->patchSize                            = 30;
   param->maxProbeCount                        = 200;
+  param->isDeterministic                      = FALSE;
 }
 
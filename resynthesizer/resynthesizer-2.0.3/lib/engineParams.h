@@ -5,6 +5,9 @@ Same as engine parameters to be passed in the SimpleAPI.
 Also error return values of engine.
 */
 
+#ifndef __SYNTH_ENGINE_PARAMS_H__
+#define __SYNTH_ENGINE_PARAMS_H__
+
 #ifndef FALSE
   #define FALSE 0
 #endif
@@ -22,6 +25,8 @@ typedef enum  ImageSynthError
   // IN data errors, user error in making selection? returned by inner engine
   IMAGE_SYNTH_ERROR_EMPTY_TARGET,
   IMAGE_SYNTH_ERROR_EMPTY_CORPUS,
+  // Status of a target of a batch not (wholly) synthesized because canceled
+  IMAGE_SYNTH_ERROR_CANCELED,
   // There are more errors returned by the GIMP adapter
   // There will be more errors returned by a future FullAPI adapter, similar to GIMP adapter errors
   // These are only pertinent for the FullAPI, when more than one image is passed
@@ -83,6 +88,13 @@ typedef struct ImageSynthParametersStruct {
   Typically in the hundreds.
   */
   unsigned int maxProbeCount;
+  
+  /*
+  Boolean.  Whether results must be repeatable, bit-identical for any count of threads.
+  Else when threaded, results depend on timing of threads, and differ slightly from run to run.
+  Deterministic is a little slower, since threads synchronize often.
+  */
+  int isDeterministic;
 } TImageSynthParameters;
 
 
@@ -92,4 +104,5 @@ extern void
 setDefaultParams(
   TImageSynthParameters* param
   );
-  
+
+#endif
@@ -12,6 +12,8 @@ This is a limited subset: only what is used in synth.
 #define gint32 int
 #define gushort short unsigned int
 #define gulong long unsigned int
+#define gsize size_t   // Requires stddef.h
+#define guint64 unsigned long long
 
 #define gfloat float
 #define gdouble double
@@ -147,3 +149,14 @@ s_array_free(
 #define g_static_mutex_init(A)      pthread_mutex_init(A, NULL);        // POSIX additional parameter
 #define g_static_mutex_lock(A)      pthread_mutex_lock(A)
 #define g_static_mutex_unlock(A)    pthread_mutex_unlock(A)
+
+// Dynamic mutex, as used for progress and synthesize.h's mutex, likewise redirected to POSIX.
+// GCond is not proxied: where it is used, the code #ifdefs pthread_cond_t itself.
+#ifndef SYNTH_USE_GLIB
+#include <pthread.h>
+typedef pthread_mutex_t GMutex;
+#define g_mutex_init(A)     pthread_mutex_init(A, NULL)
+#define g_mutex_clear(A)    pthread_mutex_destroy(A)
+#define g_mutex_lock(A)     pthread_mutex_lock(A)
+#define g_mutex_unlock(A)   pthread_mutex_unlock(A)
+#endif
@@ -137,3 +137,112 @@ imageSynth(
 }
 
 
+/*
+Batch of masks of one image.  See lib/batch.h.
+
+Differences from calling imageSynth() once per mask:
+- the corpus is the image outside ALL masks, so no mask is healed from another unhealed mask
+- each mask is synthesized in a window of the image: 
+  its bounding box plus IMAGE_SYNTH_BATCH_CONTEXT_MARGIN of context, not the whole image
+- each mask is synthesized from the original image, not from the results of other masks.
+Where masks overlap, the result of the later mask wins.
+*/
+extern int
+imageSynthBatch(
+  ImageBuffer * imageBuffer,
+  ImageBuffer * masks,
+  unsigned int maskCount,
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,  // or NULL to use defaults
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag,
+  int *maskErrors
+  )
+{
+  Map corpusMap;
+  TFormatIndices formatIndices;
+  TSynthJob *jobs;
+  Coordinates *origins;       // Of window of each job
+  guint *jobMasks;            // Index of mask of each job
+  int *isMaskValid;
+  guint jobCount = 0;
+  guint pixelelPerPixel;
+  guint i;
+  int error;
+  
+  if (!parameters) {
+    static TImageSynthParameters defaultParameters;
+    setDefaultParams(&defaultParameters);
+    parameters = &defaultParameters;
+    }
+  
+  error = prepareImageFormatIndicesFromFormatType(&formatIndices, imageFormat);
+  if ( error ) return error;
+  pixelelPerPixel = countPixelelsPerPixelForFormat(imageFormat);
+  
+  isMaskValid = calloc(maskCount, sizeof(int));
+  jobs = calloc(maskCount, sizeof(TSynthJob));
+  origins = calloc(maskCount, sizeof(Coordinates));
+  jobMasks = calloc(maskCount, sizeof(guint));
+  g_assert(isMaskValid && jobs && origins && jobMasks);
+  
+  for (i=0; i<maskCount; i++)
+  {
+    maskErrors[i] = IMAGE_SYNTH_SUCCESS;
+    if (imageBuffer->width != masks[i].width || imageBuffer->height != masks[i].height)
+      maskErrors[i] = IMAGE_SYNTH_ERROR_IMAGE_MASK_MISMATCH;
+    else
+      isMaskValid[i] = TRUE;
+  }
+  
+  adaptSimpleBatchCorpus(imageBuffer, masks, isMaskValid, maskCount, &corpusMap, pixelelPerPixel);
+  
+  for (i=0; i<maskCount; i++)
+  {
+    Coordinates size;
+    
+    if ( ! isMaskValid[i] ) continue;
+    if ( ! getMaskWindow(&masks[i], IMAGE_SYNTH_BATCH_CONTEXT_MARGIN, &origins[jobCount], &size) )
+    {
+      maskErrors[i] = IMAGE_SYNTH_ERROR_EMPTY_TARGET;
+      continue;
+    }
+    adaptSimpleBatchTarget(&corpusMap, &masks[i], origins[jobCount], size, &jobs[jobCount].targetMap);
+    jobMasks[jobCount] = i;
+    jobCount++;
+  }
+  
+  if (jobCount)
+    error = engineBatch(
+      *parameters,
+      &formatIndices, 
+      jobs,
+      jobCount,
+      &corpusMap,
+      progressCallback,
+      contextInfo,
+      cancelFlag
+      );
+  
+  // In order of masks, so the later of overlapping masks wins
+  for (i=0; i<jobCount; i++)
+  {
+    if (error)
+      maskErrors[jobMasks[i]] = error;
+    else 
+    {
+      maskErrors[jobMasks[i]] = jobs[i].error;
+      if ( ! jobs[i].error )
+        antiAdaptSimpleBatchTarget(imageBuffer, &jobs[i].targetMap, origins[i], pixelelPerPixel);
+    }
+    free_map(&jobs[i].targetMap);
+  }
+  
+  free_map(&corpusMap);
+  free(isMaskValid);
+  free(jobs);
+  free(origins);
+  free(jobMasks);
+  return error;
+}
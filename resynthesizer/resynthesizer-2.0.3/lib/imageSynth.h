@@ -38,3 +38,22 @@ imageSynth(
   void *contextInfo,	// opaque to engine, passed in progressCallback
   int *cancelFlag		// polled by engine: engine quits if ever becomes True
   );
+
+/*
+Same as imageSynth() for each of many masks of the same image, in one call, in parallel.
+For example, to heal every blemish of a photo.
+maskErrors: OUT the status of each mask, IMAGE_SYNTH_SUCCESS or a TImageSynthError.
+Returns an error common to all masks, or IMAGE_SYNTH_SUCCESS.
+*/
+int
+imageSynthBatch(
+  ImageBuffer * imageBuffer,  // IN/OUT RGBA Pixels described by imageFormat
+  ImageBuffer * masks,        // IN array of maskCount masks, each the size of imageBuffer
+  unsigned int maskCount,
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),   // int percent of masks done, void *contextInfo
+  void *contextInfo,
+  int *cancelFlag,
+  int *maskErrors           // OUT array of maskCount
+  );
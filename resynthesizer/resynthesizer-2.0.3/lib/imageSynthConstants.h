@@ -98,3 +98,33 @@ for banded randomization of target points.
 // Count of target pixels synthesized per deep progress callback
 // !!! This must in binary all x lower bits ones i.e. 2^12-1
 #define IMAGE_SYNTH_CALLBACK_COUNT 4095
+
+
+/*
+Size in bytes of a corpus pixmap above which it is out-of-core (see mapOps.h.)
+About 200 megapixels RGB.  Smaller corpus are in memory, which is faster.
+*/
+#define IMAGE_SYNTH_OUT_OF_CORE_BYTES ((gsize) 1 << 30)
+
+/*
+Max count of corpus points sampled by random probes, for an out-of-core corpus.
+Such a corpus is sampled uniformly down to this many, to bound memory.
+Heuristic 1 (neighbors' sources) still reaches every point of the corpus.
+*/
+#define IMAGE_SYNTH_MAX_CORPUS_POINTS (1 << 24)
+
+/*
+Count of consecutive target points in a phase of deterministic synthesis (see synthesize.h.)
+Larger is less synchronization between threads, smaller is closer to the order of nondeterministic synthesis.
+Changing it changes deterministic results.
+*/
+#define IMAGE_SYNTH_PHASE_SIZE 256
+
+// Seed of pseudo random numbers.  Fixed, so results are repeatable.
+#define IMAGE_SYNTH_SEED 1198472
+
+/*
+Margin in pixels of context around each mask of a batch (see imageSynthBatch().)
+Context farther from the mask is rarely in a patch (at most 8x8 pixels) of a target point.
+*/
+#define IMAGE_SYNTH_BATCH_CONTEXT_MARGIN 20
@@ -0,0 +1,210 @@
+/*
+Incremental resynthesis.
+
+Interactive users often heal, then grow or tweak the selection a little, and heal again.
+Without this, each call resynthesizes the whole target from scratch.
+
+Here the caller passes the sourceOfMap returned by a prior synthesis of the same target.
+A target point whose prior source is still valid (see below) keeps its color and source,
+and becomes context: it has a value but is not in targetPoints, so it is not resynthesized.
+Target points without a valid prior source are resynthesized,
+together with a band of reused points around them, so the new pixels blend into the old.
+The cost is then proportional to the change rather than to the whole target.
+
+A prior source is valid only if:
+- it is a point in the corpus (not clipped, selected, not transparent)
+- AND the target pixel still has the color of its source.
+The latter catches most ways the prior state can go stale:
+the user painted over the result, undid it, or the corpus changed.
+It is conservative: when in doubt, resynthesize.
+
+  Copyright (C) 2010, 2011  Lloyd Konneker
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+/* Whether a prior source can be reused for a target point. See above. */
+static gboolean
+isValidPriorSource(
+  Coordinates target_point,
+  Coordinates prior_source,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap
+  )
+{
+  TPixelelIndex j;
+
+  if ( prior_source.x == -1 ) return FALSE; // Not synthesized last time
+  if ( clippedOrMaskedCorpus(prior_source, corpusMap) ) return FALSE;
+  if ( ! not_transparent_corpus(prior_source, indices, corpusMap) ) return FALSE;
+
+  for(j=FIRST_PIXELEL_INDEX; j<indices->colorEndBip; j++)
+    if ( pixmap_index(targetMap, target_point)[j] != pixmap_index(corpusMap, prior_source)[j] )
+      return FALSE;
+  return TRUE;
+}
+
+
+/*
+Width of band (in pixels) of reused target points to resynthesize around changed target points.
+The side of a square patch: a changed point can be a neighbor of any point within this distance.
+*/
+static inline guint
+incrementalBandWidth(TImageSynthParameters* parameters)
+{
+  return (guint) ceil(sqrt((double) parameters->patchSize));
+}
+
+
+/*
+Dilate a bytemap by a square (Chebyshev distance) of radius band.
+Separable: a horizontal pass then a vertical pass, each counting set elements in a sliding window.
+*/
+static void
+dilate_bytemap(
+  Map* map,    // IN/OUT
+  guint band
+  )
+{
+  Map temp;
+  guint x;
+  guint y;
+
+  new_bytemap(&temp, map->width, map->height);
+
+  // Horizontal pass: map => temp
+  for(y=0; y<map->height; y++)
+  {
+    guint count = 0;  // Count of set elements in window [x-band, x+band]
+    for(x=0; x<map->width+band; x++)
+    {
+      if ( x < map->width )
+      {
+        Coordinates entering = {x, y};
+        if ( *bytemap_index(map, entering) ) count++;
+      }
+      if ( x >= 2*band+1 )
+      {
+        Coordinates leaving = {x-2*band-1, y};
+        if ( *bytemap_index(map, leaving) ) count--;
+      }
+      if ( x >= band )
+      {
+        Coordinates center = {x-band, y};
+        *bytemap_index(&temp, center) = (count > 0);
+      }
+    }
+  }
+
+  // Vertical pass: temp => map
+  for(x=0; x<map->width; x++)
+  {
+    guint count = 0;
+    for(y=0; y<map->height+band; y++)
+    {
+      if ( y < map->height )
+      {
+        Coordinates entering = {x, y};
+        if ( *bytemap_index(&temp, entering) ) count++;
+      }
+      if ( y >= 2*band+1 )
+      {
+        Coordinates leaving = {x, y-2*band-1};
+        if ( *bytemap_index(&temp, leaving) ) count--;
+      }
+      if ( y >= band )
+      {
+        Coordinates center = {x, y-band};
+        *bytemap_index(map, center) = (count > 0);
+      }
+    }
+  }
+
+  free_map(&temp);
+}
+
+
+/*
+Reuse prior sources.
+
+Requires prepareTargetPoints() and prepare_target_sources() done.
+Must precede orderTargetPoints(), since it shrinks targetPoints.
+
+Returns count of target points reused without resynthesis.
+*/
+static guint
+reusePriorSources(
+  TImageSynthParameters* parameters,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap,
+  Map* priorSourceOfMap,  // IN
+  Map* hasValueMap,       // IN/OUT
+  Map* sourceOfMap,       // IN/OUT
+  pointVector targetPoints  // IN/OUT
+  )
+{
+  Map changedMap; // Bytemap: target point must be resynthesized (ie has no valid prior source)
+  guint i;
+  guint keptCount = 0;
+  guint reusedCount = 0;
+
+  // Prior state is for a different target, e.g. the drawable was scaled: reuse nothing.
+  if ( priorSourceOfMap->width != targetMap->width || priorSourceOfMap->height != targetMap->height )
+    return 0;
+
+  new_bytemap(&changedMap, targetMap->width, targetMap->height);
+  set_bytemap(&changedMap, FALSE);
+
+  for(i=0; i<targetPoints->len; i++)
+  {
+    Coordinates position = g_array_index(targetPoints, Coordinates, i);
+    Coordinates prior_source = getSourceOf(position, priorSourceOfMap);
+
+    if ( isValidPriorSource(position, prior_source, indices, targetMap, corpusMap) )
+    {
+      /*
+      Start from the prior result: the point has a value and a source.
+      Even if it is in the band and resynthesized, this is a good first probe for it
+      and a good neighbor for the changed points.
+      */
+      setSourceOf(position, prior_source, sourceOfMap);
+      setHasValue(&position, TRUE, hasValueMap);
+    }
+    else
+      *bytemap_index(&changedMap, position) = TRUE;
+  }
+
+  dilate_bytemap(&changedMap, incrementalBandWidth(parameters));
+
+  /*
+  Compact targetPoints in place, keeping only changed points and the band around them.
+  Stable, so any order imposed by the caller is kept.
+  */
+  for(i=0; i<targetPoints->len; i++)
+  {
+    Coordinates position = g_array_index(targetPoints, Coordinates, i);
+    if ( *bytemap_index(&changedMap, position) )
+      g_array_index(targetPoints, Coordinates, keptCount++) = position;
+    else
+      reusedCount++;
+  }
+  targetPoints->len = keptCount;
+
+  free_map(&changedMap);
+  return reusedCount;
+}
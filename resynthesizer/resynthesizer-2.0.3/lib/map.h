@@ -24,12 +24,19 @@ Bytemap: type is char (often used as a bool)
 Pixmap: type is Pixel
 Intmap: type is int
 Coordmap: type is Coordinates
+
+Usually the elements are in data, in row major order.
+A map too large for memory (a huge corpus) can instead be out-of-core:
+the elements are in tiles, in a temporary file mapped into memory, and data is NULL.
+See new_corpus_pixmap() and mapIndex.h.
 */
 typedef struct {
   guint width;
   guint height;
   guint depth; 
   GArray * data;
+  guchar * tiles;     // Mapped file, or NULL if elements are in data
+  gsize tilesSize;    // Bytes mapped
   } Map;
 
 typedef guint8 Pixelel;
@@ -71,6 +78,21 @@ new_intmap(
   guint
   );
 
+extern void
+new_corpus_pixmap(
+  Map *,
+  guint, 
+  guint, 
+  guint
+  );
+
+extern void
+new_tiled_intmap(
+  Map *,
+  guint, 
+  guint
+  );
+
 extern void
 new_coordmap(
   Map *,
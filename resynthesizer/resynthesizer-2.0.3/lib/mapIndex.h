@@ -35,6 +35,34 @@ Here we use static inline rather than a macro.
 
 
 
+/*
+Out-of-core maps (see new_corpus_pixmap() in mapOps.h) are square tiles of elements,
+each tile contiguous, tiles in row major order, elements within a tile in row major order.
+A patch then touches a few tiles (pages of the mapped file) instead of a page per row,
+so a working set of a few tiles stays resident while the kernel pages the rest in and out.
+
+Returns the index of the element, not of its first byte.
+!!! gsize, since an out-of-core map can exceed 4G bytes.
+*/
+#define MAP_TILE_SHIFT  6   // Tiles of 64x64 elements
+#define MAP_TILE_SIDE   (1 << MAP_TILE_SHIFT)
+#define MAP_TILE_MASK   (MAP_TILE_SIDE - 1)
+
+static inline gsize
+tiled_map_offset(
+  const Map * const map,
+  const Coordinates coords
+  )
+{
+  gsize tilesPerRow = (map->width + MAP_TILE_MASK) >> MAP_TILE_SHIFT;
+  gsize tile = (coords.y >> MAP_TILE_SHIFT) * tilesPerRow + (coords.x >> MAP_TILE_SHIFT);
+  
+  return (tile << (2*MAP_TILE_SHIFT)) 
+    + ((coords.y & MAP_TILE_MASK) << MAP_TILE_SHIFT) 
+    + (coords.x & MAP_TILE_MASK);
+}
+
+
 /* 
 !!! Note in this case the 3rd dimension, depth, varies. 
 i.e. a Pixel is a variable-length array of Pixelels.
@@ -45,8 +73,12 @@ pixmap_index(
   const Coordinates coords
   )
 {
+  if (map->tiles)
+    return map->tiles + tiled_map_offset(map, coords) * map->depth;
+  {
   guint index = (coords.x + coords.y * map->width) * map->depth;
   return &g_array_index(map->data, Pixelel, index);
+  }
 }
   
 /* Return pointer to guint at coordinates in map. */
@@ -56,8 +88,12 @@ intmap_index(
   const Coordinates coords
   )
 {
+  if (map->tiles)
+    return ((guint *) map->tiles) + tiled_map_offset(map, coords);
+  {
   guint index = coords.x + coords.y * map->width;
   return &g_array_index(map->data, guint, index);
+  }
 }
   
 /* Return pointer to coordinates at coordinates in map. */
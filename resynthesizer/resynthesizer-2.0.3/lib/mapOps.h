@@ -32,10 +32,26 @@ Here, there are separate functions for creating and indexing each type of map.
 
 // Note, included, not compiled separately
 
+#ifdef SYNTH_TILED_CORPUS
+  #include <stdio.h>    // snprintf
+  #include <stdlib.h>   // mkstemp, getenv
+  #include <unistd.h>   // ftruncate, unlink, close
+  #include <sys/mman.h> // mmap
+#endif
+
 void
 free_map (Map *map)
 {
-  g_array_free(map->data, TRUE);
+  if (map->tiles)
+  {
+    #ifdef SYNTH_TILED_CORPUS
+    munmap(map->tiles, map->tilesSize);
+    #endif
+    map->tiles = NULL;
+    map->tilesSize = 0;
+  }
+  else
+    g_array_free(map->data, TRUE);
   map->data = (GArray *) NULL;
 }
   
@@ -59,6 +75,8 @@ new_pixmap(
    map->data = g_array_sized_new (FALSE, TRUE, sizeof(Pixelel), size);
   */
   map->data = g_array_sized_new (FALSE, TRUE, depth, width * height);
+  map->tiles = NULL;
+  map->tilesSize = 0;
 }
 
 
@@ -74,6 +92,8 @@ new_intmap(
   map->height = height;
   map->depth = sizeof(guint);   // Not used
   map->data = g_array_sized_new (FALSE, TRUE, sizeof(guint), width * height);
+  map->tiles = NULL;
+  map->tilesSize = 0;
 }
 
 /* Create dynamic 2-D array of Coordinates. */
@@ -88,6 +108,8 @@ new_coordmap(
   map->height = height;
   map->depth = sizeof(Coordinates);   // Not used
   map->data = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), width * height);
+  map->tiles = NULL;
+  map->tilesSize = 0;
 }
   
 /* Create dynamic 2-D array of guchar. */
@@ -104,6 +126,117 @@ new_bytemap(
 
 
 
+/*
+Out-of-core maps.
+
+A corpus of hundreds of megapixels (e.g. a panorama) as a pixmap, plus its recentProberMap,
+can exceed memory, and g_array_sized_new() then aborts.
+Instead, put such maps in an unlinked temporary file mapped into memory, in tiles (see mapIndex.h).
+The kernel page cache is the tile cache: it keeps recently probed tiles resident,
+reads others on demand, and writes back or drops the least recently used under memory pressure.
+A cache in our own code would need locking, since the synthesis threads share the corpus.
+Indexing differs only by a test of map->tiles, so in-memory maps cost the same as before.
+
+Returns FALSE if the map could not be created (e.g. no disk space or platform without mmap.)
+Then the caller falls back to an in-memory map.
+*/
+#ifdef SYNTH_TILED_CORPUS
+static const char *
+tiled_map_dir(void)
+{
+  #ifdef SYNTH_USE_GLIB
+  return g_get_tmp_dir();
+  #else
+  const char * dir = getenv("TMPDIR");
+  return dir ? dir : "/tmp";
+  #endif
+}
+#endif
+
+
+static gboolean
+new_tiled_map(
+  Map * map,
+  guint width, 
+  guint height, 
+  guint depth   // Bytes per element
+  )
+{
+  #ifdef SYNTH_TILED_CORPUS
+  gsize tilesPerRow = (width + MAP_TILE_MASK) >> MAP_TILE_SHIFT;
+  gsize tilesPerColumn = (height + MAP_TILE_MASK) >> MAP_TILE_SHIFT;
+  gsize size = tilesPerRow * tilesPerColumn * MAP_TILE_SIDE * MAP_TILE_SIDE * depth;
+  char path[1024];
+  int fd;
+  void * tiles;
+  
+  snprintf(path, sizeof(path), "%s/resynthesizer-XXXXXX", tiled_map_dir());
+  fd = mkstemp(path);
+  if (fd < 0)
+    return FALSE;
+  // Unlink now, so the file goes away when unmapped, even if we crash.
+  unlink(path);
+  // Sparse, zero filled.  Unlike malloc, disk space is only claimed as pages are written.
+  if (ftruncate(fd, size) != 0)
+  {
+    close(fd);
+    return FALSE;
+  }
+  tiles = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);  // Mapping keeps the file open
+  if (tiles == MAP_FAILED)
+    return FALSE;
+  // Probes are random: read ahead would only evict useful tiles.
+  #ifdef MADV_RANDOM
+  (void) madvise(tiles, size, MADV_RANDOM);
+  #endif
+  
+  map->width = width;
+  map->height = height;
+  map->depth = depth;
+  map->data = (GArray *) NULL;
+  map->tiles = tiles;
+  map->tilesSize = size;
+  return TRUE;
+  #else
+  return FALSE;
+  #endif
+}
+
+
+/* 
+Create new Pixmap for a corpus (or other large, read mostly image.)
+Out-of-core if it is larger than IMAGE_SYNTH_OUT_OF_CORE_BYTES, else same as new_pixmap().
+*/
+void
+new_corpus_pixmap(
+  Map * map,
+  guint width, 
+  guint height, 
+  guint depth
+  )
+{
+  if ( (gsize) width * height * depth < IMAGE_SYNTH_OUT_OF_CORE_BYTES
+    || ! new_tiled_map(map, width, height, depth) 
+    )
+    new_pixmap(map, width, height, depth);
+}
+
+
+/* Create out-of-core intmap, or an in-memory one if that fails. */
+void
+new_tiled_intmap(
+  Map * map,
+  guint width, 
+  guint height
+  )
+{
+  if ( ! new_tiled_map(map, width, height, sizeof(guint)) )
+    new_intmap(map, width, height);
+}
+
+
+
 /* Misc operations on Map. */
 
 /* Set all elements of bytemap to a value. 
@@ -156,15 +289,19 @@ interleave_mask(
   Map *mask
   )
 {
-  guint i;
+  guint x;
+  guint y;
   
-  guint size = pixmap->height * pixmap->width;
-  g_assert( size == mask->height * mask->width);  /* Same dimensions. */
+  g_assert( pixmap->height == mask->height && pixmap->width == mask->width);  /* Same dimensions. */
 
-  for (i=0; i < size; i++)
-    /* Copy one byte */
-    g_array_index(pixmap->data, Pixelel, i*pixmap->depth + MASK_PIXELEL_INDEX) =
-          g_array_index(mask->data, Pixelel, i*mask->depth);
+  /* By coordinates, since pixmap may be out-of-core i.e. tiled. */
+  for (y=0; y < pixmap->height; y++)
+    for (x=0; x < pixmap->width; x++)
+    {
+      Coordinates coords = {x,y};
+      /* Copy one byte */
+      pixmap_index(pixmap, coords)[MASK_PIXELEL_INDEX] = *bytemap_index(mask, coords);
+    }
 }
 
 
@@ -11,6 +11,11 @@
   #include <glib.h>
 #endif
 
+#ifdef USE_GLIB_PROXY
+  #include <stddef.h>   // size_t
+  #include "glibProxy.h"  // Redefines the glib structs and routines used here
+#endif
+
 
 #include "imageSynthConstants.h"
 #include "progress.h"
@@ -64,7 +64,17 @@ refiner(
   
   ProgressRecordT progressRecord;
 
+  // Deterministic synthesis only.  Unthreaded is deterministic anyway, but not the same as threaded.
+  TSynthPhase phase;
+  GArray *phaseResults = NULL;
+  
   prepare_repetition_parameters(repetition_params, targetPoints->len);
+  
+  if (parameters.isDeterministic)
+  {
+    phaseResults = newPhaseResults();
+    phase.results = (TPhaseResult*) phaseResults->data;
+  }
 
   initializeProgressRecord(
     &progressRecord,
@@ -77,9 +87,49 @@ refiner(
     guint endTargetIndex = repetition_params[pass][1];
     gulong betters = 0; // gulong so can be cast to void *
     
-    betters = synthesize(
+    if (parameters.isDeterministic)
+    {
+      // Phases as in refinerThreaded.h, but all in this thread
+      guint startPhaseIndex;
+      
+      phase.passSeed = passSeed(pass);
+      for (startPhaseIndex=0; startPhaseIndex<endTargetIndex; startPhaseIndex += IMAGE_SYNTH_PHASE_SIZE)
+      {
+        guint endPhaseIndex = MIN(startPhaseIndex + IMAGE_SYNTH_PHASE_SIZE, endTargetIndex);
+        
+        betters += synthesize(
+          &parameters,
+          0,      // Unthreaded synthesis is threadIndex 0
+          1,      // Unthreaded synthesis is one thread
+          startPhaseIndex,
+          endPhaseIndex,
+          indices,
+          targetMap,
+          corpusMap,
+          recentProberMap,
+          hasValueMap,
+          sourceOfMap,
+          targetPoints,
+          corpusPoints,
+          sortedOffsets,
+          prng,
+          corpusTargetMetric,
+          mapsMetric,
+          deepProgressCallback,
+          &progressRecord,
+          cancelFlag,
+          &phase
+          );
+        commitPhase(0, 1, startPhaseIndex, endPhaseIndex, 
+          indices, targetMap, corpusMap, hasValueMap, sourceOfMap, targetPoints, &phase);
+        if (*cancelFlag) break;
+      }
+    }
+    else
+      betters = synthesize(
         &parameters,
         0,      // Unthreaded synthesis is threadIndex 0
+        1,      // Unthreaded synthesis is one thread
         0,      // Unthreaded synthesis startTargetIndex is 0
         endTargetIndex,
         indices,
@@ -96,7 +146,8 @@ refiner(
         mapsMetric,
         deepProgressCallback,
 	&progressRecord,	// parameters to progress callback.  progressRecord is on stack.
-        cancelFlag
+        cancelFlag,
+        (TSynthPhase*) NULL
         );
 
     // nil unless DEBUG
@@ -119,4 +170,7 @@ refiner(
     // And the later passes are much shorter than earlier passes.
     // progressCallback( (int) ((pass+1.0)/(MAX_PASSES+1)*100), contextInfo);
   } // end pass
+  
+  if (phaseResults)
+    g_array_free(phaseResults, TRUE);
 }
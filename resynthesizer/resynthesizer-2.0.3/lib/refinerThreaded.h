@@ -55,6 +55,127 @@ Sept. 2011.  One experiment shows it is no faster, and produces different, grain
 #endif
 
 
+/*
+Barrier between phases of deterministic synthesis (see synthesize.h.)
+Glib has no barrier, and POSIX barriers are optional, so a conventional one from a mutex and condition.
+The last thread to arrive also samples the cancel flag, so all threads agree whether to quit.
+*/
+typedef struct {
+#ifdef SYNTH_USE_GLIB_THREADS
+  GMutex mutex;
+  GCond cond;
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+  guint count;        // Of threads
+  guint waiting;      // Count of threads arrived
+  guint generation;   // Count of times all threads arrived
+  gboolean isCanceled;
+} TPhaseBarrier;
+
+
+static void
+initPhaseBarrier(
+  TPhaseBarrier* barrier,
+  guint count
+  )
+{
+#ifdef SYNTH_USE_GLIB_THREADS
+  g_mutex_init(&barrier->mutex);
+  g_cond_init(&barrier->cond);
+#else
+  pthread_mutex_init(&barrier->mutex, NULL);
+  pthread_cond_init(&barrier->cond, NULL);
+#endif
+  barrier->count = count;
+  barrier->waiting = 0;
+  barrier->generation = 0;
+  barrier->isCanceled = FALSE;
+}
+
+
+static void
+clearPhaseBarrier(TPhaseBarrier* barrier)
+{
+#ifdef SYNTH_USE_GLIB_THREADS
+  g_mutex_clear(&barrier->mutex);
+  g_cond_clear(&barrier->cond);
+#else
+  pthread_mutex_destroy(&barrier->mutex);
+  pthread_cond_destroy(&barrier->cond);
+#endif
+}
+
+
+/*
+Change the count of threads, before any round can complete with the new count.
+The caller arrives after, so a round in progress completes on its arrival.
+*/
+static void
+setPhaseBarrierCount(
+  TPhaseBarrier* barrier,
+  guint count
+  )
+{
+#ifdef SYNTH_USE_GLIB_THREADS
+  g_mutex_lock(&barrier->mutex);
+#else
+  pthread_mutex_lock(&barrier->mutex);
+#endif
+  barrier->count = count;
+#ifdef SYNTH_USE_GLIB_THREADS
+  g_mutex_unlock(&barrier->mutex);
+#else
+  pthread_mutex_unlock(&barrier->mutex);
+#endif
+}
+
+
+/* Wait for all threads.  Returns whether canceled. */
+static gboolean
+waitPhaseBarrier(
+  TPhaseBarrier* barrier,
+  int* cancelFlag
+  )
+{
+  gboolean isCanceled;
+  guint generation;
+  
+#ifdef SYNTH_USE_GLIB_THREADS
+  g_mutex_lock(&barrier->mutex);
+#else
+  pthread_mutex_lock(&barrier->mutex);
+#endif
+  generation = barrier->generation;
+  if (++barrier->waiting == barrier->count)
+  {
+    barrier->waiting = 0;
+    barrier->generation++;
+    barrier->isCanceled = *cancelFlag;
+#ifdef SYNTH_USE_GLIB_THREADS
+    g_cond_broadcast(&barrier->cond);
+#else
+    pthread_cond_broadcast(&barrier->cond);
+#endif
+  }
+  else
+    while (generation == barrier->generation)
+#ifdef SYNTH_USE_GLIB_THREADS
+      g_cond_wait(&barrier->cond, &barrier->mutex);
+#else
+      pthread_cond_wait(&barrier->cond, &barrier->mutex);
+#endif
+  isCanceled = barrier->isCanceled;
+#ifdef SYNTH_USE_GLIB_THREADS
+  g_mutex_unlock(&barrier->mutex);
+#else
+  pthread_mutex_unlock(&barrier->mutex);
+#endif
+  return isCanceled;
+}
+
+
 // When synthesize() is threaded, it needs a single argument.
 // Wrapper struct for single arg to synthesize
 typedef struct synthArgsStruct {
@@ -77,6 +198,8 @@ typedef struct synthArgsStruct {
   void (*deepProgressCallback)();         // void func(void)
   ProgressRecordT *progressRecord;
   int* cancelFlag;  // flag set when canceled
+  TSynthPhase *phase;       // Deterministic synthesis only, else NULL
+  TPhaseBarrier *barrier;   // Ditto
 } SynthArgs;
 
 
@@ -104,7 +227,9 @@ newSynthesisArgs(
   TMapPixelelMetricFunc mapsMetric,
   void (*deepProgressCallback)(),
   ProgressRecordT* progressRecord,
-  int* cancelFlag
+  int* cancelFlag,
+  TSynthPhase *phase,
+  TPhaseBarrier *barrier
   )
 {
   args->parameters = parameters;
@@ -126,6 +251,8 @@ newSynthesisArgs(
   args->deepProgressCallback = deepProgressCallback;
   args->progressRecord = progressRecord;
   args->cancelFlag = cancelFlag;
+  args->phase = phase;
+  args->barrier = barrier;
 }
 
 
@@ -160,6 +287,7 @@ synthesisThread(void * uncastArgs)
   gulong betters = synthesize(  // gulong so can be cast to void *
       parameters,
       threadIndex,
+      THREAD_LIMIT,
       startTargetIndex,
       endTargetIndex,
       indices,
@@ -176,13 +304,87 @@ synthesisThread(void * uncastArgs)
       mapsMetric,
       deepProgressCallback,
       progressRecord,	// parameters to progress callback.  progressRecord is in stack frame of refinerThreaded().
-      cancelFlag
+      cancelFlag,
+      (TSynthPhase*) NULL
       );
   return (void*) betters;
 }
 
-static void
+
+/*
+Deterministic synthesis of a pass: every thread synthesizes its slice of each phase,
+then every thread commits its slice of the phase.  See synthesize.h.
+One thread may do the slices of several, as one party to the barrier:
+the caller does the slices of threads that failed to start.
+*/
+static gulong
+deterministicSynthesis(
+  SynthArgs** slices,
+  guint sliceCount
+  )
+{
+  SynthArgs* args = slices[0];  // Slices differ only in threadIndex
+  gulong betters = 0;
+  guint startPhaseIndex;
+  guint slice;
+  
+  for (startPhaseIndex=args->startTargetIndex; 
+      startPhaseIndex<args->endTargetIndex; 
+      startPhaseIndex += IMAGE_SYNTH_PHASE_SIZE)
+  {
+    guint endPhaseIndex = MIN(startPhaseIndex + IMAGE_SYNTH_PHASE_SIZE, args->endTargetIndex);
+    gboolean isCanceled;
+    
+    for (slice=0; slice<sliceCount; slice++)
+      betters += synthesize(
+        args->parameters,
+        slices[slice]->threadIndex,
+        THREAD_LIMIT,
+        startPhaseIndex,
+        endPhaseIndex,
+        args->indices,
+        args->targetMap,
+        args->corpusMap,
+        args->recentProberMap,
+        args->hasValueMap,
+        args->sourceOfMap,
+        args->targetPoints,
+        args->corpusPoints,
+        args->sortedOffsets,
+        args->prng,
+        args->corpusTargetMetric, 
+        args->mapsMetric,
+        args->deepProgressCallback,
+        args->progressRecord,
+        args->cancelFlag,
+        args->phase
+        );
+    // Until all threads have synthesized this phase, no thread writes it
+    isCanceled = waitPhaseBarrier(args->barrier, args->cancelFlag);
+    for (slice=0; slice<sliceCount; slice++)
+      commitPhase(slices[slice]->threadIndex, THREAD_LIMIT, startPhaseIndex, endPhaseIndex, 
+        args->indices, args->targetMap, args->corpusMap, args->hasValueMap, args->sourceOfMap, 
+        args->targetPoints, args->phase);
+    // Until all threads have committed this phase, no thread reads it
+    (void) waitPhaseBarrier(args->barrier, args->cancelFlag);
+    if (isCanceled) break;
+  }
+  return betters;
+}
+
+
+static void *
+deterministicSynthesisThread(void * uncastArgs)
+{
+  SynthArgs* args = (SynthArgs *) uncastArgs;
+  
+  return (void*) deterministicSynthesis(&args, 1);  // gulong so can be cast to void *
+}
+
+/* Returns whether the thread started.  If not, the caller must do its slice. */
+static gboolean
 startThread(
+  void * (*threadFunc)(void *), // synthesisThread or deterministicSynthesisThread
   SynthArgs* args,
 #ifdef SYNTH_USE_GLIB_THREADS
   GThread** thread,
@@ -207,7 +409,9 @@ startThread(
   TMapPixelelMetricFunc mapsMetric,
   void (*deepProgressCallback)(),
   ProgressRecordT *progressRecord,
-  int* cancelFlag
+  int* cancelFlag,
+  TSynthPhase *phase,
+  TPhaseBarrier *barrier
   )
 {
   newSynthesisArgs(
@@ -230,7 +434,9 @@ startThread(
     mapsMetric,
     deepProgressCallback,
     progressRecord,
-    cancelFlag
+    cancelFlag,
+    phase,
+    barrier
     );
 
 #ifdef SYNTH_USE_GLIB_THREADS
@@ -238,15 +444,19 @@ startThread(
 
   g_assert(g_thread_supported());
   // old, deprecated: *thread = g_thread_create(synthesisThread, (void * __restrict__) args, TRUE, &error);
-  *thread = g_thread_try_new(NULL, synthesisThread, (void * __restrict__) args, &error);
+  *thread = g_thread_try_new(NULL, threadFunc, (void * __restrict__) args, &error);
   if (error != NULL) 
   {
     printf("Error creating thread: %s\n", error->message);
-    // Only for debugging:  app will likely crash.  Caller does not handle this error sufficiently.
-    // *thread is probably NULL
+    g_error_free(error);
+    *thread = NULL;
   }
+  return (*thread != NULL);
 #else
-    pthread_create(thread, NULL, synthesisThread, (void * __restrict__) args);
+  int error = pthread_create(thread, NULL, threadFunc, (void * __restrict__) args);
+  if (error != 0)
+    printf("Error creating thread: %d\n", error);
+  return (error == 0);
 #endif
 }
 
@@ -298,8 +508,23 @@ refiner(
 
 
   SynthArgs synthArgs[THREAD_LIMIT];
+  gboolean started[THREAD_LIMIT];
+  
+  // Deterministic synthesis only
+  TSynthPhase phase;
+  GArray *phaseResults = NULL;
+  TPhaseBarrier barrier;
+  void * (*threadFunc)(void *) = synthesisThread;
 
   prepare_repetition_parameters(repetition_params, targetPoints->len);
+  
+  if (parameters.isDeterministic)
+  {
+    phaseResults = newPhaseResults();
+    phase.results = (TPhaseResult*) phaseResults->data;
+    initPhaseBarrier(&barrier, THREAD_LIMIT);
+    threadFunc = deterministicSynthesisThread;
+  }
 
   initializeThreadedProgressRecord(
     &progressRecord,
@@ -316,9 +541,16 @@ refiner(
     gulong betters = 0;
 
     guint threadIndex;
+    SynthArgs* unstarted[THREAD_LIMIT];
+    guint unstartedCount = 0;
+    
+    phase.passSeed = passSeed(pass);
+    if (parameters.isDeterministic)
+      setPhaseBarrierCount(&barrier, THREAD_LIMIT);
     for (threadIndex=0; threadIndex<THREAD_LIMIT; threadIndex++)
     {
-      startThread(
+      started[threadIndex] = startThread(
+        threadFunc,
         &synthArgs[threadIndex], &threads[threadIndex], threadIndex, // thread specific
         0, endTargetIndex,      // Every thread works on a prefix of targetPoints, splits it modulo threadIndex
         &parameters,
@@ -335,8 +567,29 @@ refiner(
         corpusTargetMetric, mapsMetric,
         deepProgressCallback,
         &progressRecord,
-        cancelFlag
+        cancelFlag,
+        parameters.isDeterministic ? &phase : (TSynthPhase*) NULL,
+        &barrier
         );
+      if (!started[threadIndex])
+        unstarted[unstartedCount++] = &synthArgs[threadIndex];
+   }
+
+   /*
+   Do the slices of threads not started, else they go unsynthesized
+   and the barrier waits forever for them.
+   This thread stands in for all of them at the barrier.
+   */
+   if (unstartedCount > 0)
+   {
+     if (parameters.isDeterministic)
+     {
+       setPhaseBarrierCount(&barrier, THREAD_LIMIT - unstartedCount + 1);
+       betters += deterministicSynthesis(unstarted, unstartedCount);
+     }
+     else
+       for (threadIndex=0; threadIndex<unstartedCount; threadIndex++)
+         betters += (gulong) synthesisThread(unstarted[threadIndex]);
    }
 
    // Wait for threads to complete; rejoin them
@@ -344,6 +597,9 @@ refiner(
    {
      gulong temp;
 
+     if (!started[threadIndex])
+       continue;
+
 #ifdef SYNTH_USE_GLIB_THREADS
      temp = (gulong) g_thread_join(threads[threadIndex]);       // cast return value from gpointer to gulong
 #else
@@ -373,6 +629,12 @@ refiner(
     // And the later passes are much shorter than earlier passes.
     // progressCallback( (int) ((pass+1.0)/(MAX_PASSES+1)*100), contextInfo);
   }
+  
+  if (phaseResults)
+  {
+    clearPhaseBarrier(&barrier);
+    g_array_free(phaseResults, TRUE);
+  }
 }
 
 
@@ -43,11 +43,43 @@ Innermost routines of image synthesis.
   #endif
 
 #else   // No threads: redefine mutex functions to nil
+  #undef g_mutex_lock
+  #undef g_mutex_unlock
   #define g_mutex_lock(A)
   #define g_mutex_unlock(A)
 #endif
 
 
+/*
+Deterministic synthesis (parameters->isDeterministic.)
+
+Otherwise results depend on thread timing: threads read neighbors that other threads are writing,
+and share one prng.
+Deterministic synthesis instead proceeds in phases of IMAGE_SYNTH_PHASE_SIZE consecutive target points.
+Within a phase, synthesis reads only what earlier phases wrote: 
+each result is deferred in a TPhaseResult and committed by commitPhase() after all threads finish the phase.
+Random probes come from a stream per target point per pass (see randomCorpusPointFromStream())
+instead of the shared prng.
+Heuristic 2 is per target point instead of by the shared recentProberMap.
+Then the result depends only on the phases, not on which thread synthesizes a point nor when,
+so it is bit-identical for any count of threads, including none.
+
+Phases are a sequential order of the target (like red-black ordering in relaxation, but by the target order.)
+The cost is that a point does not see points of its own phase, a small loss since the phase is small.
+*/
+typedef struct {
+  Coordinates source;   // Best match
+  gboolean isDone;      // Synthesized (not canceled)
+  gboolean isBettered;  // Source changed: commit color and source
+} TPhaseResult;
+
+typedef struct {
+  guint64 passSeed;       // Seed for random streams of this pass
+  TPhaseResult *results;  // IMAGE_SYNTH_PHASE_SIZE of them, index relative to start of phase
+} TSynthPhase;
+
+
+
 // Match result kind
 typedef enum  BettermentKindEnum 
 {
@@ -419,6 +451,103 @@ setColor(
 }
 
 
+/*
+Prefetch the nearest neighbors of a candidate corpus patch,
+which are the first, and often the only, corpus pixels computeBestFit() reads before an early out.
+Nil unless SYNTH_PREFETCH.
+*/
+static inline void
+prefetchCorpusPatch(
+  const Coordinates point,
+  const Map * const corpusMap,
+  const guint countNeighbors,
+  const TNeighbor neighbors[]
+  )
+{
+#ifdef SYNTH_PREFETCH
+  guint i;
+  guint countPrefetch = MIN(countNeighbors, SYNTH_PREFETCH_NEIGHBORS);
+  
+  for(i=0; i<countPrefetch; i++)
+  {
+    Coordinates off_point = add_points(point, neighbors[i].offset);
+    // Only the bounds check: prefetching a masked pixel is harmless
+    if ( off_point.x >= 0 && off_point.y >= 0 
+      && off_point.x < (gint) corpusMap->width && off_point.y < (gint) corpusMap->height )
+      __builtin_prefetch(pixmap_index(corpusMap, off_point), 0 /* read */, 1 /* low temporal locality */);
+  }
+#endif
+}
+
+
+/*
+Gather candidates for heuristic 1: corpus points continuing the sources of neighbors.
+Returns count of candidates.
+
+Duplicates are removed by heuristic 2 (recentProberMap): all target neighbors with values
+might come from the same corpus locus, called a "continuation" in Harrison's thesis.
+If recentProberMap is NULL (deterministic synthesis), duplicates are removed by searching the candidates.
+
+Prefetches each candidate patch.
+*/
+static inline guint
+gatherNeighborSourceCandidates(
+  const guint target_index,
+  const Map * const corpusMap,
+  Map* recentProberMap,   // IN/OUT, or NULL
+  const guint countNeighbors,
+  const TNeighbor neighbors[],
+  Coordinates candidates[]  // OUT
+  )
+{
+  guint neighbor_index;
+  guint count = 0;
+  
+  for(neighbor_index=0; neighbor_index<countNeighbors; neighbor_index++)
+    // If the neighbor is in the target (not the context) and has a source in the corpus (already synthesized.)
+    if ( has_source_neighbor(neighbor_index, neighbors) ) 
+    {
+      /*
+      Coord arithmetic: corpus source minus neighbor offset.
+      corpus_point is a pixel in the corpus with opposite offset to corpus source of neighbor
+      as target position has to this target neighbor.
+      !!! Note corpus_point is raw coordinate into corpus: might be masked.
+      !!! It is not an index into unmasked corpusPoints.
+      */
+      Coordinates corpus_point = subtract_points(neighbors[neighbor_index].sourceOf, 
+        neighbors[neighbor_index].offset);
+      
+      /* !!! Must clip corpus_point before further use, its only potentially in the corpus. */
+      if (clippedOrMaskedCorpus(corpus_point, corpusMap)) continue;
+      if (recentProberMap)
+      {
+        // One plus the index, see prepareRecentProber()
+        if (*intmap_index(recentProberMap, corpus_point) == target_index + 1) continue; // Heuristic 2
+        /*
+         * Shared and written but no mutex.  It should not be a problem,
+         * even if garbled, the value written is not used except for a comparison.
+         * At most, it would reduce the value of heuristic2.
+         * Different threads are probably working in different continuations and not contending.
+         */
+        *intmap_index(recentProberMap, corpus_point) = target_index + 1;
+      }
+      else
+      {
+        // Not shared, so independent of other threads.  Few candidates, so linear search.
+        guint i;
+        for(i=0; i<count; i++)
+          if (equal_points(candidates[i], corpus_point)) break;
+        if (i < count) continue;
+      }
+      
+      prefetchCorpusPatch(corpus_point, corpusMap, countNeighbors, neighbors);
+      candidates[count++] = corpus_point;
+    }
+    // Else the neighbor is not in the target (has no source) so we can't use the heuristic 1.
+  return count;
+}
+
+
 /*
 The heart of the algorithm.
 Called repeatedly: many passes over the data.
@@ -427,6 +556,7 @@ static guint
 synthesize(
   TImageSynthParameters *parameters,  // IN
   guint threadIndex,       // IN Zero if not threaded
+  guint threadCount,       // IN Count of threads synthesizing this range of targetPoints, one if not threaded
   guint startTargetIndex,  // IN
   guint endTargetIndex,    // IN
   TFormatIndices* indices, // IN
@@ -443,7 +573,8 @@ synthesize(
   TMapPixelelMetricFunc mapsMetric,
   void (*deepProgressCallback)(ProgressRecordT*),
   ProgressRecordT * progressCallbackParams,
-  int *cancelFlag
+  int *cancelFlag,
+  TSynthPhase *phase        // IN/OUT deferred results, or NULL if not deterministic
   )
 {
   guint target_index;
@@ -477,9 +608,9 @@ synthesize(
 
   // Each thread works on a slice of targetPoints.  Starting at the threadIndex, incremented by count of threads.
   // If there is no threads or only one thread, starts at startTargetIndex, increments by 1
-  for(target_index=startTargetIndex + threadIndex % THREAD_LIMIT;
+  for(target_index=startTargetIndex + threadIndex % threadCount;
       target_index<endTargetIndex;
-      target_index += THREAD_LIMIT)
+      target_index += threadCount)
   {
 #ifdef STATS
     countTargetTries += 1;
@@ -533,50 +664,32 @@ synthesize(
     On the first pass, it has no source.
     On subsequent passes, it has a source and thus its source is the first corpus point to be probed again,
     and that will set bestPatchDiff to a low value!!!
+    
+    Gather all candidates first, then match them.
+    Gathering prefetches each candidate's patch, so its cache misses overlap
+    the matching of earlier candidates instead of stalling each match in turn.
     */
     {
-    guint neighbor_index;
+    Coordinates candidates[IMAGE_SYNTH_MAX_NEIGHBORS];
+    guint countCandidates;
+    guint candidate_index;
     
-    // TODO check for zero here is redundant
-    for(neighbor_index=0; neighbor_index<countNeighbors && bestPatchDiff != 0; neighbor_index++)
-      // If the neighbor is in the target (not the context) and has a source in the corpus (already synthesized.)
-      if ( has_source_neighbor(neighbor_index, neighbors) ) {
-        /*
-        Coord arithmetic: corpus source minus neighbor offset.
-        corpus_point is a pixel in the corpus with opposite offset to corpus source of neighbor
-        as target position has to this target neighbor.
-        !!! Note corpus_point is raw coordinate into corpus: might be masked.
-        !!! It is not an index into unmasked corpusPoints.
-        */
-        Coordinates corpus_point = subtract_points(neighbors[neighbor_index].sourceOf, 
-          neighbors[neighbor_index].offset);
-        
-        /* !!! Must clip corpus_point before further use, its only potentially in the corpus. */
-        if (clippedOrMaskedCorpus(corpus_point, corpusMap)) continue;
-        if (*intmap_index(recentProberMap, corpus_point) == target_index) continue; // Heuristic 2
-        isPerfectMatch = computeBestFit(corpus_point, indices, corpusMap,
-          &bestPatchDiff, &bestMatchCorpusPoint,
-          countNeighbors, neighbors, 
-          &latestBettermentKind, NEIGHBORS_SOURCE,
-          corpusTargetMetric, mapsMetric
-          );
-        // TODO stats: if bettered, is kind NEIGHBORS_SOURCE 
-        // if ( matchResult == PERFECT_MATCH ) break;  // Break neighbors loop
-        if ( isPerfectMatch ) break;  // Break neighbors loop
-        /*
-        !!! Remember we probed corpus pixel point for target point target_index.
-        Heuristic 2: all target neighbors with values might come from the same corpus locus,
-        called a "continuation" in Harrison's thesis.
-        */
-        /*
-         * Shared and written but no mutex.  It should not be a problem,
-         * even if garbled, the value written is not used except for a comparison.
-         * At most, it would reduce the value of heuristic2.
-         * Different threads are probably working in different continuations and not contending.
-         */
-        *intmap_index(recentProberMap, corpus_point) = target_index;
-      }
-      // Else the neighbor is not in the target (has no source) so we can't use the heuristic 1.
+    countCandidates = gatherNeighborSourceCandidates(target_index, corpusMap, 
+      phase ? (Map*) NULL : recentProberMap,
+      countNeighbors, neighbors, 
+      candidates);
+    
+    for(candidate_index=0; candidate_index<countCandidates; candidate_index++)
+    {
+      isPerfectMatch = computeBestFit(candidates[candidate_index], indices, corpusMap,
+        &bestPatchDiff, &bestMatchCorpusPoint,
+        countNeighbors, neighbors, 
+        &latestBettermentKind, NEIGHBORS_SOURCE,
+        corpusTargetMetric, mapsMetric
+        );
+      // TODO stats: if bettered, is kind NEIGHBORS_SOURCE 
+      if ( isPerfectMatch ) break;  // Break candidates loop
+    }
     }
       
     // if ( matchResult != PERFECT_MATCH )
@@ -585,11 +698,42 @@ synthesize(
       /* 
       Match patches at random source points from the corpus.
       In later passes, many will be earlyouts.
+      
+      Random points are almost always cache misses.
+      With SYNTH_PREFETCH, pick each point one probe ahead, and prefetch its patch while matching the current point.
+      That draws one point more per target, so the result differs from a build without it.
       */
       gint j;
+      guint64 stream = 0;
+      Coordinates randomPoint;
+      #ifdef SYNTH_PREFETCH
+      Coordinates nextRandomPoint;
+      #endif
+      
+      if (phase)
+        stream = newPointStream(phase->passSeed, target_index);
+      #ifdef SYNTH_PREFETCH
+      if (phase)
+        nextRandomPoint = randomCorpusPointFromStream(corpusPoints, &stream);
+      else
+        nextRandomPoint = randomCorpusPoint(corpusPoints, prng);
+      #endif
       for(j=0; j<parameters->maxProbeCount; j++)
       {
-        isPerfectMatch = computeBestFit(randomCorpusPoint(corpusPoints, prng), 
+        #ifdef SYNTH_PREFETCH
+        randomPoint = nextRandomPoint;
+        if (phase)
+          nextRandomPoint = randomCorpusPointFromStream(corpusPoints, &stream);
+        else
+          nextRandomPoint = randomCorpusPoint(corpusPoints, prng);
+        prefetchCorpusPatch(nextRandomPoint, corpusMap, countNeighbors, neighbors);
+        #else
+        if (phase)
+          randomPoint = randomCorpusPointFromStream(corpusPoints, &stream);
+        else
+          randomPoint = randomCorpusPoint(corpusPoints, prng);
+        #endif
+        isPerfectMatch = computeBestFit(randomPoint, 
           indices, corpusMap,
           &bestPatchDiff, &bestMatchCorpusPoint,
           countNeighbors, neighbors,
@@ -616,6 +760,20 @@ synthesize(
     These are all independent.
     We distinguish some of these cases: only store a better matching, new source.
     */
+    if (phase)
+    {
+      // Defer, see commitPhase()
+      TPhaseResult *result = &phase->results[target_index - startTargetIndex];
+      
+      result->isDone = TRUE;
+      result->isBettered = latestBettermentKind != NO_BETTERMENT 
+        && ! equal_points(getSourceOf(position, sourceOfMap), bestMatchCorpusPoint);
+      result->source = bestMatchCorpusPoint;
+      if (result->isBettered)
+        repeatCountBetters++;
+      continue;
+    }
+    
     // if (matchResult != NO_BETTERMENT )
     if (latestBettermentKind != NO_BETTERMENT )
     {
@@ -641,3 +799,67 @@ synthesize(
   return repeatCountBetters;
 }
 
+
+/*
+Commit the deferred results of a phase of deterministic synthesis.
+Threads commit disjoint slices of the phase, after all threads have synthesized it.
+*/
+static void
+commitPhase(
+  guint threadIndex,
+  guint threadCount,
+  guint startTargetIndex,
+  guint endTargetIndex,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap,
+  Map* hasValueMap,
+  Map* sourceOfMap,
+  pointVector targetPoints,
+  TSynthPhase *phase
+  )
+{
+  guint target_index;
+  
+  for(target_index=startTargetIndex + threadIndex;
+      target_index<endTargetIndex;
+      target_index += threadCount)
+  {
+    TPhaseResult *result = &phase->results[target_index - startTargetIndex];
+    Coordinates position;
+    
+    if ( ! result->isDone ) continue; // Canceled
+    position = g_array_index(targetPoints, Coordinates, target_index);
+    if (result->isBettered)
+    {
+      integrate_color_change(position);
+      setColor( indices, targetMap, position, corpusMap, result->source);
+      setSourceOf(position, result->source, sourceOfMap);
+    }
+    setHasValue(&position, TRUE, hasValueMap);
+    result->isDone = FALSE;  // Ready for next phase
+  }
+}
+
+
+/* Deferred results of one phase, cleared. Caller must free. */
+static GArray *
+newPhaseResults(void)
+{
+  GArray *results = g_array_sized_new(FALSE, TRUE, sizeof(TPhaseResult), IMAGE_SYNTH_PHASE_SIZE);
+  TPhaseResult cleared = {{0,0}, FALSE, FALSE};
+  guint i;
+  
+  for(i=0; i<IMAGE_SYNTH_PHASE_SIZE; i++)
+    g_array_append_val(results, cleared);
+  return results;
+}
+
+
+/* Seed of the random streams of a pass of deterministic synthesis. */
+static inline guint64
+passSeed(guint pass)
+{
+  guint64 state = ((guint64) IMAGE_SYNTH_SEED << 32) | pass;
+  return nextStreamValue(&state);
+}
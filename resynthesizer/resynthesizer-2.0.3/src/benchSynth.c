@@ -0,0 +1,145 @@
+/*
+Microbenchmark for libresynthesizer.
+
+Heals a hole in a synthetic, noisy texture large enough that the corpus does not fit in cache.
+Reports the best wall time and the processor time over several runs.
+
+Build it twice to compare a build switch, e.g. prefetching (see buildSwitches.h):
+  make -f Makefile.synth bench
+  ./benchSynth ; ./benchSynthPrefetch
+For stall time, run both under e.g. perf stat -e cycles,stalled-cycles-backend
+
+  Copyright (C) 2010, 2011  Lloyd Konneker
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#define _POSIX_C_SOURCE 200809L  // clock_gettime under -std=c99
+
+#include <stddef.h>  // size_t
+#include <stdio.h>	// printf
+#include <stdlib.h> // malloc, atoi
+#include <string.h> // memset
+#include <time.h>   // clock_gettime, clock
+
+// Redefine parts of glib that we use
+#include "glibProxy.h"  // glibProxy.c
+#include "imageSynth.h"
+
+#define BENCH_WIDTH   1024
+#define BENCH_HEIGHT  1024
+#define BENCH_HOLE    160   // Side of square hole in center
+#define BENCH_RUNS    3
+
+static double
+wallSeconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void progressCallback(int percent, void * context) { }
+
+/*
+Texture with structure at several scales, plus noise so that matches are rarely perfect
+(perfect matches short circuit the search, and would hide memory stalls.)
+*/
+static void
+makeTexture(ImageBuffer* buffer)
+{
+  unsigned int row;
+  unsigned int col;
+  unsigned int seed = 12345;
+
+  for (row=0; row<buffer->height; row++)
+    for (col=0; col<buffer->width; col++)
+    {
+      unsigned char * pixel = &buffer->data[row*buffer->rowBytes + col*3];
+      seed = seed * 1103515245 + 12345;
+      pixel[0] = (unsigned char) (((col/16 + row/16) & 1) * 128 + ((seed >> 16) & 63));
+      pixel[1] = (unsigned char) ((col * 3 + row * 5) & 0xFF);
+      pixel[2] = (unsigned char) (((col ^ row) & 0x3F) + ((seed >> 24) & 31));
+    }
+}
+
+static void
+makeHole(ImageBuffer* mask)
+{
+  unsigned int row;
+  unsigned int col;
+
+  memset(mask->data, 0, mask->rowBytes * mask->height);
+  for (row=(mask->height-BENCH_HOLE)/2; row<(mask->height+BENCH_HOLE)/2; row++)
+    for (col=(mask->width-BENCH_HOLE)/2; col<(mask->width+BENCH_HOLE)/2; col++)
+      mask->data[row*mask->rowBytes + col] = 0xFF;  // totally selected
+}
+
+int main(
+  int argc,
+  char * argv[]
+	)
+{
+  int runs = (argc > 1) ? atoi(argv[1]) : BENCH_RUNS;
+  int run;
+  double bestWall = 1e30;
+  double totalProcessor = 0;
+
+  ImageBuffer image = { NULL, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH*3 };
+  ImageBuffer mask = { NULL, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH };
+  TImageSynthParameters parameters;
+
+  image.data = malloc(image.rowBytes * image.height);
+  mask.data = malloc(mask.rowBytes * mask.height);
+  setDefaultParams(&parameters);
+
+  #ifdef SYNTH_PREFETCH
+  printf("benchSynth, with prefetch: ");
+  #else
+  printf("benchSynth: ");
+  #endif
+  printf("%dx%d RGB, hole %dx%d, %d runs\n", BENCH_WIDTH, BENCH_HEIGHT, BENCH_HOLE, BENCH_HOLE, runs);
+
+  for (run=0; run<runs; run++)
+  {
+    int cancelFlag = 0;
+    int error;
+    double startWall;
+    double wall;
+    clock_t startProcessor;
+
+    // Every run from the same input, since imageSynth() writes its result into image
+    makeTexture(&image);
+    makeHole(&mask);
+
+    startWall = wallSeconds();
+    startProcessor = clock();
+    error = imageSynth(&image, &mask, T_RGB, &parameters, progressCallback, (void*) 0, &cancelFlag);
+    wall = wallSeconds() - startWall;
+    totalProcessor += (double) (clock() - startProcessor) / CLOCKS_PER_SEC;
+
+    if (error)
+    {
+      printf("!!!! imageSynth returned error: %d\n", error);
+      return 1;
+    }
+    if (wall < bestWall) bestWall = wall;
+    printf("Run %d wall seconds %f\n", run, wall);
+  }
+  printf("Best wall seconds %f, mean processor seconds %f\n", bestWall, totalProcessor/runs);
+
+  free(image.data);
+  free(mask.data);
+  return 0;
+}
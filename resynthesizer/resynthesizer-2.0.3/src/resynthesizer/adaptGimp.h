@@ -89,13 +89,19 @@ pixmap_to_drawable(
   img = g_malloc(size);
   
   {
-  guint i;
+  guint x;
+  guint y;
   guint j;
+  guchar *dest = img;
   
-  for(i=0; i<width*height; i++)  // Iterate over map as a sequence
-    for(j=0; j<pixelel_count; j++)  // Iterate over Pixelels
-      img[i*pixelel_count+j] = 
-        g_array_index(map.data, Pixelel, i*map.depth+pixelel_offset+j);
+  for(y=0; y<height; y++)  // Iterate over map by coordinates, it may be out-of-core
+    for(x=0; x<width; x++)
+    {
+      Coordinates coords = {x, y};
+      Pixelel *pixel = pixmap_index(&map, coords) + pixelel_offset;
+      for(j=0; j<pixelel_count; j++)  // Iterate over Pixelels
+        *dest++ = pixel[j];
+    }
   }
         
   /* Send seq of Pixelels to Gimp. */
@@ -109,6 +115,8 @@ Copy SOME channels of GimpDrawable to pixmap, possibly offsetting them in the Pi
 (Usually called many times, for image, then mask, then other drawables,
 to interleave many drawables into one pixmap.)
 Copy a sub-rect from the drawable.
+
+In bands of rows, so a huge (out-of-core) corpus is never wholly in memory twice.
 */
 static void 
 pixmap_from_drawable(
@@ -126,9 +134,10 @@ pixmap_from_drawable(
   /* !!! Note our pixmap is same width, height as drawable, but depths may differ. */
   guint width = map.width;
   guint height = map.height;
-  guint drawable_size = width * height * drawable->bpp;
+  guint band_height = MIN(gimp_tile_height(), height);
+  guint band_y;
 
-  g_assert(drawable_size > 0);
+  g_assert(width * height > 0);
   /* Will fit in our Pixel */
   g_assert( pixelel_count_to_copy + pixelel_offset <= map.depth );
   /* Drawable has enough to copy */
@@ -136,24 +145,33 @@ pixmap_from_drawable(
   
   gimp_pixel_rgn_init(&region, drawable, x,y, map.width, map.height, FALSE,FALSE);
 
-  img = g_malloc(drawable_size);
+  img = g_malloc(width * band_height * drawable->bpp);
   
-  /* 
-  Get all the pixelels from drawable into img sequence.
-  Note x1,y1 are in drawable coords i.e. relative to drawable
-  The drawable may be offset from the canvas and other drawables.
-  */
-  gimp_pixel_rgn_get_rect(&region, img, x,y, width,height);
-
+  for(band_y=0; band_y<height; band_y+=band_height)
   {
-  guint i;
-  guint j;
-  
-  /* Copy SOME of the pixels from img sequence to our pixmap, OFFSET them. */
-  for(i=0; i<width*height; i++)
-    for(j=0; j<pixelel_count_to_copy; j++)  /* Count can be different from strides. */
-        g_array_index(map.data, Pixelel, i*map.depth+pixelel_offset+j)  /* Stride is depth of pixmap. */
-          = img[i*drawable->bpp+j];   /* Stride is bpp */
+    guint rows = MIN(band_height, height - band_y);
+    guint row;
+    guint col;
+    guint j;
+    
+    /* 
+    Get a band of pixelels from drawable into img sequence.
+    Note x1,y1 are in drawable coords i.e. relative to drawable
+    The drawable may be offset from the canvas and other drawables.
+    */
+    gimp_pixel_rgn_get_rect(&region, img, x, y+band_y, width, rows);
+
+    /* Copy SOME of the pixels from img sequence to our pixmap, OFFSET them. */
+    for(row=0; row<rows; row++)
+      for(col=0; col<width; col++)
+      {
+        Coordinates coords = {col, band_y+row};
+        Pixelel *pixel = pixmap_index(&map, coords) + pixelel_offset;
+        guchar *src = &img[(row*width+col)*drawable->bpp];  /* Stride is bpp */
+        
+        for(j=0; j<pixelel_count_to_copy; j++)  /* Count can be different from strides. */
+          pixel[j] = src[j];
+      }
   }
   
   g_free(img);
@@ -263,12 +281,16 @@ fetch_image_and_mask(
   Map *pixmap,            // OUT our color pixmap of drawable
   guint pixelel_count,    // IN total count mask+image+map Pixelels in our Pixel
   Map *mask,              // OUT our selection bytemap (only one channel ie byte ie depth)
-  Pixelel default_mask_value  // IN default value for any created mask
+  Pixelel default_mask_value,  // IN default value for any created mask
+  gboolean is_corpus      // IN whether pixmap may be out-of-core
   ) 
 {
    
   /* Both OUT pixmaps same 2D dimensions.  Depth pixelel_count includes a mask byte. */
-  new_pixmap(pixmap, drawable->width, drawable->height, pixelel_count);
+  if (is_corpus)
+    new_corpus_pixmap(pixmap, drawable->width, drawable->height, pixelel_count);
+  else
+    new_pixmap(pixmap, drawable->width, drawable->height, pixelel_count);
   
   /* Get color, alpha channels */
   pixmap_from_drawable(*pixmap, drawable, 0,0, FIRST_PIXELEL_INDEX, drawable->bpp);  
@@ -299,13 +321,14 @@ fetch_image_mask_map(
   Map          *mask,               // OUT our selection bytemap (only one channel ie byte ie depth)
   Pixelel      default_mask_value,  // IN default value for any created mask
   GimpDrawable *map_drawable,       // IN map drawable, target or corpus
-  guint        map_offset          // IN index in our Pixel to first map Pixelel
+  guint        map_offset,          // IN index in our Pixel to first map Pixelel
+  gboolean     is_corpus            // IN whether pixmap may be out-of-core (if huge)
   ) 
 {
   /* Fetch image.  If no selection mask, create one defaulted to SELECTED.
   The selection mask distinguishes the target from the context (which is optional.)
   */
-  fetch_image_and_mask(image_drawable, pixmap, pixelel_count, mask, default_mask_value);
+  fetch_image_and_mask(image_drawable, pixmap, pixelel_count, mask, default_mask_value, is_corpus);
 
   /* 
   Append some of the map channels (Pixelels) to our Pixel.  map_offset is the destination Pixelel. 
@@ -38,7 +38,7 @@ adaptImageToBuffer(
   // Many parameters are global vars
   // Assert image and image_mask invalid, uninitialized.
   fetch_image_mask_map(drawable, image, total_bpp, image_mask, MASK_TOTALLY_SELECTED, 
-      NULL /*map_out_drawable*/, map_start_bip);
+      NULL /*map_out_drawable*/, map_start_bip, FALSE);
   // assert image and image_mask now valid, same dimensions
   // assert mask represents selection in drawable
       
@@ -13,4 +13,5 @@ adaptPluginToLibraryParameters(
   p2->sensitivityToOutliers                = p1->autism;
   p2->patchSize                            = p1->neighbours;
   p2->maxProbeCount                        = p1->trys;
+  p2->isDeterministic                      = FALSE;
 }
@@ -0,0 +1,216 @@
+/*
+Persist the sources of a synthesis as a parasite on the target drawable,
+so a later call on the same drawable can resynthesize incrementally.
+See engineIncremental() and lib/incremental.h.
+
+The parasite is not persistent: it lives for the session, not in the saved .xcf.
+It costs 16 bytes per synthesized pixel, so a synthesis larger than RESYNTH_SOURCES_MAX_BYTES
+stores nothing, and the next call on the drawable resynthesizes in full.
+
+Sources are stored in the coordinates of the target drawable, not of the corpus drawable,
+because callers such as the heal selection plugin pass a new, cropped corpus each call.
+The origin of the corpus in target drawable coordinates is, in order of preference:
+- from a parasite on the corpus drawable, set by a caller that knows it (i.e. that cropped)
+- from layer offsets, if corpus and target are in the same image
+- else assumed to be (0,0).
+If the assumption is wrong, the engine finds the prior sources invalid and simply resynthesizes.
+
+  Copyright (C) 2010, 2011  Lloyd Konneker
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#define RESYNTH_SOURCES_PARASITE        "resynthesizer-sources"
+#define RESYNTH_CORPUS_ORIGIN_PARASITE  "resynthesizer-corpus-origin"
+#define RESYNTH_SOURCES_VERSION         1
+#define RESYNTH_SOURCES_MAX_BYTES       ((gsize) 16 << 20)  // About a million synthesized pixels
+
+/*
+Layout of sources parasite: a header of gint32, then one record of gint32 per synthesized target point.
+*/
+typedef struct {
+  gint32 version;
+  gint32 width;   // Of target drawable
+  gint32 height;
+  gint32 count;   // Of records
+} TSourcesHeader;
+
+typedef struct {
+  gint32 x;   // Target point
+  gint32 y;
+  gint32 sx;  // Its source, in target drawable coordinates
+  gint32 sy;
+} TSourcesRecord;
+
+
+/* Origin of corpus drawable in coordinates of target drawable. See above. */
+static Coordinates
+get_corpus_origin(
+  GimpDrawable *drawable,
+  GimpDrawable *corpus_drawable
+  )
+{
+  Coordinates origin = {0, 0};
+  GimpParasite *parasite;
+
+  parasite = gimp_item_get_parasite(corpus_drawable->drawable_id, RESYNTH_CORPUS_ORIGIN_PARASITE);
+  if (parasite)
+  {
+    if (gimp_parasite_data_size(parasite) == 2*sizeof(gint32))
+    {
+      const gint32 *data = gimp_parasite_data(parasite);
+      origin.x = data[0];
+      origin.y = data[1];
+    }
+    gimp_parasite_free(parasite);
+  }
+  else if (gimp_item_get_image(drawable->drawable_id) == gimp_item_get_image(corpus_drawable->drawable_id))
+  {
+    gint target_x, target_y, corpus_x, corpus_y;
+
+    gimp_drawable_offsets(drawable->drawable_id, &target_x, &target_y);
+    gimp_drawable_offsets(corpus_drawable->drawable_id, &corpus_x, &corpus_y);
+    origin.x = corpus_x - target_x;
+    origin.y = corpus_y - target_y;
+  }
+  return origin;
+}
+
+
+/*
+Fetch sources of a prior synthesis of drawable, as a coordmap in corpus coordinates.
+If none, or stale (drawable was resized), sourceOfMap->data is NULL.
+The engine validates each source; here we only translate.
+*/
+static void
+fetch_prior_sources(
+  GimpDrawable *drawable,
+  GimpDrawable *corpus_drawable,
+  Map *sourceOfMap        // OUT
+  )
+{
+  GimpParasite *parasite;
+  const TSourcesHeader *header;
+  const TSourcesRecord *records;
+  Coordinates origin;
+  Coordinates null_coords = {-1, -1};
+  guint x;
+  guint y;
+  gint i;
+
+  sourceOfMap->data = NULL;
+
+  parasite = gimp_item_get_parasite(drawable->drawable_id, RESYNTH_SOURCES_PARASITE);
+  if (!parasite)
+    return;
+
+  header = gimp_parasite_data(parasite);
+  if ( gimp_parasite_data_size(parasite) < sizeof(TSourcesHeader)
+    || header->version != RESYNTH_SOURCES_VERSION
+    || header->width != (gint32) drawable->width
+    || header->height != (gint32) drawable->height
+    || gimp_parasite_data_size(parasite) != sizeof(TSourcesHeader) + header->count * sizeof(TSourcesRecord)
+    )
+  {
+    gimp_parasite_free(parasite);
+    return;
+  }
+
+  origin = get_corpus_origin(drawable, corpus_drawable);
+
+  new_coordmap(sourceOfMap, drawable->width, drawable->height);
+  for(y=0; y<drawable->height; y++)
+    for(x=0; x<drawable->width; x++)
+    {
+      Coordinates coords = {x, y};
+      *coordmap_index(sourceOfMap, coords) = null_coords;
+    }
+
+  records = (const TSourcesRecord *) (header + 1);
+  for (i=0; i<header->count; i++)
+  {
+    Coordinates coords = {records[i].x, records[i].y};
+    Coordinates source = {records[i].sx - origin.x, records[i].sy - origin.y};
+
+    if (coords.x < 0 || coords.y < 0 || coords.x >= (gint) drawable->width || coords.y >= (gint) drawable->height)
+      continue;
+    // Source might now be outside the corpus: engine clips it.
+    *coordmap_index(sourceOfMap, coords) = source;
+  }
+  gimp_parasite_free(parasite);
+}
+
+
+/* Store sources of this synthesis on drawable, for a later incremental synthesis. */
+static void
+store_sources(
+  GimpDrawable *drawable,
+  GimpDrawable *corpus_drawable,
+  Map *sourceOfMap        // IN as returned by engineIncremental()
+  )
+{
+  GimpParasite *parasite;
+  TSourcesHeader *header;
+  TSourcesRecord *records;
+  Coordinates origin = get_corpus_origin(drawable, corpus_drawable);
+  guint count = 0;
+  guint x;
+  guint y;
+  gsize size;
+
+  // Count synthesized points to size the parasite
+  for(y=0; y<sourceOfMap->height; y++)
+    for(x=0; x<sourceOfMap->width; x++)
+    {
+      Coordinates coords = {x, y};
+      if (coordmap_index(sourceOfMap, coords)->x != -1)
+        count++;
+    }
+
+  size = sizeof(TSourcesHeader) + (gsize) count * sizeof(TSourcesRecord);
+  if (size > RESYNTH_SOURCES_MAX_BYTES)
+  {
+    // Too big to keep: drop any older sources too, they no longer describe the drawable
+    gimp_item_detach_parasite(drawable->drawable_id, RESYNTH_SOURCES_PARASITE);
+    return;
+  }
+  header = g_malloc(size);
+  header->version = RESYNTH_SOURCES_VERSION;
+  header->width = sourceOfMap->width;
+  header->height = sourceOfMap->height;
+  header->count = count;
+
+  records = (TSourcesRecord *) (header + 1);
+  for(y=0; y<sourceOfMap->height; y++)
+    for(x=0; x<sourceOfMap->width; x++)
+    {
+      Coordinates coords = {x, y};
+      Coordinates source = *coordmap_index(sourceOfMap, coords);
+      if (source.x != -1)
+      {
+        records->x = x;
+        records->y = y;
+        records->sx = source.x + origin.x;
+        records->sy = source.y + origin.y;
+        records++;
+      }
+    }
+
+  // Flags 0: not persistent, not undoable
+  parasite = gimp_parasite_new(RESYNTH_SOURCES_PARASITE, 0, size, header);
+  gimp_item_attach_parasite(drawable->drawable_id, parasite);
+  gimp_parasite_free(parasite);
+  g_free(header);
+}
@@ -104,6 +104,7 @@ Is separate to reduce file sizes and later, coupling.
 
 #include "mapIndex.h"	// from resynthesizer library
 #include "adaptGimp.h"  // requires mapIndex.h
+#include "priorSources.h" // requires mapIndex.h
 #include "../resynth-parameters.h" // requires engine.h
 #include "adaptParameters.c"
 
@@ -310,6 +311,11 @@ static void run(
   Map targetMaskMap;
   Map corpusMaskMap;
   
+  /*
+  Sources of target pixels: IN from a prior synthesis of this drawable, if any; OUT to persist for the next.
+  */
+  Map sourceOfMap;
+  
   int cancelFlag = 0;
   
   #ifdef SYNTH_THREADED
@@ -474,17 +480,19 @@ static void run(
     fetch_image_mask_map(drawable, &targetMap, formatIndices.total_bpp, 
       &targetMaskMap, 
       MASK_TOTALLY_SELECTED, 
-      map_out_drawable, formatIndices.map_start_bip);
+      map_out_drawable, formatIndices.map_start_bip,
+      FALSE);
     
       #ifdef ANIMATE
       clear_target_pixels(formatIndices.colorEndBip);  // For debugging, blacken so new colors sparkle
       #endif
   
-    /*  corpus adaption */
+    /*  corpus adaption.  A huge corpus is out-of-core. */
     fetch_image_mask_map(corpus_drawable, &corpusMap, formatIndices.total_bpp, 
       &corpusMaskMap,
       MASK_TOTALLY_SELECTED, 
-      map_in_drawable, formatIndices.map_start_bip);
+      map_in_drawable, formatIndices.map_start_bip,
+      TRUE);
       
     // TODO These are artifacts of earlier design, not used.
     free_map(&corpusMaskMap);
@@ -502,16 +510,23 @@ static void run(
   // Begin real work
   progressStart("synthesizing...");
   
-  int result = engine(
+  // Incremental: reuse what the prior synthesis of this drawable produced, if it is still valid
+  fetch_prior_sources(drawable, corpus_drawable, &sourceOfMap);
+  
+  int result = engineIncremental(
     engineParameters, 
     &formatIndices, 
     &targetMap, 
     &corpusMap,
+    &sourceOfMap,
     progressUpdate,
     (void *) 0,
     &cancelFlag
     );
   
+  if (result && sourceOfMap.data)
+    free_map(&sourceOfMap);
+  
   if (result == IMAGE_SYNTH_ERROR_EMPTY_CORPUS)
   {
     ERROR_RETURN(_("The texture source is empty. Does any selection include non-transparent pixels?"));
@@ -537,6 +552,13 @@ static void run(
   */
   post_results_to_gimp(drawable, targetMap); 
   
+  // Remember sources for a later, incremental synthesis of this drawable
+  if (sourceOfMap.data)
+  {
+    store_sources(drawable, corpus_drawable, &sourceOfMap);
+    free_map(&sourceOfMap);
+  }
+  
   /* Clean up */
   // Adapted
   free_map(&targetMap);
@@ -0,0 +1,583 @@
+/* 
+ * Wavelet denoise GIMP plugin
+ * 
+ * batch.c
+ * Copyright 2008 by Marco Rossini
+ * 
+ * Implements the wavelet denoise code of UFRaw by Udi Fuchs
+ * which itself bases on the code by Dave Coffin
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ * 
+ */
+
+/* wavelet-denoise-batch: denoise 8 and 16 bit TIFF and PNG files without
+ * GIMP, with the same denoiser and colour models as the plugin. Each file
+ * is denoised whole in memory. Several files are denoised at once, each
+ * with a share of the processors for its wavelet transforms. */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <tiffio.h>
+#include <png.h>
+#include "wavelet.h"
+
+typedef struct
+{
+  int width, height, channels;
+  int depth;			/* bits per sample, 8 or 16 */
+  guchar *pixels;		/* rows of width * channels samples */
+  gboolean png;			/* else TIFF */
+  guint16 compression;		/* of a TIFF, kept for writing it */
+} image;
+
+static struct
+{
+  int colour_mode;
+  double thresholds[4];		/* per channel, as in the image */
+  double low[4];
+  char *output;
+  int jobs;			/* files at once */
+  int threads;			/* per file */
+  gboolean compact;		/* scratch planes of 8 bit files */
+  gboolean verbose;
+  gboolean progress;		/* only if one file at a time */
+} options = { MODE_YCBCR, {0, 0, 0, 0}, {0, 0, 0, 0}, NULL, 0, 0, FALSE,
+  FALSE, FALSE
+};
+
+/* the files of the batch, taken in turn by the threads of the pool */
+typedef struct
+{
+  char **files;
+  int count;
+  volatile gint next;
+  volatile gint failed;
+} batch;
+
+static gsize
+row_bytes (image * img)
+{
+  return (gsize) img->width * img->channels * (img->depth / 8);
+}
+
+static gboolean
+read_tiff (const char *path, image * img)
+{
+  TIFF *tif;
+  guint32 width, height;
+  guint16 bits, samples, planar, photometric;
+  int y;
+
+  tif = TIFFOpen (path, "r");
+  if (!tif)
+    return FALSE;
+  TIFFGetField (tif, TIFFTAG_IMAGEWIDTH, &width);
+  TIFFGetField (tif, TIFFTAG_IMAGELENGTH, &height);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_BITSPERSAMPLE, &bits);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_PLANARCONFIG, &planar);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_COMPRESSION, &img->compression);
+  if (!TIFFGetField (tif, TIFFTAG_PHOTOMETRIC, &photometric))
+    photometric = samples > 2 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK;
+
+  if ((bits != 8 && bits != 16) || samples < 1 || samples > 4
+      || planar != PLANARCONFIG_CONTIG
+      || photometric != (samples > 2 ? PHOTOMETRIC_RGB
+			 : PHOTOMETRIC_MINISBLACK))
+    {
+      g_printerr ("%s: only 8 or 16 bit gray or RGB TIFF, with or without"
+		  " alpha, is supported\n", path);
+      TIFFClose (tif);
+      return FALSE;
+    }
+
+  img->width = width;
+  img->height = height;
+  img->channels = samples;
+  img->depth = bits;
+  img->png = FALSE;
+  img->pixels = g_malloc (row_bytes (img) * height);
+  for (y = 0; y < img->height; y++)
+    if (TIFFReadScanline (tif, img->pixels + y * row_bytes (img), y, 0) < 0)
+      {
+	g_free (img->pixels);
+	TIFFClose (tif);
+	return FALSE;
+      }
+  TIFFClose (tif);
+  return TRUE;
+}
+
+static gboolean
+write_tiff (const char *path, image * img)
+{
+  TIFF *tif;
+  guint16 extra = EXTRASAMPLE_UNASSALPHA;
+  gboolean ok = TRUE;
+  int y;
+
+  tif = TIFFOpen (path, "w");
+  if (!tif)
+    return FALSE;
+  TIFFSetField (tif, TIFFTAG_IMAGEWIDTH, img->width);
+  TIFFSetField (tif, TIFFTAG_IMAGELENGTH, img->height);
+  TIFFSetField (tif, TIFFTAG_BITSPERSAMPLE, img->depth);
+  TIFFSetField (tif, TIFFTAG_SAMPLESPERPIXEL, img->channels);
+  TIFFSetField (tif, TIFFTAG_PHOTOMETRIC, img->channels > 2
+		? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+  TIFFSetField (tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField (tif, TIFFTAG_COMPRESSION, img->compression);
+  TIFFSetField (tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize (tif, 0));
+  if (img->channels % 2 == 0)
+    TIFFSetField (tif, TIFFTAG_EXTRASAMPLES, 1, &extra);
+  for (y = 0; y < img->height && ok; y++)
+    ok = TIFFWriteScanline (tif, img->pixels + y * row_bytes (img), y, 0)
+      >= 0;
+  TIFFClose (tif);
+  return ok;
+}
+
+static gboolean
+read_png (const char *path, image * img)
+{
+  FILE *file;
+  png_structp png;
+  png_infop info;
+  png_bytep *volatile rows = NULL;
+  int y;
+
+  file = fopen (path, "rb");
+  if (!file)
+    return FALSE;
+  png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  info = png_create_info_struct (png);
+  img->pixels = NULL;
+  if (setjmp (png_jmpbuf (png)))
+    {
+      png_destroy_read_struct (&png, &info, NULL);
+      g_free (rows);
+      g_free (img->pixels);
+      fclose (file);
+      return FALSE;
+    }
+  png_init_io (png, file);
+  png_read_info (png, info);
+  /* palette to RGB, gray of less than 8 bit to 8 bit, tRNS to alpha */
+  png_set_expand (png);
+  if (G_BYTE_ORDER == G_LITTLE_ENDIAN)
+    png_set_swap (png);
+  png_read_update_info (png, info);
+
+  img->width = png_get_image_width (png, info);
+  img->height = png_get_image_height (png, info);
+  img->channels = png_get_channels (png, info);
+  img->depth = png_get_bit_depth (png, info);
+  img->png = TRUE;
+  img->pixels = g_malloc (row_bytes (img) * img->height);
+  rows = g_new (png_bytep, img->height);
+  for (y = 0; y < img->height; y++)
+    rows[y] = img->pixels + y * row_bytes (img);
+  png_read_image (png, rows);
+  png_read_end (png, NULL);
+
+  png_destroy_read_struct (&png, &info, NULL);
+  g_free (rows);
+  fclose (file);
+  return TRUE;
+}
+
+static gboolean
+write_png (const char *path, image * img)
+{
+  static const int colour_types[] = { PNG_COLOR_TYPE_GRAY,
+    PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA
+  };
+  FILE *file;
+  png_structp png;
+  png_infop info;
+  png_bytep *volatile rows = NULL;
+  int y;
+
+  file = fopen (path, "wb");
+  if (!file)
+    return FALSE;
+  png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  info = png_create_info_struct (png);
+  if (setjmp (png_jmpbuf (png)))
+    {
+      png_destroy_write_struct (&png, &info);
+      g_free (rows);
+      fclose (file);
+      return FALSE;
+    }
+  png_init_io (png, file);
+  png_set_IHDR (png, info, img->width, img->height, img->depth,
+		colour_types[img->channels - 1], PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_write_info (png, info);
+  if (G_BYTE_ORDER == G_LITTLE_ENDIAN)
+    png_set_swap (png);
+  rows = g_new (png_bytep, img->height);
+  for (y = 0; y < img->height; y++)
+    rows[y] = img->pixels + y * row_bytes (img);
+  png_write_image (png, rows);
+  png_write_end (png, NULL);
+
+  png_destroy_write_struct (&png, &info);
+  g_free (rows);
+  return fclose (file) == 0;
+}
+
+/* PNG or TIFF, by the signature of the file */
+static gboolean
+read_image_file (const char *path, image * img)
+{
+  FILE *file;
+  guchar signature[8];
+  size_t size;
+
+  file = fopen (path, "rb");
+  if (!file)
+    return FALSE;
+  size = fread (signature, 1, sizeof (signature), file);
+  fclose (file);
+
+  if (size == sizeof (signature) && !png_sig_cmp (signature, 0, size))
+    return read_png (path, img);
+  return read_tiff (path, img);
+}
+
+/* the output of path, in the output directory under the same name. Never
+ * path itself */
+static char *
+output_path (const char *path)
+{
+  struct stat in, out;
+  char *name, *result;
+
+  name = g_path_get_basename (path);
+  result = g_build_filename (options.output, name, NULL);
+  g_free (name);
+  if (stat (path, &in) == 0 && stat (result, &out) == 0
+      && in.st_dev == out.st_dev && in.st_ino == out.st_ino)
+    {
+      g_printerr ("%s: would be overwritten, choose another output"
+		  " directory\n", path);
+      g_free (result);
+      return NULL;
+    }
+  return result;
+}
+
+/* whether two of files would be written to the same output, which they
+ * would be under the same name from different directories */
+static gboolean
+same_outputs (char **files, int count)
+{
+  GHashTable *names;
+  gboolean same = FALSE;
+  char *name;
+  int i;
+
+  names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (i = 0; i < count; i++)
+    {
+      name = g_path_get_basename (files[i]);
+      if (g_hash_table_lookup (names, name))
+	{
+	  g_printerr ("%s: same output as %s\n", files[i],
+		      (char *) g_hash_table_lookup (names, name));
+	  g_free (name);
+	  same = TRUE;
+	}
+      else
+	g_hash_table_insert (names, name, files[i]);
+    }
+  g_hash_table_destroy (names);
+  return same;
+}
+
+/* the progress of a file, over the channels it denoises */
+typedef struct
+{
+  const char *path;
+  int done, count;
+} file_progress;
+
+static void
+print_progress (float fraction, gpointer data)
+{
+  file_progress *fp = (file_progress *) data;
+
+  g_printerr ("\r%s: %3.0f%%", fp->path,
+	      100 * (fp->done + fraction) / fp->count);
+}
+
+/* denoise a file into the output directory, with nthreads threads */
+static gboolean
+denoise_file (const char *path, int nthreads)
+{
+  image img;
+  file_progress progress = { path, 0, 0 };
+  float *fimg[4], *planes[3];
+  char *out;
+  guchar *row;
+  gboolean ok, compact;
+  gsize size;
+  int c, y;
+
+  out = output_path (path);
+  if (!out)
+    return FALSE;
+  if (!read_image_file (path, &img))
+    {
+      g_printerr ("%s: cannot read\n", path);
+      g_free (out);
+      return FALSE;
+    }
+
+  /* 16 bit files need the precision of float */
+  compact = options.compact && img.depth == 8;
+  size = (gsize) img.width * img.height;
+  for (c = 0; c < img.channels; c++)
+    fimg[c] = g_new (float, size);
+  planes[1] = g_malloc (WAVELET_SCRATCH_SIZE (img.width, img.height,
+					      compact));
+  planes[2] = g_malloc (WAVELET_SCRATCH_SIZE (img.width, img.height,
+					      compact));
+
+  for (y = 0; y < img.height; y++)
+    {
+      row = img.pixels + y * row_bytes (&img);
+      if (img.depth == 8)
+	load_row (row, fimg, (gsize) y * img.width, img.width, img.channels,
+		  options.colour_mode);
+      else
+	load_row16 ((guint16 *) row, fimg, (gsize) y * img.width, img.width,
+		    img.channels, options.colour_mode);
+    }
+
+  for (c = 0; c < img.channels; c++)
+    if (options.thresholds[c] > 0)
+      progress.count++;
+  for (c = 0; c < img.channels; c++)
+    {
+      if (options.thresholds[c] <= 0)
+	continue;
+      planes[0] = fimg[c];
+      wavelet_denoise (planes, img.width, img.height, options.thresholds[c],
+		       options.low[c], NULL, nthreads, compact,
+		       options.progress ? print_progress : NULL, &progress);
+      progress.done++;
+    }
+
+  for (y = 0; y < img.height; y++)
+    {
+      row = img.pixels + y * row_bytes (&img);
+      if (img.depth == 8)
+	store_row (fimg, (gsize) y * img.width, row, img.width, img.channels,
+		   options.colour_mode);
+      else
+	store_row16 (fimg, (gsize) y * img.width, (guint16 *) row, img.width,
+		     img.channels, options.colour_mode);
+    }
+
+  ok = img.png ? write_png (out, &img) : write_tiff (out, &img);
+  if (!ok)
+    g_printerr ("%s: cannot write %s\n", path, out);
+  else if (options.verbose)
+    g_printerr (options.progress ? "\r%s: done\n" : "%s: done\n", path);
+
+  for (c = 0; c < img.channels; c++)
+    g_free (fimg[c]);
+  g_free (planes[1]);
+  g_free (planes[2]);
+  g_free (img.pixels);
+  g_free (out);
+  return ok;
+}
+
+static gpointer
+batch_thread (gpointer data)
+{
+  batch *b = (batch *) data;
+  int i;
+
+  for (;;)
+    {
+      i = g_atomic_int_add (&b->next, 1);
+      if (i >= b->count)
+	break;
+      if (!denoise_file (b->files[i], options.threads))
+	g_atomic_int_inc (&b->failed);
+    }
+  return NULL;
+}
+
+/* up to 4 comma separated numbers into values */
+static gboolean
+parse_list (const char *text, double values[4])
+{
+  char *end;
+  int c;
+
+  for (c = 0; c < 4; c++)
+    {
+      values[c] = strtod (text, &end);
+      if (end == text || values[c] < 0)
+	return FALSE;
+      if (*end == '\0')
+	return TRUE;
+      if (*end != ',')
+	return FALSE;
+      text = end + 1;
+    }
+  return FALSE;
+}
+
+static void
+usage (const char *name)
+{
+  g_printerr ("Usage: %s [OPTION]... -o DIRECTORY FILE...\n"
+	      "Denoise 8 and 16 bit TIFF and PNG files into DIRECTORY.\n"
+	      "\n"
+	      "  -o, --output=DIRECTORY  where the denoised files are written\n"
+	      "  -m, --mode=MODEL        colour model: ycbcr (default), rgb"
+	      " or lab\n"
+	      "  -t, --threshold=T,...   threshold of each channel, in the"
+	      " order of the\n"
+	      "                          model (Y,Cb,Cr,alpha or gray,alpha);"
+	      " 0 leaves a\n"
+	      "                          channel alone; at least one is"
+	      " required\n"
+	      "  -s, --softness=S,...    softness of each channel, 0 to 1\n"
+	      "  -j, --jobs=N            files denoised at once (default: one"
+	      " per processor)\n"
+	      "  -n, --threads=N         threads per file (default: processors"
+	      " / jobs)\n"
+	      "  -c, --compact           16 bit scratch planes for 8 bit files,"
+	      " for a third\n"
+	      "                          less memory\n"
+	      "  -v, --verbose           report progress\n", name);
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct option long_options[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"mode", required_argument, NULL, 'm'},
+    {"threshold", required_argument, NULL, 't'},
+    {"softness", required_argument, NULL, 's'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"threads", required_argument, NULL, 'n'},
+    {"compact", no_argument, NULL, 'c'},
+    {"verbose", no_argument, NULL, 'v'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  GThread *threads[MAX_THREADS];
+  batch b;
+  int opt, t, c, jobs, nprocs;
+
+  while ((opt = getopt_long (argc, argv, "o:m:t:s:j:n:cvh", long_options,
+			     NULL)) != -1)
+    switch (opt)
+      {
+      case 'o':
+	options.output = optarg;
+	break;
+      case 'm':
+	if (!strcmp (optarg, "ycbcr"))
+	  options.colour_mode = MODE_YCBCR;
+	else if (!strcmp (optarg, "rgb"))
+	  options.colour_mode = MODE_RGB;
+	else if (!strcmp (optarg, "lab"))
+	  options.colour_mode = MODE_LAB;
+	else
+	  {
+	    usage (argv[0]);
+	    return 2;
+	  }
+	break;
+      case 't':
+	if (!parse_list (optarg, options.thresholds))
+	  {
+	    usage (argv[0]);
+	    return 2;
+	  }
+	break;
+      case 's':
+	if (!parse_list (optarg, options.low))
+	  {
+	    usage (argv[0]);
+	    return 2;
+	  }
+	break;
+      case 'j':
+	options.jobs = atoi (optarg);
+	break;
+      case 'n':
+	options.threads = atoi (optarg);
+	break;
+      case 'c':
+	options.compact = TRUE;
+	break;
+      case 'v':
+	options.verbose = TRUE;
+	break;
+      default:
+	usage (argv[0]);
+	return opt == 'h' ? 0 : 2;
+      }
+
+  if (!options.output || optind >= argc)
+    {
+      usage (argv[0]);
+      return 2;
+    }
+  /* as in the plugin, all thresholds are 0 unless given, which would
+   * only copy the files */
+  for (c = 0; c < 4 && options.thresholds[c] <= 0; c++);
+  if (c == 4)
+    {
+      g_printerr ("%s: no threshold given (-t), nothing to denoise\n",
+		  argv[0]);
+      return 2;
+    }
+  if (!g_file_test (options.output, G_FILE_TEST_IS_DIR))
+    {
+      g_printerr ("%s: not a directory\n", options.output);
+      return 1;
+    }
+
+  b.files = argv + optind;
+  b.count = argc - optind;
+  if (same_outputs (b.files, b.count))
+    return 1;
+  b.next = 0;
+  b.failed = 0;
+
+  /* files at once, and the processors left for the transforms of each */
+  nprocs = g_get_num_processors ();
+  jobs = options.jobs > 0 ? options.jobs : MIN2 (b.count, nprocs);
+  jobs = CLIP (jobs, 1, MIN2 (b.count, MAX_THREADS));
+  if (options.threads <= 0)
+    options.threads = MAX2 (nprocs / jobs, 1);
+  /* progress lines of several files would mix */
+  options.progress = options.verbose && jobs == 1;
+
+  /* the first job is run by this thread */
+  for (t = 1; t < jobs; t++)
+    threads[t] = g_thread_try_new (NULL, batch_thread, &b, NULL);
+  batch_thread (&b);
+  for (t = 1; t < jobs; t++)
+    if (threads[t])
+      g_thread_join (threads[t]);
+
+  return b.failed ? 1 : 0;
+}
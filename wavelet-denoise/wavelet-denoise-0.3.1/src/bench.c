@@ -0,0 +1,381 @@
+/* 
+ * Wavelet denoise GIMP plugin
+ * 
+ * bench.c
+ * Copyright 2008 by Marco Rossini
+ * 
+ * Implements the wavelet denoise code of UFRaw by Udi Fuchs
+ * which itself bases on the code by Dave Coffin
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ * 
+ */
+
+/* wavelet-denoise-bench: times the denoiser on a synthetic noisy RGB
+ * image, converted to YCbCr and back as by the plugin. Reports the best
+ * wall time over several runs, with float and with compact scratch planes,
+ * and how close the compact result comes to the float one (PSNR and the
+ * largest difference, in 8 bit levels).
+ *
+ * With --accuracy it instead checks the colour conversion of load_row,
+ * store_row and their 16 bit versions against the whole-plane converters
+ * they replaced, for every colour model and channel count: the largest
+ * difference on loading, on storing, and on a round trip, with the round
+ * trip of the old converters beside it.
+ *
+ * usage: wavelet-denoise-bench [WIDTH HEIGHT [RUNS [THREADS]]]
+ *        wavelet-denoise-bench --accuracy */
+
+#include <stdio.h>
+#include "wavelet.h"
+
+#define BENCH_WIDTH 4000
+#define BENCH_HEIGHT 3000
+#define BENCH_RUNS 3
+
+/* pixels converted at a time, and the 16 bit pixels checked */
+#define ACCURACY_ROW 4096
+#define ACCURACY_WORDS (1 << 22)
+
+/* gradients and edges, plus noise of about 5 levels in each channel */
+static void
+make_image (guchar * pixels, int width, int height)
+{
+  unsigned int seed = 12345;
+  int x, y, c, v;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      for (c = 0; c < 3; c++)
+	{
+	  seed = seed * 1103515245 + 12345;
+	  v = ((x / 64 + y / 64) & 1) * 96 + (x + c * y) * 128 / width;
+	  v += (int) ((seed >> 16) % 11) - 5;
+	  pixels[(y * width + x) * 3 + c] = CLIP (v, 0, 255);
+	}
+}
+
+/* denoise pixels in place, returning the seconds it took */
+static double
+denoise_image (guchar * pixels, float *fimg[3], float *planes[3], int width,
+	       int height, int nthreads, gboolean compact)
+{
+  double thresholds[3] = { 1.0, 2.0, 2.0 };
+  gint64 start;
+  int c, y;
+
+  start = g_get_monotonic_time ();
+  for (y = 0; y < height; y++)
+    load_row (pixels + (gsize) y * width * 3, fimg, y * width, width, 3,
+	      MODE_YCBCR);
+  for (c = 0; c < 3; c++)
+    {
+      planes[0] = fimg[c];
+      wavelet_denoise (planes, width, height, thresholds[c], 0, NULL,
+		       nthreads, compact, NULL, NULL);
+    }
+  for (y = 0; y < height; y++)
+    store_row (fimg, y * width, pixels + (gsize) y * width * 3, width, 3,
+	       MODE_YCBCR);
+  return (g_get_monotonic_time () - start) / 1e6;
+}
+
+/* The old conversions, from sRGB in [0:1] as read, done on whole planes
+ * after reading. The way back (ycbcr2srgb and so on) is still in
+ * colorspace.c, for the preview. */
+static void
+old_srgb2ycbcr (float **fimg, int size)
+{
+  float y, cb, cr;
+  int i;
+
+  for (i = 0; i < size; i++)
+    {
+      y = 0.2990 * fimg[0][i] + 0.5870 * fimg[1][i] + 0.1140 * fimg[2][i];
+      cb = -0.1687 * fimg[0][i] - 0.3313 * fimg[1][i]
+	+ 0.5000 * fimg[2][i] + 0.5;
+      cr = 0.5000 * fimg[0][i] - 0.4187 * fimg[1][i]
+	- 0.0813 * fimg[2][i] + 0.5;
+      fimg[0][i] = y;
+      fimg[1][i] = cb;
+      fimg[2][i] = cr;
+    }
+}
+
+static float
+old_lab_scale (float v)
+{
+  if (v > 216 / 24389.0)
+    return pow (v, 1 / 3.0);
+  return (24389 * v / 27.0 + 16) / 116.0;
+}
+
+static void
+old_srgb2lab (float **fimg, int size)
+{
+  float r, g, b, x, y, z;
+  int i;
+
+  for (i = 0; i < size; i++)
+    {
+      r = pow (fimg[0][i], 2.2);
+      g = pow (fimg[1][i], 2.2);
+      b = pow (fimg[2][i], 2.2);
+      x = 0.412424 * r + 0.357579 * g + 0.180464 * b;
+      y = 0.212656 * r + 0.715158 * g + 0.0721856 * b;
+      z = 0.0193324 * r + 0.119193 * g + 0.950444 * b;
+      x = old_lab_scale (x / 0.95047);
+      y = old_lab_scale (y);
+      z = old_lab_scale (z / 1.08883);
+      fimg[0][i] = MAX2 ((116 * y - 16) / 116.0, 0);
+      fimg[1][i] = 500 * (x - y) / 500.0 / 2.0 + 0.5;
+      fimg[2][i] = 200 * (y - z) / 200.0 / 2.2 + 0.5;
+    }
+}
+
+static void
+old_load (const guint16 * samples, float **fimg, int width, int channels,
+	  int colour_mode, float max)
+{
+  int x, c;
+
+  for (c = 0; c < channels; c++)
+    for (x = 0; x < width; x++)
+      fimg[c][x] = samples[x * channels + c] / max;
+  if (channels > 2 && colour_mode == MODE_YCBCR)
+    old_srgb2ycbcr (fimg, width);
+  else if (channels > 2 && colour_mode == MODE_LAB)
+    old_srgb2lab (fimg, width);
+}
+
+/* changes fimg */
+static void
+old_store (float **fimg, guint16 * samples, int width, int channels,
+	   int colour_mode, float max)
+{
+  int x, c;
+
+  if (channels > 2 && colour_mode == MODE_YCBCR)
+    ycbcr2srgb (fimg, width, 0);
+  else if (channels > 2 && colour_mode == MODE_LAB)
+    lab2srgb (fimg, width, 0);
+  for (c = 0; c < channels; c++)
+    for (x = 0; x < width; x++)
+      samples[x * channels + c] =
+	(guint16) (CLIP (fimg[c][x] * max, 0, max) + 0.5);
+}
+
+/* load_row or load_row16, from samples of depth bits */
+static void
+new_load (const guint16 * samples, float **fimg, int width, int channels,
+	  int colour_mode, int depth)
+{
+  guchar bytes[ACCURACY_ROW * 4];
+  int i;
+
+  if (depth == 16)
+    {
+      load_row16 ((guint16 *) samples, fimg, 0, width, channels,
+		  colour_mode);
+      return;
+    }
+  for (i = 0; i < width * channels; i++)
+    bytes[i] = samples[i];
+  load_row (bytes, fimg, 0, width, channels, colour_mode);
+}
+
+static void
+new_store (float **fimg, guint16 * samples, int width, int channels,
+	   int colour_mode, int depth)
+{
+  guchar bytes[ACCURACY_ROW * 4];
+  int i;
+
+  if (depth == 16)
+    {
+      store_row16 (fimg, 0, samples, width, channels, colour_mode);
+      return;
+    }
+  store_row (fimg, 0, bytes, width, channels, colour_mode);
+  for (i = 0; i < width * channels; i++)
+    samples[i] = bytes[i];
+}
+
+static int
+max_difference (const guint16 * a, const guint16 * b, int count)
+{
+  int i, worst = 0;
+
+  for (i = 0; i < count; i++)
+    worst = MAX2 (worst, abs (a[i] - b[i]));
+  return worst;
+}
+
+/* Every 8 bit colour, or ACCURACY_WORDS pseudo random 16 bit pixels. The
+ * stores are also given the loaded planes shifted a little, as the
+ * denoiser leaves them, so that clipping is exercised too. */
+static void
+accuracy (int colour_mode, int depth, int channels)
+{
+  static const char *names[] = { "YCbCr", "RGB", "LAB" };
+  guint16 samples[ACCURACY_ROW * 4], old[ACCURACY_ROW * 4],
+    new[ACCURACY_ROW * 4];
+  float *fold[4], *fnew[4], *fcopy[4];
+  float max = depth == 16 ? 65535.0 : 255.0, load = 0;
+  gsize count, pixel;
+  unsigned int seed = 12345;
+  int colours, x, c, store = 0, round = 0, old_round = 0;
+
+  for (c = 0; c < 4; c++)
+    {
+      fold[c] = g_new (float, ACCURACY_ROW);
+      fnew[c] = g_new (float, ACCURACY_ROW);
+      fcopy[c] = g_new (float, ACCURACY_ROW);
+    }
+  colours = MIN2 (channels, 3);
+  if (depth == 16)
+    count = ACCURACY_WORDS;
+  else
+    count = (gsize) 1 << (8 * colours);
+
+  for (pixel = 0; pixel < count; pixel += ACCURACY_ROW)
+    {
+      int width = MIN2 (count - pixel, ACCURACY_ROW);
+
+      for (x = 0; x < width; x++)
+	for (c = 0; c < channels; c++)
+	  {
+	    seed = seed * 1103515245 + 12345;
+	    if (depth == 16)
+	      samples[x * channels + c] = seed >> 16;
+	    else if (c < colours)
+	      samples[x * channels + c] = ((pixel + x) >> (8 * c)) & 255;
+	    else
+	      samples[x * channels + c] = (seed >> 16) & 255;
+	  }
+
+      old_load (samples, fold, width, channels, colour_mode, max);
+      new_load (samples, fnew, width, channels, colour_mode, depth);
+      for (c = 0; c < channels; c++)
+	for (x = 0; x < width; x++)
+	  load = MAX2 (load, fabs (fold[c][x] - fnew[c][x]));
+
+      new_store (fnew, new, width, channels, colour_mode, depth);
+      round = MAX2 (round, max_difference (samples, new,
+					    width * channels));
+      for (c = 0; c < channels; c++)
+	memcpy (fcopy[c], fold[c], width * sizeof (float));
+      old_store (fcopy, old, width, channels, colour_mode, max);
+      old_round = MAX2 (old_round, max_difference (samples, old,
+						    width * channels));
+
+      for (c = 0; c < channels; c++)
+	for (x = 0; x < width; x++)
+	  {
+	    seed = seed * 1103515245 + 12345;
+	    fold[c][x] += ((seed >> 16) % 2001 - 1000) * 5e-5;
+	    fcopy[c][x] = fold[c][x];
+	  }
+      old_store (fcopy, old, width, channels, colour_mode, max);
+      new_store (fold, new, width, channels, colour_mode, depth);
+      store = MAX2 (store, max_difference (old, new, width * channels));
+    }
+
+  printf ("%-5s %2d bit, %d channels: load %.2g, store %d levels,"
+	  " round trip %d levels (before: %d)\n", names[colour_mode], depth,
+	  channels, load, store, round, old_round);
+
+  for (c = 0; c < 4; c++)
+    {
+      g_free (fold[c]);
+      g_free (fnew[c]);
+      g_free (fcopy[c]);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  int width = argc > 2 ? atoi (argv[1]) : BENCH_WIDTH;
+  int height = argc > 2 ? atoi (argv[2]) : BENCH_HEIGHT;
+  int runs = argc > 3 ? atoi (argv[3]) : BENCH_RUNS;
+  int nthreads = argc > 4 ? atoi (argv[4]) : g_get_num_processors ();
+  double best, t, error = 0;
+  guchar *pixels, *reference;
+  float *fimg[3], *planes[3];
+  gsize size, i;
+  int compact, run, c, d, worst = 0;
+
+  if (argc == 2 && !strcmp (argv[1], "--accuracy"))
+    {
+      printf ("%s: largest difference from the old conversions\n",
+	      argv[0]);
+      for (d = 8; d <= 16; d += 8)
+	for (c = 1; c <= 4; c++)
+	  for (run = MODE_YCBCR; run <= MODE_LAB; run++)
+	    if (c > 2 || run == MODE_YCBCR)
+	      accuracy (run, d, c);
+      return 0;
+    }
+
+  if (width <= 0 || height <= 0 || runs <= 0)
+    {
+      g_printerr ("usage: %s [WIDTH HEIGHT [RUNS [THREADS]]]\n"
+		  "       %s --accuracy\n", argv[0], argv[0]);
+      return 1;
+    }
+  nthreads = CLIP (nthreads, 1, MAX_THREADS);
+
+  size = (gsize) width * height;
+  pixels = g_new (guchar, size * 3);
+  reference = g_new (guchar, size * 3);
+  for (c = 0; c < 3; c++)
+    fimg[c] = g_new (float, size);
+  /* big enough for either */
+  planes[1] = g_malloc (WAVELET_SCRATCH_SIZE (width, height, FALSE));
+  planes[2] = g_malloc (WAVELET_SCRATCH_SIZE (width, height, FALSE));
+
+  printf ("%s: %dx%d RGB in YCbCr, %d threads, %d runs\n", argv[0], width,
+	  height, nthreads, runs);
+  for (compact = 0; compact < 2; compact++)
+    {
+      best = 1e30;
+      for (run = 0; run < runs; run++)
+	{
+	  /* every run from the same input, since the result replaces it */
+	  make_image (pixels, width, height);
+	  t = denoise_image (pixels, fimg, planes, width, height, nthreads,
+			     compact);
+	  if (t < best)
+	    best = t;
+	  printf ("%s run %d: %.3f s\n", compact ? "compact" : "float", run,
+		  t);
+	}
+      printf ("%s best: %.3f s, %.1f Mpixel/s\n",
+	      compact ? "compact" : "float", best, size / best / 1e6);
+      if (!compact)
+	memcpy (reference, pixels, size * 3);
+    }
+
+  for (i = 0; i < size * 3; i++)
+    {
+      d = pixels[i] - reference[i];
+      error += d * d;
+      worst = MAX2 (worst, abs (d));
+    }
+  if (error > 0)
+    printf ("compact against float: PSNR %.1f dB, at most %d off\n",
+	    10 * log10 (255.0 * 255.0 * size * 3 / error), worst);
+  else
+    printf ("compact against float: identical\n");
+
+  for (c = 0; c < 3; c++)
+    g_free (fimg[c]);
+  g_free (planes[1]);
+  g_free (planes[2]);
+  g_free (pixels);
+  g_free (reference);
+  return 0;
+}
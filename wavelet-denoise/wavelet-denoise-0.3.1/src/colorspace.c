@@ -13,26 +13,414 @@
  * 
  */
 
-#include "plugin.h"
+#include "wavelet.h"
 
-void
-srgb2ycbcr (float ** fimg, int size)
+/* Reading and writing the image go through load_row and store_row, which
+ * convert between sRGB and the colour model while (de)interleaving, so
+ * each is a single pass over the pixels. For 8 bit pixels the gamma of the
+ * input is a table of 256 and the gamma of the output, with clipping and
+ * rounding, is found among the 256 values it rounds to. 16 bit pixels
+ * (load_row16 and store_row16) take a table of 65536 for the input and
+ * pow for the output. */
+
+#define GAMMA_CELLS 4096
+
+/* byte / 255.0 */
+static float byte_value[256];
+/* the same with gamma correction (approximate) */
+static float byte_linear[256];
+/* the linear value from which a byte is written: ((i - 0.5) / 255)^2.2 */
+static float byte_bound[257];
+/* the byte written for the start of each of GAMMA_CELLS linear cells */
+static guchar cell_byte[GAMMA_CELLS];
+/* word / 65535.0 with gamma correction, allocated if 16 bit is used */
+static float *word_linear;
+
+/* the tables are filled once, by whichever thread comes first */
+static void
+init_tables (void)
 {
-  /* using JPEG conversion here - expecting all channels to be
-   * in [0:255] range */
+  static gsize done = 0;
   int i;
-  float y, cb, cr;
 
-  for (i = 0; i < size; i++) {
-    y =   0.2990 * fimg[0][i] + 0.5870 * fimg[1][i] + 0.1140 * fimg[2][i];
-    cb = -0.1687 * fimg[0][i] - 0.3313 * fimg[1][i] + 0.5000 * fimg[2][i]
-         + 0.5;
-    cr =  0.5000 * fimg[0][i] - 0.4187 * fimg[1][i] - 0.0813 * fimg[2][i]
-         + 0.5;
-    fimg[0][i] = y;
-    fimg[1][i] = cb;
-    fimg[2][i] = cr;
-  }
+  if (!g_once_init_enter (&done))
+    return;
+  for (i = 0; i < 256; i++)
+    {
+      byte_value[i] = i / 255.0;
+      byte_linear[i] = pow (byte_value[i], 2.2);
+      byte_bound[i] = pow ((i - 0.5) / 255.0, 2.2);
+    }
+  byte_bound[0] = 0.0;
+  byte_bound[256] = HUGE_VAL;
+  for (i = 0; i < GAMMA_CELLS; i++)
+    {
+      cell_byte[i] = i ? cell_byte[i - 1] : 0;
+      while (byte_bound[cell_byte[i] + 1] <= (float) i / GAMMA_CELLS)
+	cell_byte[i]++;
+    }
+  g_once_init_leave (&done, 1);
+}
+
+static void
+init_word_tables (void)
+{
+  static gsize done = 0;
+  float *table;
+  int i;
+
+  if (!g_once_init_enter (&done))
+    return;
+  /* FIXME: replace by GIMP functions */
+  table = (float *) malloc (65536 * sizeof (float));
+  for (i = 0; i < 65536; i++)
+    table[i] = pow (i / 65535.0, 2.2);
+  word_linear = table;
+  g_once_init_leave (&done, 1);
+}
+
+/* byte to write for a value in [0:1], clipped and rounded */
+static inline guchar
+quantize (float v)
+{
+  float clipped = CLIP (v * 255.0f, 0, 255);
+  /* avoiding rounding errors !!! */
+  return (guchar) (clipped + 0.5);
+}
+
+/* byte to write for a linear value: the same as quantize (pow (v, 1 / 2.2))
+ * but a table lookup and a step or two of search */
+static inline guchar
+quantize_gamma (float v)
+{
+  int i;
+
+  if (!(v > 0))
+    return 0;
+  if (v >= 1)
+    return 255;
+  i = cell_byte[(int) (v * GAMMA_CELLS)];
+  while (v >= byte_bound[i + 1])
+    i++;
+  return i;
+}
+
+/* the same for 16 bit */
+static inline guint16
+quantize16 (float v)
+{
+  float clipped = CLIP (v * 65535.0f, 0, 65535);
+  return (guint16) (clipped + 0.5);
+}
+
+static inline guint16
+quantize16_gamma (float v)
+{
+  if (!(v > 0))
+    return 0;
+  if (v >= 1)
+    return 65535;
+  return quantize16 (powf (v, 1 / 2.2f));
+}
+
+/* cube root of x > 0: a guess from the exponent, refined by Newton */
+static inline float
+cube_root (float x)
+{
+  union
+  {
+    float f;
+    guint32 i;
+  } u;
+  float y;
+
+  u.f = x;
+  u.i = u.i / 3 + 709921077;
+  y = u.f;
+  y = (2 * y + x / (y * y)) * (1 / 3.0f);
+  y = (2 * y + x / (y * y)) * (1 / 3.0f);
+  y = (2 * y + x / (y * y)) * (1 / 3.0f);
+  return y;
+}
+
+static inline float
+lab_scale (float v)
+{
+  if (v > 216 / 24389.0)
+    return cube_root (v);
+  return (24389 * v / 27.0 + 16) / 116.0;
+}
+
+/* The conversions of a pixel, shared by the 8 and 16 bit rows. The
+ * values are in [0:1], and r, g, b are linear for CIELAB. */
+
+static inline void
+ycbcr_from_rgb (float r, float g, float b, float **fimg, gsize i)
+{
+  /* using JPEG conversion here */
+  fimg[0][i] = 0.2990 * r + 0.5870 * g + 0.1140 * b;
+  fimg[1][i] = -0.1687 * r - 0.3313 * g + 0.5000 * b + 0.5;
+  fimg[2][i] = 0.5000 * r - 0.4187 * g - 0.0813 * b + 0.5;
+}
+
+static inline void
+lab_from_linear (float r, float g, float b, float **fimg, gsize i)
+{
+  float l, fx, fy, fz;
+
+  /* matrix RGB -> XYZ, with D65 reference white
+     (www.brucelindbloom.com), relative to the reference white */
+  fx = 0.412424 * r + 0.357579 * g + 0.180464 * b;
+  fy = 0.212656 * r + 0.715158 * g + 0.0721856 * b;
+  fz = 0.0193324 * r + 0.119193 * g + 0.950444 * b;
+  fx /= 0.95047;
+  fz /= 1.08883;
+
+  /* scale */
+  fx = lab_scale (fx);
+  fy = lab_scale (fy);
+  fz = lab_scale (fz);
+
+  l = 116 * fy - 16;
+  fimg[0][i] = MAX2 (l / 116.0, 0);
+  fimg[1][i] = 500 * (fx - fy) / 500.0 / 2.0 + 0.5;
+  fimg[2][i] = 200 * (fy - fz) / 200.0 / 2.2 + 0.5;
+}
+
+static inline void
+rgb_from_ycbcr (float **fimg, gsize i, float rgb[3])
+{
+  float y = fimg[0][i];
+  double cb = fimg[1][i] - 0.5;
+  double cr = fimg[2][i] - 0.5;
+
+  rgb[0] = y + 1.40200 * cr;
+  rgb[1] = y - 0.34414 * cb - 0.71414 * cr;
+  rgb[2] = y + 1.77200 * cb;
+}
+
+static inline void
+linear_from_lab (float **fimg, gsize i, float rgb[3])
+{
+  float l, a, b, fx, fy, fz;
+
+  /* convert back to normal LAB */
+  l = fimg[0][i] * 116;
+  a = (fimg[1][i] - 0.5) * 500 * 2;
+  b = (fimg[2][i] - 0.5) * 200 * 2.2;
+
+  /* matrix */
+  fy = (l + 16) / 116;
+  fz = fy - b / 200.0;
+  fx = a / 500.0 + fy;
+
+  /* scale, and the white reference */
+  if (fx * fx * fx > 216 / 24389.0)
+    fx = fx * fx * fx;
+  else
+    fx = (116 * fx - 16) * 27 / 24389.0;
+  if (l > 216 / 27.0)
+    fy = fy * fy * fy;
+  else
+    fy = (116 * fy - 16) * 27 / 24389.0;
+  if (fz * fz * fz > 216 / 24389.0)
+    fz = fz * fz * fz;
+  else
+    fz = (116 * fz - 16) * 27 / 24389.0;
+  fx *= 0.95047;
+  fz *= 1.08883;
+
+  /* matrix XYZ -> RGB, with D65 reference white
+     (www.brucelindbloom.com) */
+  rgb[0] = 3.24071 * fx - 1.53726 * fy - 0.498571 * fz;
+  rgb[1] = -0.969258 * fx + 1.87599 * fy + 0.0415557 * fz;
+  rgb[2] = 0.0556352 * fx - 0.203996 * fy + 1.05707 * fz;
+}
+
+/* read a row of width pixels of channels bytes from line into fimg at
+ * offset, converted to the colour model */
+void
+load_row (guchar * line, float **fimg, gsize offset, int width, int channels,
+	  int colour_mode)
+{
+  int x;
+  guchar *p;
+
+  init_tables ();
+
+  if (channels < 3 || colour_mode == MODE_RGB)
+    {
+      for (x = 0; x < width; x++)
+	{
+	  fimg[0][offset + x] = byte_value[line[x * channels]];
+	  if (channels > 2)
+	    {
+	      fimg[1][offset + x] = byte_value[line[x * channels + 1]];
+	      fimg[2][offset + x] = byte_value[line[x * channels + 2]];
+	    }
+	}
+    }
+  else if (colour_mode == MODE_YCBCR)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	ycbcr_from_rgb (byte_value[p[0]], byte_value[p[1]],
+			byte_value[p[2]], fimg, offset + x);
+    }
+  else if (colour_mode == MODE_LAB)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	lab_from_linear (byte_linear[p[0]], byte_linear[p[1]],
+			 byte_linear[p[2]], fimg, offset + x);
+    }
+
+  /* alpha */
+  if (channels % 2 == 0)
+    for (x = 0; x < width; x++)
+      fimg[channels - 1][offset + x] =
+	byte_value[line[x * channels + channels - 1]];
+}
+
+/* write a row of width pixels of fimg at offset to line, converted back
+ * from the colour model, clipped and rounded */
+void
+store_row (float **fimg, gsize offset, guchar * line, int width, int channels,
+	   int colour_mode)
+{
+  int x;
+  float rgb[3];
+  guchar *p;
+
+  init_tables ();
+
+  if (channels < 3 || colour_mode == MODE_RGB)
+    {
+      for (x = 0; x < width; x++)
+	{
+	  line[x * channels] = quantize (fimg[0][offset + x]);
+	  if (channels > 2)
+	    {
+	      line[x * channels + 1] = quantize (fimg[1][offset + x]);
+	      line[x * channels + 2] = quantize (fimg[2][offset + x]);
+	    }
+	}
+    }
+  else if (colour_mode == MODE_YCBCR)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	{
+	  rgb_from_ycbcr (fimg, offset + x, rgb);
+	  p[0] = quantize (rgb[0]);
+	  p[1] = quantize (rgb[1]);
+	  p[2] = quantize (rgb[2]);
+	}
+    }
+  else if (colour_mode == MODE_LAB)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	{
+	  linear_from_lab (fimg, offset + x, rgb);
+	  p[0] = quantize_gamma (rgb[0]);
+	  p[1] = quantize_gamma (rgb[1]);
+	  p[2] = quantize_gamma (rgb[2]);
+	}
+    }
+
+  /* alpha */
+  if (channels % 2 == 0)
+    for (x = 0; x < width; x++)
+      line[x * channels + channels - 1] =
+	quantize (fimg[channels - 1][offset + x]);
+}
+
+/* load_row for 16 bit pixels */
+void
+load_row16 (guint16 * line, float **fimg, gsize offset, int width,
+	    int channels, int colour_mode)
+{
+  const float scale = 1 / 65535.0f;
+  int x;
+  guint16 *p;
+
+  if (channels < 3 || colour_mode == MODE_RGB)
+    {
+      for (x = 0; x < width; x++)
+	{
+	  fimg[0][offset + x] = line[x * channels] * scale;
+	  if (channels > 2)
+	    {
+	      fimg[1][offset + x] = line[x * channels + 1] * scale;
+	      fimg[2][offset + x] = line[x * channels + 2] * scale;
+	    }
+	}
+    }
+  else if (colour_mode == MODE_YCBCR)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	ycbcr_from_rgb (p[0] * scale, p[1] * scale, p[2] * scale, fimg,
+			offset + x);
+    }
+  else if (colour_mode == MODE_LAB)
+    {
+      init_word_tables ();
+      for (x = 0, p = line; x < width; x++, p += channels)
+	lab_from_linear (word_linear[p[0]], word_linear[p[1]],
+			 word_linear[p[2]], fimg, offset + x);
+    }
+
+  /* alpha */
+  if (channels % 2 == 0)
+    for (x = 0; x < width; x++)
+      fimg[channels - 1][offset + x] =
+	line[x * channels + channels - 1] * scale;
+}
+
+/* store_row for 16 bit pixels */
+void
+store_row16 (float **fimg, gsize offset, guint16 * line, int width,
+	     int channels, int colour_mode)
+{
+  int x;
+  float rgb[3];
+  guint16 *p;
+
+  if (channels < 3 || colour_mode == MODE_RGB)
+    {
+      for (x = 0; x < width; x++)
+	{
+	  line[x * channels] = quantize16 (fimg[0][offset + x]);
+	  if (channels > 2)
+	    {
+	      line[x * channels + 1] = quantize16 (fimg[1][offset + x]);
+	      line[x * channels + 2] = quantize16 (fimg[2][offset + x]);
+	    }
+	}
+    }
+  else if (colour_mode == MODE_YCBCR)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	{
+	  rgb_from_ycbcr (fimg, offset + x, rgb);
+	  p[0] = quantize16 (rgb[0]);
+	  p[1] = quantize16 (rgb[1]);
+	  p[2] = quantize16 (rgb[2]);
+	}
+    }
+  else if (colour_mode == MODE_LAB)
+    {
+      for (x = 0, p = line; x < width; x++, p += channels)
+	{
+	  linear_from_lab (fimg, offset + x, rgb);
+	  p[0] = quantize16_gamma (rgb[0]);
+	  p[1] = quantize16_gamma (rgb[1]);
+	  p[2] = quantize16_gamma (rgb[2]);
+	}
+    }
+
+  /* alpha */
+  if (channels % 2 == 0)
+    for (x = 0; x < width; x++)
+      line[x * channels + channels - 1] =
+	quantize16 (fimg[channels - 1][offset + x]);
 }
 
 void
@@ -69,37 +457,6 @@ ycbcr2srgb (float **fimg, int size, int pc)
   }
 }
 
-void
-srgb2xyz (float **fimg, int size)
-{
-  /* fimg in [0:1], sRGB */
-  int i;
-  float x, y, z;
-
-  for (i = 0; i < size; i++) {
-    /* scaling and gamma correction (approximate) */
-    fimg[0][i] = pow(fimg[0][i], 2.2);
-    fimg[1][i] = pow(fimg[1][i], 2.2);
-    fimg[2][i] = pow(fimg[2][i], 2.2);
- 
-
-    /* matrix RGB -> XYZ, with D65 reference white (www.brucelindbloom.com) */
-    x = 0.412424 * fimg[0][i] + 0.357579 * fimg[1][i] + 0.180464 * fimg[2][i];
-    y = 0.212656 * fimg[0][i] + 0.715158 * fimg[1][i] + 0.0721856 * fimg[2][i];
-    z = 0.0193324 * fimg[0][i] + 0.119193 * fimg[1][i] + 0.950444 * fimg[2][i];
-
-    /*
-    x = 0.412424 * fimg[0][i] + 0.212656 * fimg[1][i] + 0.0193324 * fimg[2][i];
-    y = 0.357579 * fimg[0][i] + 0.715158 * fimg[1][i] + 0.119193  * fimg[2][i];
-    z = 0.180464 * fimg[0][i] + 0.0721856 * fimg[1][i] + 0.950444 * fimg[2][i];
-    */
-
-    fimg[0][i] = x;
-    fimg[1][i] = y;
-    fimg[2][i] = z;
-  }
-}
-
 void
 xyz2srgb (float **fimg, int size, int pc)
 {
@@ -204,57 +561,6 @@ void lab2srgb (float **fimg, int size, int pc)
   xyz2srgb(fimg, size, 0);
 }
 
-void srgb2lab (float **fimg, int size)
-{
-  int i;
-  float l, a, b;
-  srgb2xyz(fimg, size);
-  for (i = 0; i < size; i++) {
-    /* reference white */
-    fimg[0][i] /= 0.95047;
-    /* (just for completeness)
-    fimg[1][i] /= 1.00000; */
-    fimg[2][i] /= 1.08883;
-
-    /* scale */
-    if (fimg[0][i] > 216 / 24389.0) {
-      fimg[0][i] = pow(fimg[0][i], 1 / 3.0);
-    } else {
-      fimg[0][i] = (24389 * fimg[0][i] / 27.0 + 16) / 116.0;
-    }
-    if (fimg[1][i] > 216 / 24389.0) {
-      fimg[1][i] = pow(fimg[1][i], 1 / 3.0);
-    } else {
-      fimg[1][i] = (24389 * fimg[1][i] / 27.0 + 16) / 116.0;
-    }
-    if (fimg[2][i] > 216 / 24389.0) {
-      fimg[2][i] = pow(fimg[2][i], 1 / 3.0);
-    } else {
-      fimg[2][i] = (24389 * fimg[2][i] / 27.0 + 16) / 116.0;
-    }
-
-    l = 116 * fimg[1][i] - 16;
-    a = 500 * (fimg[0][i] - fimg[1][i]);
-    b = 200 * (fimg[1][i] - fimg[2][i]);
-    fimg[0][i] = l / 116.0; // + 16 * 27 / 24389.0;
-    fimg[1][i] = a / 500.0 / 2.0 + 0.5;
-    fimg[2][i] = b / 200.0 / 2.2 + 0.5;
-    if (fimg[0][i] < 0)
-      fimg[0][i] = 0;
-  }
-}
-
-void srgb2rgb(float **fimg, int size)
-{
-  /*int i;
-  for (i = 0; i < size; i++)
-    {
-      fimg[0][i] = pow(fimg[0][i], 1.1);
-      fimg[0][i] = pow(fimg[1][i], 1.1);
-      fimg[0][i] = pow(fimg[2][i], 1.1);
-    }*/
-}
-
 void
 rgb2srgb (float **fimg, int size, int pc)
 {
@@ -15,14 +15,404 @@
 
 #include "plugin.h"
 
+/* one channel to denoise, with its own scratch planes */
+typedef struct
+{
+  float *fimg[3];
+  unsigned int width, height;
+  float threshold;
+  double low;
+  int channel;
+  double (*noise)[5];		/* or NULL, to profile the noise here */
+  int nthreads;
+  volatile float progress;
+  GThread *thread;
+} channel_job;
+
+/* kept for the main thread to poll, see denoise_channels */
+static void
+channel_progress (float fraction, gpointer data)
+{
+  ((channel_job *) data)->progress = fraction;
+}
+
+static gpointer
+denoise_channel (gpointer data)
+{
+  channel_job *job = (channel_job *) data;
+
+  wavelet_denoise (job->fimg, job->width, job->height, job->threshold,
+		   job->low, job->noise, job->nthreads, COMPACT_SCRATCH,
+		   channel_progress, job);
+  return NULL;
+}
+
+/* denoise the channels of jobs concurrently, each on its own thread with
+ * a share of the processors for its wavelet transforms. The channels are
+ * independent after the colour model conversion. libgimp must only be
+ * called from this thread, so it polls the progress of the channels and
+ * reports it as a + b * (channels done), unless b is 0 */
+static void
+denoise_channels (channel_job * jobs, int count, unsigned int width,
+		  unsigned int height, double a, double b)
+{
+  int c, running;
+  float done;
+
+  for (c = 0; c < count; c++)
+    {
+      /* FIXME: replace by GIMP functions */
+      jobs[c].fimg[1] = (float *) malloc (WAVELET_SCRATCH_SIZE
+					  (width, height, COMPACT_SCRATCH));
+      jobs[c].fimg[2] = (float *) malloc (WAVELET_SCRATCH_SIZE
+					  (width, height, COMPACT_SCRATCH));
+      jobs[c].width = width;
+      jobs[c].height = height;
+      jobs[c].nthreads = MAX2 (g_get_num_processors () / count, 1);
+      jobs[c].progress = 0.0;
+      jobs[c].thread = g_thread_try_new (NULL, denoise_channel, &jobs[c],
+					 NULL);
+      /* no thread, so denoise the channel here */
+      if (!jobs[c].thread)
+	denoise_channel (&jobs[c]);
+    }
+
+  if (b > 0)
+    do
+      {
+	running = 0;
+	done = 0.0;
+	for (c = 0; c < count; c++)
+	  {
+	    done += jobs[c].progress;
+	    if (jobs[c].progress < 1.0)
+	      running++;
+	  }
+	gimp_progress_update (a + b * done);
+	if (running)
+	  g_usleep (G_USEC_PER_SEC / 10);
+      }
+    while (running);
+
+  for (c = 0; c < count; c++)
+    {
+      if (jobs[c].thread)
+	g_thread_join (jobs[c].thread);
+      /* FIXME: replace by GIMP functions */
+      free (jobs[c].fimg[1]);
+      free (jobs[c].fimg[2]);
+    }
+}
+
+/* The image is read and written a tile at a time, as GIMP holds it, so
+ * every tile is fetched once and no tile cache is needed. The rows of a
+ * tile are (de)interleaved and converted straight from and to the tile
+ * data by load_row and store_row. */
+
+/* read the region from GIMP into fimg, converted to the colour model.
+ * Progress goes from a to a + b, unless b is 0 */
+static void
+read_image (GimpDrawable * drawable, gint x1, gint y1, gint width,
+	    gint height, double a, double b)
+{
+  GimpPixelRgn rgn;
+  gpointer iter;
+  gint i, done = 0;
+
+  gimp_pixel_rgn_init (&rgn, drawable, x1, y1, width, height, FALSE,
+		       FALSE);
+  for (iter = gimp_pixel_rgns_register (1, &rgn); iter != NULL;
+       iter = gimp_pixel_rgns_process (iter))
+    {
+      for (i = 0; i < rgn.h; i++)
+	load_row (rgn.data + i * rgn.rowstride, fimg,
+		  (rgn.y - y1 + i) * width + rgn.x - x1, rgn.w, channels,
+		  settings.colour_mode);
+      done += rgn.w * rgn.h;
+      if (b > 0)
+	gimp_progress_update (a + b * done / ((double) width * height));
+    }
+}
+
+/* the preview planes are already converted and scaled to [0:255] */
+static void
+store_preview_row (gint offset, guchar * line, gint width)
+{
+  gint x, c;
+
+  for (c = 0; c < channels; c++)
+    for (x = 0; x < width; x++)
+      /* avoiding rounding errors !!! */
+      line[x * channels + c] = (guchar) (fimg[c][offset + x] + 0.5);
+}
+
+/* write the region from fimg, whose rows are stride pixels apart starting
+ * at offset, to the shadow tiles of the drawable through rgn, which is left
+ * set up for drawing the preview. Progress as for read_image */
+static void
+write_image (GimpDrawable * drawable, GimpPixelRgn * rgn, gint x1, gint y1,
+	     gint width, gint height, gint offset, gint stride,
+	     gboolean preview, double a, double b)
+{
+  gpointer iter;
+  gint i, row, done = 0;
+
+  gimp_pixel_rgn_init (rgn, drawable, x1, y1, width, height, !preview,
+		       TRUE);
+  for (iter = gimp_pixel_rgns_register (1, rgn); iter != NULL;
+       iter = gimp_pixel_rgns_process (iter))
+    {
+      for (i = 0; i < rgn->h; i++)
+	{
+	  row = offset + (rgn->y - y1 + i) * stride + rgn->x - x1;
+	  if (preview)
+	    store_preview_row (row, rgn->data + i * rgn->rowstride, rgn->w);
+	  else
+	    store_row (fimg, row, rgn->data + i * rgn->rowstride, rgn->w,
+		       channels, settings.colour_mode);
+	}
+      done += rgn->w * rgn->h;
+      if (b > 0)
+	gimp_progress_update (a + b * done / ((double) width * height));
+    }
+}
+
+/* the channels to denoise, with their settings, as jobs on fimg. In preview
+ * mode only the displayed channel is processed */
+static int
+select_channels (channel_job * jobs, gboolean preview)
+{
+  int c, count = 0;
+
+  for (c = 0; c < channels; c++)
+    {
+      if (preview && settings.preview_mode > 0 &&
+	  settings.preview_channel != c)
+	continue;
+      if (channels > 2 && settings.colour_thresholds[c] > 0)
+	{
+	  jobs[count].threshold = settings.colour_thresholds[c];
+	  jobs[count].low = settings.colour_low[c];
+	}
+      else if (channels < 3 && settings.gray_thresholds[c] > 0)
+	{
+	  jobs[count].threshold = settings.gray_thresholds[c];
+	  jobs[count].low = settings.gray_low[c];
+	}
+      else
+	continue;
+      jobs[count].fimg[0] = fimg[c];
+      jobs[count].channel = c;
+      jobs[count].noise = NULL;
+      count++;
+    }
+  return count;
+}
+
+/* retransform fimg from the colour model to sRGB. pc selects a single
+ * channel to show, as for the converters in colorspace.c */
+static void
+convert_back (int size, int pc)
+{
+  if (channels > 2) {
+    if (settings.colour_mode == MODE_YCBCR) {
+      ycbcr2srgb(fimg, size, pc);
+    } else if (settings.colour_mode == MODE_LAB) {
+      lab2srgb(fimg, size, pc);
+    } else if (settings.colour_mode == MODE_RGB) {
+      rgb2srgb(fimg, size, pc);
+    }
+  }
+}
+
+/* Denoise the region in tiles, for images too large to hold as float
+ * planes. A tile is read with an apron of TILE_APRON pixels (clipped to
+ * the region) so its interior comes out as if the region were transformed
+ * at once. The noise must be profiled over the whole region, so a first
+ * pass sums the noise of the interiors of the tiles on every stride'th
+ * diagonal, about TILED_NOISE_TILES of them, and a second pass denoises
+ * all tiles with it. Profiling every tile would take as long as the
+ * denoising. */
+static void
+denoise_tiled (GimpDrawable * drawable, gint x1, gint y1, gint width,
+	       gint height)
+{
+  GimpPixelRgn rgn_out;
+  channel_job jobs[4];
+  double sums[4][5][5], noise[4][5][5];
+  unsigned int samples[4][5][5];
+  float *scratch[3];
+  gint pass, count, ncols, nrows, ntiles, nprofiled, stride, done, c;
+  gint tx, ty, ax1, ay1, ax2, ay2, aw, ah, iw, ih;
+
+  /* FIXME: replace by GIMP functions */
+  aw = TILE_SIZE + 2 * TILE_APRON;
+  for (c = 0; c < channels; c++)
+    fimg[c] = (float *) malloc (aw * aw * sizeof (float));
+  scratch[1] = (float *) malloc (WAVELET_SCRATCH_SIZE
+				 (aw, aw, COMPACT_SCRATCH));
+  scratch[2] = (float *) malloc (WAVELET_SCRATCH_SIZE
+				 (aw, aw, COMPACT_SCRATCH));
+
+  memset (sums, 0, sizeof (sums));
+  memset (samples, 0, sizeof (samples));
+  count = select_channels (jobs, FALSE);
+  ncols = (width + TILE_SIZE - 1) / TILE_SIZE;
+  nrows = (height + TILE_SIZE - 1) / TILE_SIZE;
+  ntiles = ncols * nrows;
+  stride = MAX2 (ntiles / TILED_NOISE_TILES, 1);
+  nprofiled = 0;
+  for (ty = 0; ty < nrows; ty++)
+    for (tx = 0; tx < ncols; tx++)
+      if ((tx + ty) % stride == 0)
+	nprofiled++;
+
+  gimp_progress_init (_("Wavelet denoising..."));
+  done = 0;
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (ty = y1; ty < y1 + height; ty += TILE_SIZE)
+	for (tx = x1; tx < x1 + width; tx += TILE_SIZE)
+	  {
+	    if (pass == 0
+		&& ((tx - x1) / TILE_SIZE + (ty - y1) / TILE_SIZE) % stride)
+	      continue;
+	    gimp_progress_update ((double) done++ / (nprofiled + ntiles));
+
+	    /* the tile and its apron, inside the region */
+	    ax1 = MAX2 (tx - TILE_APRON, x1);
+	    ay1 = MAX2 (ty - TILE_APRON, y1);
+	    ax2 = MIN2 (tx + TILE_SIZE + TILE_APRON, x1 + width);
+	    ay2 = MIN2 (ty + TILE_SIZE + TILE_APRON, y1 + height);
+	    aw = ax2 - ax1;
+	    ah = ay2 - ay1;
+	    iw = MIN2 (TILE_SIZE, x1 + width - tx);
+	    ih = MIN2 (TILE_SIZE, y1 + height - ty);
+	    read_image (drawable, ax1, ay1, aw, ah, 0.0, 0.0);
+
+	    /* first pass: the noise of the interior */
+	    if (pass == 0)
+	      {
+		for (c = 0; c < count; c++)
+		  {
+		    scratch[0] = jobs[c].fimg[0];
+		    wavelet_noise_sums (scratch, aw, ah, tx - ax1, ty - ay1,
+					tx - ax1 + iw, ty - ay1 + ih,
+					sums[c], samples[c],
+					g_get_num_processors (),
+					COMPACT_SCRATCH);
+		  }
+		continue;
+	      }
+
+	    /* second pass: denoise with the noise of the region */
+	    denoise_channels (jobs, count, aw, ah, 0.0, 0.0);
+	    write_image (drawable, &rgn_out, tx, ty, iw, ih,
+			 (ty - ay1) * aw + tx - ax1, aw, FALSE, 0.0, 0.0);
+	  }
+
+      if (pass == 0)
+	for (c = 0; c < count; c++)
+	  {
+	    wavelet_noise_stdev (sums[c], samples[c], noise[c]);
+	    jobs[c].noise = noise[c];
+	  }
+    }
+
+  /* FIXME: replace by GIMP functions */
+  for (c = 0; c < channels; c++)
+    free (fimg[c]);
+  free (scratch[1]);
+  free (scratch[2]);
+
+  gimp_drawable_flush (drawable);
+  gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
+  gimp_drawable_update (drawable->drawable_id, x1, y1, width, height);
+}
+
+/* The preview keeps the colour converted planes of its region and, once a
+ * channel has been denoised, the wavelet decomposition of that channel.
+ * Moving a threshold or softness slider then only redoes the thresholding
+ * and the reconstruction, not the reading, conversion and transforms.
+ * Scrolling the preview or changing the colour model starts afresh. */
+static struct
+{
+  gint x1, y1, width, height;
+  guint colour_mode;
+  float *planes[4];
+  wavelet_decomposition decomposition[4];
+} cache;
+
+void
+preview_cache_clear (void)
+{
+  gint c;
+
+  for (c = 0; c < 4; c++)
+    {
+      if (cache.decomposition[c].lowpass)
+	wavelet_decomposition_free (&cache.decomposition[c]);
+      /* FIXME: replace by GIMP functions */
+      free (cache.planes[c]);
+      cache.planes[c] = NULL;
+    }
+}
+
+/* if the cache holds the region, copy its planes to fimg */
+static gboolean
+cache_lookup (gint x1, gint y1, gint width, gint height)
+{
+  gint c;
+
+  if (!cache.planes[0] || cache.x1 != x1 || cache.y1 != y1
+      || cache.width != width || cache.height != height
+      || cache.colour_mode != settings.colour_mode)
+    return FALSE;
+  for (c = 0; c < channels; c++)
+    memcpy (fimg[c], cache.planes[c], width * height * sizeof (float));
+  return TRUE;
+}
+
+static void
+cache_store (gint x1, gint y1, gint width, gint height)
+{
+  gint c;
+
+  preview_cache_clear ();
+  cache.x1 = x1;
+  cache.y1 = y1;
+  cache.width = width;
+  cache.height = height;
+  cache.colour_mode = settings.colour_mode;
+  for (c = 0; c < channels; c++)
+    {
+      /* FIXME: replace by GIMP functions */
+      cache.planes[c] = (float *) malloc (width * height * sizeof (float));
+      memcpy (cache.planes[c], fimg[c], width * height * sizeof (float));
+    }
+}
+
+/* denoise a channel of the cached region, decomposing it if not yet done */
+static void
+cache_denoise_channel (channel_job * job)
+{
+  wavelet_decomposition *dec = &cache.decomposition[job->channel];
+
+  if (!dec->lowpass)
+    wavelet_decompose (dec, cache.planes[job->channel], cache.width,
+		       cache.height, g_get_num_processors ());
+  wavelet_reconstruct (dec, job->fimg[0], job->threshold, job->low,
+		       g_get_num_processors ());
+}
+
 void
 denoise (GimpDrawable * drawable, GimpPreview * preview)
 {
-  GimpPixelRgn rgn_in, rgn_out;
-  gint i, x1, y1, x2, y2, width, height, x, c;
-  guchar *line;
+  GimpPixelRgn rgn_out;
+  gint i, x1, y1, x2, y2, width, height, c;
   float times[3], totaltime;
   int channels_denoised;
+  channel_job jobs[4];
 
   if (preview)
     {
@@ -38,13 +428,11 @@ denoise (GimpDrawable * drawable, GimpPreview * preview)
       height = y2 - y1;
     }
 
-  gimp_pixel_rgn_init (&rgn_in, drawable, x1, y1, width, height, FALSE,
-		       FALSE);
-  gimp_pixel_rgn_init (&rgn_out, drawable, x1, y1, width, height,
-		       preview == NULL, TRUE);
-
-  /* cache some tiles to make reading/writing faster */
-  gimp_tile_cache_ntiles (drawable->width / gimp_tile_width () + 1);
+  if (!preview && (gint64) width * height > TILED_MIN_PIXELS)
+    {
+      denoise_tiled (drawable, x1, y1, width, height);
+      return;
+    }
 
   totaltime = settings.times[0];
   totaltime += settings.times[2];
@@ -57,7 +445,8 @@ denoise (GimpDrawable * drawable, GimpPreview * preview)
     }
 
   /* FIXME: replace by GIMP functions */
-  line = (guchar *) malloc (channels * width * sizeof (guchar));
+  for (c = 0; c < channels; c++)
+    fimg[c] = (float *) malloc (width * height * sizeof (float));
 
   /* read the full image from GIMP */
   if (!preview)
@@ -65,126 +454,68 @@ denoise (GimpDrawable * drawable, GimpPreview * preview)
        progress */
     gimp_progress_init (_("Wavelet denoising..."));
   times[0] = g_timer_elapsed (timer, NULL);
-  for (i = 0; i < y2 - y1; i++)
+  if (!preview || !cache_lookup (x1, y1, width, height))
     {
-      if (!preview && i % 10 == 0)
-	gimp_progress_update (settings.times[0] * i
-			      / (double) height / totaltime);
-      gimp_pixel_rgn_get_row (&rgn_in, line, x1, i + y1, width);
-
-      /* convert pixel values to float [0,1] */
-      for (c = 0; c < channels; c++)
-	{
-	  for (x = 0; x < width; x++)
-	    fimg[c][i * width + x] = line[x * channels + c] / 255.0;
-	}
+      read_image (drawable, x1, y1, width, height, 0.0,
+		  preview ? 0.0 : settings.times[0] / totaltime);
+      if (preview)
+	cache_store (x1, y1, width, height);
     }
   times[0] = g_timer_elapsed (timer, NULL) - times[0];
 
-  /* do colour model conversion sRGB[0,1] -> whatever */
-  if (channels > 2) {
-    if (settings.colour_mode == MODE_YCBCR) {
-      srgb2ycbcr(fimg, width * height);
-    } else if (settings.colour_mode == MODE_LAB) {
-      srgb2lab(fimg, width * height);
-    } else if (settings.colour_mode == MODE_RGB) {
-      srgb2rgb(fimg, width * height);
-    }
-  }
-
-  /* denoise the channels individually */
+  /* denoise the channels individually, all at once */
   times[1] = g_timer_elapsed (timer, NULL);
-  /* FIXME: variable abuse (x) */
-  channels_denoised = 0;
-  for (c = 0; c < channels; c++)
-    {
-      double a, b;
-      /* in preview mode only process the displayed channel */
-      if (preview && settings.preview_mode > 0 &&
-	  settings.preview_channel != c)
-	continue;
-      buffer[0] = fimg[c];
-      b = preview ? 0.0 : settings.times[1] / totaltime;
-      a = settings.times[0] + channels_denoised * settings.times[1];
-      a /= totaltime;
-      if (channels > 2 && settings.colour_thresholds[c] > 0)
-	{
-	  wavelet_denoise (buffer, width, height, (float)
-			   settings.colour_thresholds[c],
-			   settings.colour_low[c], a, b);
-	  channels_denoised++;
-	}
-      if (channels < 3 && settings.gray_thresholds[c] > 0)
-	{
-	  wavelet_denoise (buffer, width, height, (float)
-			   settings.gray_thresholds[c], settings.gray_low[c],
-			   a, b);
-	  channels_denoised++;
-	}
-    }
+  channels_denoised = select_channels (jobs, preview != NULL);
+  if (preview)
+    for (c = 0; c < channels_denoised; c++)
+      cache_denoise_channel (&jobs[c]);
+  else
+    denoise_channels (jobs, channels_denoised, width, height,
+		      settings.times[0] / totaltime,
+		      settings.times[1] / totaltime);
   times[1] = g_timer_elapsed (timer, NULL) - times[1];
   times[1] /= channels_denoised;
 
-  /* retransform the image data */
-  if (channels > 2) {
-    int pc = 0;
-    if (preview && settings.preview_mode == 1)
-      pc = settings.preview_channel + 1;
-    else if (preview && settings.preview_mode == 2)
-      pc = settings.preview_channel + 4;
-
-    if (settings.colour_mode == MODE_YCBCR) {
-      ycbcr2srgb(fimg, width * height, pc);
-    } else if (settings.colour_mode == MODE_LAB) {
-      lab2srgb(fimg, width * height, pc);
-    } else if (settings.colour_mode == MODE_RGB) {
-      rgb2srgb(fimg, width * height, pc);
-    }
-  }
-
-  /* if alpha channel preview */
-  if (preview && channels % 2 == 0 && settings.preview_channel == channels - 1 && settings.preview_mode != 0)
-    for (c = 0; c < channels - 1; c++) {
-      for (i = 0; i < width * height; i++) {
-        fimg[c][i] = fimg[channels - 1][i];
-      }
-    }
-
-  /* set alpha to full opacity in preview mode */
-  if (preview && channels % 2 == 0 && !(settings.preview_channel == channels - 1 && settings.preview_mode == 0))
-    for (i = 0; i < width * height; i++)
-      fimg[channels - 1][i] = 1.0;
-
-  /* clip the values */
-  for (c = 0; c < channels; c++)
+  /* retransform the preview, showing the selected channels. The image
+   * is retransformed, clipped and rounded by store_row as it is written */
+  if (preview)
     {
-      for (i = 0; i < width * height; i++)
-	{
-	  fimg[c][i] = CLIP (fimg[c][i] * 255.0, 0, 255);
+      if (settings.preview_mode == 1)
+	convert_back (width * height, settings.preview_channel + 1);
+      else if (settings.preview_mode == 2)
+	convert_back (width * height, settings.preview_channel + 4);
+      else
+	convert_back (width * height, 0);
+
+      /* if alpha channel preview */
+      if (channels % 2 == 0 && settings.preview_channel == channels - 1 && settings.preview_mode != 0)
+	for (c = 0; c < channels - 1; c++) {
+	  for (i = 0; i < width * height; i++) {
+	    fimg[c][i] = fimg[channels - 1][i];
+	  }
 	}
-    }
 
-  /* write the image back to GIMP */
-  times[2] = g_timer_elapsed (timer, NULL);
-  for (i = 0; i < height; i++)
-    {
-      if (!preview)
-	gimp_progress_update ((settings.times[0] + channels_denoised
-			       * settings.times[1] + settings.times[2]
-			       * i / (double) height) / totaltime);
+      /* set alpha to full opacity in preview mode */
+      if (channels % 2 == 0 && !(settings.preview_channel == channels - 1 && settings.preview_mode == 0))
+	for (i = 0; i < width * height; i++)
+	  fimg[channels - 1][i] = 1.0;
 
-      /* scale and convert back to guchar */
+      /* clip the values */
       for (c = 0; c < channels; c++)
 	{
-	  for (x = 0; x < width; x++)
+	  for (i = 0; i < width * height; i++)
 	    {
-	      /* avoiding rounding errors !!! */
-	      line[x * channels + c] =
-		(guchar) (fimg[c][i * width + x] + 0.5);
+	      fimg[c][i] = CLIP (fimg[c][i] * 255.0, 0, 255);
 	    }
 	}
-      gimp_pixel_rgn_set_row (&rgn_out, line, x1, i + y1, width);
     }
+
+  /* write the image back to GIMP */
+  times[2] = g_timer_elapsed (timer, NULL);
+  write_image (drawable, &rgn_out, x1, y1, width, height, 0, width,
+	       preview != NULL, (settings.times[0] + channels_denoised
+				 * settings.times[1]) / totaltime,
+	       preview ? 0.0 : settings.times[2] / totaltime);
   times[2] = g_timer_elapsed (timer, NULL) - times[2];
 
   if (!preview)
@@ -197,7 +528,8 @@ denoise (GimpDrawable * drawable, GimpPreview * preview)
     }
 
   /* FIXME: replace by gimp functions */
-  free (line);
+  for (c = 0; c < channels; c++)
+    free (fimg[c]);
 
   if (preview)
     {
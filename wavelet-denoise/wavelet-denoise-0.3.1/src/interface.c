@@ -418,6 +418,7 @@ user_interface (GimpDrawable * drawable)
 
   /* FIXME: destroy all widgets - memory leak! */
   gtk_widget_destroy (dialog);
+  preview_cache_clear ();
 
   return run;
 }
@@ -72,7 +72,6 @@ run (const gchar * name, gint nparams, const GimpParam * param,
   static GimpParam values[1];
   GimpRunMode run_mode;
   GimpDrawable *drawable;
-  gint i;
 
   bindtextdomain("gimp20-wavelet-denoise-plug-in", LOCALEDIR);
   textdomain("gimp20-wavelet-denoise-plug-in");
@@ -95,18 +94,6 @@ run (const gchar * name, gint nparams, const GimpParam * param,
   if (settings.preview_channel > channels - 1)
     settings.preview_channel = 0;
 
-  /* allocate buffers */
-  /* FIXME: replace by GIMP funcitons */
-  for (i = 0; i < channels; i++)
-    {
-      fimg[i] = (float *) malloc (drawable->width * drawable->height
-				  * sizeof (float));
-    }
-  buffer[1] = (float *) malloc (drawable->width * drawable->height
-				* sizeof (float));
-  buffer[2] = (float *) malloc (drawable->width * drawable->height
-				* sizeof (float));
-
   /* run GUI if in interactiv mode */
   run_mode = param[0].data.d_int32;
   if (run_mode == GIMP_RUN_INTERACTIVE)
@@ -121,15 +108,6 @@ run (const gchar * name, gint nparams, const GimpParam * param,
 
   denoise (drawable, NULL);
 
-  /* free buffers */
-  /* FIXME: replace by GIMP functions */
-  for (i = 0; i < channels; i++)
-    {
-      free (fimg[i]);
-    }
-  free (buffer[1]);
-  free (buffer[2]);
-
   gimp_displays_flush ();
   gimp_drawable_detach (drawable);
 
@@ -17,6 +17,7 @@
 #define __PLUGIN_H__
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
@@ -29,25 +30,32 @@
 #define N_(str) gettext_noop(str)
 
 #include "messages.h"
-
-#define MAX2(x,y) ((x) > (y) ? (x) : (y))
-#define MIN2(x,y) ((x) < (y) ? (x) : (y))
-#define CLIP(x,min,max) MAX2((min), MIN2((x), (max)))
+#include "wavelet.h"
 
 #define TIMER_READ (1.0 / 10)
 #define TIMER_WRITE (1.0 / 7)
 #define TIMER_PROCESS (1.0 - TIMER_READ - TIMER_WRITE)
 
-#define MODE_YCBCR 0
-#define MODE_RGB 1
-#define MODE_LAB 2
+/* images larger than this are denoised in tiles of TILE_SIZE squared,
+ * each read with an apron covering the support of the 5 level transform
+ * (1 + 2 + 4 + 8 + 16 pixels), so memory does not grow with the image */
+#define TILED_MIN_PIXELS (4096 * 4096)
+#define TILE_SIZE 1024
+#define TILE_APRON 32
+/* the noise of a tiled image is profiled from about this many tiles,
+ * spread over the image, rather than from all of them */
+#define TILED_NOISE_TILES 8
+
+/* define TRUE for 16 bit fixed point scratch planes in the wavelet
+ * transforms: a third less working memory, but the result may differ from
+ * the float one by a level where the low pass falls on an intensity bucket
+ * limit (see WAVELET_SCRATCH_SIZE) */
+#define COMPACT_SCRATCH FALSE
 
 void query (void);
 void run (const gchar * name, gint nparams, const GimpParam * param,
 		 gint * nreturn_vals, GimpParam ** return_vals);
-void wavelet_denoise (float *fimg[3], unsigned int width,
-			     unsigned int height, float threshold, double low,
-			     float a, float b);
+void preview_cache_clear (void);
 void denoise (GimpDrawable * drawable, GimpPreview * preview);
 void set_rgb_mode (GtkWidget * w, gpointer data);
 void set_lab_mode (GtkWidget * w, gpointer data);
@@ -61,15 +69,6 @@ void reset_channel (GtkWidget * w, gpointer data);
 void reset_all (GtkWidget * w, gpointer data);
 void temporarily_reset (GtkWidget * w, gpointer data);
 
-void srgb2rgb (float **fimg, int size);
-void rgb2srgb (float **fimg, int size, int pc);
-void srgb2ycbcr (float **fimg, int size);
-void ycbcr2srgb (float **fimg, int size, int pc);
-void srgb2lab (float **fimg, int size);
-void lab2srgb (float **fimg, int size, int pc);
-void srgb2xyz (float **fimg, int size);
-void xyz2srgb (float **fimg, int size, int pc);
-
 extern GimpPlugInInfo PLUG_IN_INFO;
 
 typedef struct
@@ -94,7 +93,6 @@ extern char *names_gray[];
 extern char *names_lab[];
 
 float *fimg[4];
-float *buffer[3];
 gint channels;
 
 GTimer *timer;
@@ -15,136 +15,688 @@
  * compile with gimptool, eg. 'gimptool-2.0 --install wavelet-denoise.c'
  */
 
-#include "plugin.h"
+#include "wavelet.h"
 
-/* code copied from UFRaw (which originates from dcraw) */
+/* code copied from UFRaw (which originates from dcraw), for st == 1 and
+ * in place: one row of the image */
 static void
-hat_transform (float *temp, float *base, int st, int size, int sc)
+hat_transform_row (float *temp, float *base, int size, int sc)
 {
   int i;
   for (i = 0; i < sc; i++)
-    temp[i] = 2 * base[st * i] + base[st * (sc - i)] + base[st * (i + sc)];
+    temp[i] = 2 * base[i] + base[sc - i] + base[i + sc];
   for (; i + sc < size; i++)
-    temp[i] = 2 * base[st * i] + base[st * (i - sc)] + base[st * (i + sc)];
+    temp[i] = 2 * base[i] + base[i - sc] + base[i + sc];
   for (; i < size; i++)
-    temp[i] = 2 * base[st * i] + base[st * (i - sc)]
-      + base[st * (2 * size - 2 - (i + sc))];
+    temp[i] = 2 * base[i] + base[i - sc] + base[2 * size - 2 - (i + sc)];
+  for (i = 0; i < size; i++)
+    base[i] = temp[i] * 0.25f;
 }
 
-/* actual denoising algorithm. code copied from UFRaw (originates from dcraw) */
-void
-wavelet_denoise (float *fimg[3], unsigned int width,
-		 unsigned int height, float threshold, double low, float a,
-		 float b)
+/* the same transform down the columns, for one row of the result. Walking
+ * a column at a time with stride width misses the cache for every pixel;
+ * instead each result row is the sum of three whole rows of the input, so
+ * all columns are done at once in a contiguous (vectorizable) loop */
+static void
+hat_transform_cols (float *dest, float *base, int width, int height,
+		    int sc, int row)
 {
-  float *temp, thold;
-  unsigned int i, lev, lpass, hpass, size, col, row;
-  double stdev[5];
-  unsigned int samples[5];
+  float *above, *here, *below;
+  int col;
 
-  size = width * height;
+  if (row < sc)
+    above = base + (sc - row) * width;
+  else
+    above = base + (row - sc) * width;
+  if (row + sc < height)
+    below = base + (row + sc) * width;
+  else
+    below = base + (2 * height - 2 - (row + sc)) * width;
+  here = base + row * width;
 
-  /* FIXME: replace by GIMP functions */
-  temp = (float *) malloc (MAX2 (width, height) * sizeof (float));
+  for (col = 0; col < width; col++)
+    dest[col] = (2 * here[col] + above[col] + below[col]) * 0.25f;
+}
 
-  hpass = 0;
-  for (lev = 0; lev < 5; lev++)
+/* A compact plane holds 16 bit fixed point instead of float, for half the
+ * memory and traffic. It has COMPACT_ONE steps per unit with 0 at
+ * COMPACT_ZERO, so it covers -2 to 2 in steps of 1/64 of an 8 bit level.
+ * The low pass of the levels lies within the range of the image, as it is
+ * a weighted mean of it. */
+#define COMPACT_ONE 16384
+#define COMPACT_ZERO 32768
+
+static inline guint16
+compact_value (float v)
+{
+  v = v * COMPACT_ONE + (COMPACT_ZERO + 0.5f);
+  return (guint16) CLIP (v, 0.0f, 65535.0f);
+}
+
+static inline float
+float_value (guint16 q)
+{
+  return q * (1.0f / COMPACT_ONE) - (float) COMPACT_ZERO / COMPACT_ONE;
+}
+
+/* store a row in a compact plane, leaving in row the value it stores */
+static void
+pack_row (guint16 * dest, float *row, int size)
+{
+  int i;
+
+  for (i = 0; i < size; i++)
     {
-      if (b != 0)
-	gimp_progress_update (a + b * lev / 5.0);
-      lpass = ((lev & 1) + 1);
-      for (row = 0; row < height; row++)
+      dest[i] = compact_value (row[i]);
+      row[i] = float_value (dest[i]);
+    }
+}
+
+static void
+unpack_row (float *dest, guint16 * row, int size)
+{
+  int i;
+
+  for (i = 0; i < size; i++)
+    dest[i] = float_value (row[i]);
+}
+
+/* hat_transform_cols of a compact plane. The weighted sum of the fixed
+ * point values is exact in integers, so only the result is converted */
+static void
+hat_transform_cols16 (float *dest, guint16 * base, int width, int height,
+		      int sc, int row)
+{
+  guint16 *above, *here, *below;
+  int col;
+
+  if (row < sc)
+    above = base + (sc - row) * width;
+  else
+    above = base + (row - sc) * width;
+  if (row + sc < height)
+    below = base + (row + sc) * width;
+  else
+    below = base + (2 * height - 2 - (row + sc)) * width;
+  here = base + row * width;
+
+  for (col = 0; col < width; col++)
+    dest[col] = (2 * here[col] + above[col] + below[col])
+      * (0.25f / COMPACT_ONE) - (float) COMPACT_ZERO / COMPACT_ONE;
+}
+
+/* a piece of work split in bands of rows, one per thread */
+typedef struct
+{
+  void (*func) (gpointer data, int band, int row_begin, int row_end);
+  gpointer data;
+  int band, row_begin, row_end;
+} band_job;
+
+static gpointer
+run_band (gpointer data)
+{
+  band_job *job = (band_job *) data;
+
+  job->func (job->data, job->band, job->row_begin, job->row_end);
+  return NULL;
+}
+
+/* number of bands: as many as threads asked for, but at least one and not
+ * more than rows */
+static int
+band_count (int nthreads, int height)
+{
+  return CLIP (nthreads, 1, MIN2 (MAX_THREADS, height));
+}
+
+/* call func on nthreads bands of the height rows, each on its own thread */
+static void
+for_bands (void (*func) (gpointer, int, int, int), gpointer data,
+	   int height, int nthreads)
+{
+  band_job jobs[MAX_THREADS];
+  GThread *threads[MAX_THREADS];
+  int t;
+
+  for (t = 0; t < nthreads; t++)
+    {
+      jobs[t].func = func;
+      jobs[t].data = data;
+      jobs[t].band = t;
+      jobs[t].row_begin = height * t / nthreads;
+      jobs[t].row_end = height * (t + 1) / nthreads;
+    }
+
+  /* the first band is done by this thread */
+  for (t = 1; t < nthreads; t++)
+    {
+      threads[t] = g_thread_try_new (NULL, run_band, &jobs[t], NULL);
+      /* no thread, so do the band here */
+      if (!threads[t])
+	run_band (&jobs[t]);
+    }
+  run_band (&jobs[0]);
+  for (t = 1; t < nthreads; t++)
+    if (threads[t])
+      g_thread_join (threads[t]);
+}
+
+/* which of the 5 intensity ranges the noise is profiled in, without
+ * branches. Each limit is the nearest float to 0.2, 0.4, 0.6 and 0.8,
+ * which lies just above it, so >= is the same as > in double */
+static inline int
+intensity_bucket (float lowpass)
+{
+  return (lowpass >= 0.2f) + (lowpass >= 0.4f) + (lowpass >= 0.6f)
+    + (lowpass >= 0.8f);
+}
+
+/* detail smaller than this is taken as noise at level lev */
+static float
+noise_limit (unsigned int lev)
+{
+  return 5.0 / (1 << 6) * exp (-2.6 * sqrt (lev + 1)) * 0.8002 / exp (-2.6);
+}
+
+/* add the noise in the detail hpass - lowpass of a row to the sums for all
+ * intensities. If not NULL, the detail and the intensity bucket of each
+ * pixel are kept in detail and bucket */
+static void
+level_sums (float *hpass, float *lowpass, float *detail, guchar * bucket,
+	    int size, float thold, double sums[5], unsigned int samples[5])
+{
+  double row_sums[5] = { 0, 0, 0, 0, 0 };
+  unsigned int row_samples[5] = { 0, 0, 0, 0, 0 };
+  float d;
+  int i, k;
+
+  if (detail)
+    for (i = 0; i < size; i++)
+      {
+	detail[i] = hpass[i] - lowpass[i];
+	bucket[i] = intensity_bucket (lowpass[i]);
+      }
+
+  for (i = 0; i < size; i++)
+    {
+      d = hpass[i] - lowpass[i];
+      if (d < thold && d > -thold)
 	{
-	  hat_transform (temp, fimg[hpass] + row * width, 1, width, 1 << lev);
-	  for (col = 0; col < width; col++)
-	    {
-	      fimg[lpass][row * width + col] = temp[col] * 0.25;
-	    }
+	  k = intensity_bucket (lowpass[i]);
+	  row_sums[k] += d * d;
+	  row_samples[k]++;
 	}
-      if (b != 0)
-	gimp_progress_update (a + b * (lev + 0.25) / 5.0);
-      for (col = 0; col < width; col++)
+    }
+  for (k = 0; k < 5; k++)
+    {
+      sums[k] += row_sums[k];
+      samples[k] += row_samples[k];
+    }
+}
+
+/* the stdev of the noise of a level for all intensities */
+static void
+noise_stdev (double sums[5], unsigned int samples[5], double stdev[5])
+{
+  int k;
+
+  for (k = 0; k < 5; k++)
+    stdev[k] = sqrt (sums[k] / (samples[k] + 1));
+}
+
+/* the noise of a level, gathered by hat_transform */
+typedef struct
+{
+  int x0, y0, x1, y1;		/* over these pixels */
+  float *detail;		/* if not NULL, keep the detail here */
+  guchar *bucket;		/* if not NULL, keep the buckets here */
+  double *sums;			/* added to, per intensity */
+  unsigned int *samples;
+} level_noise;
+
+/* the planes of a transform are float, or compact if dest16 or base16 is
+ * given instead */
+typedef struct
+{
+  float *dest, *base, *temp;
+  guint16 *dest16, *base16;
+  int width, height, sc;
+  level_noise *noise;
+  float thold;
+  double sums[MAX_THREADS][5];
+  unsigned int samples[MAX_THREADS][5];
+} hat_context;
+
+/* both passes over a band of rows. The column pass of a row reads only
+ * base, so the row pass can follow at once, and bands need no syncing.
+ * The noise of a row is gathered while the row is still in the cache.
+ * temp holds three rows for each thread: for the row pass, and for the
+ * low and high pass of a compact row */
+static void
+hat_transform_band (gpointer data, int band, int row_begin, int row_end)
+{
+  hat_context *hat = (hat_context *) data;
+  level_noise *noise = hat->noise;
+  int width = hat->width;
+  float *temp = hat->temp + 3 * band * width;
+  float *lowpass, *hpass;
+  int row, offset;
+
+  memset (hat->sums[band], 0, sizeof (hat->sums[band]));
+  memset (hat->samples[band], 0, sizeof (hat->samples[band]));
+  for (row = row_begin; row < row_end; row++)
+    {
+      lowpass = hat->dest16 ? temp + width : hat->dest + row * width;
+      if (hat->base16)
+	hat_transform_cols16 (lowpass, hat->base16, width, hat->height,
+			      hat->sc, row);
+      else
+	hat_transform_cols (lowpass, hat->base, width, hat->height, hat->sc,
+			    row);
+      hat_transform_row (temp, lowpass, width, hat->sc);
+      if (hat->dest16)
+	pack_row (hat->dest16 + row * width, lowpass, width);
+
+      if (noise && row >= noise->y0 && row < noise->y1)
 	{
-	  hat_transform (temp, fimg[lpass] + col, width, height, 1 << lev);
-	  for (row = 0; row < height; row++)
+	  offset = row * width + noise->x0;
+	  if (hat->base16)
 	    {
-	      fimg[lpass][row * width + col] = temp[row] * 0.25;
+	      hpass = temp + 2 * width;
+	      unpack_row (hpass, hat->base16 + offset, noise->x1 - noise->x0);
 	    }
+	  else
+	    hpass = hat->base + offset;
+	  level_sums (hpass, lowpass + noise->x0,
+		      noise->detail ? noise->detail + offset : NULL,
+		      noise->bucket ? noise->bucket + offset : NULL,
+		      noise->x1 - noise->x0, hat->thold, hat->sums[band],
+		      hat->samples[band]);
 	}
-      if (b != 0)
-	gimp_progress_update (a + b * (lev + 0.5) / 5.0);
+    }
+}
 
-      thold =
-	5.0 / (1 << 6) * exp (-2.6 * sqrt (lev + 1)) * 0.8002 / exp (-2.6);
+/* the separable a trous transform of level lev of base into dest, on
+ * nthreads threads, adding the noise to noise if not NULL. Either plane
+ * is compact if given as base16 or dest16 instead. temp holds three rows
+ * for each thread */
+static void
+hat_transform (float *dest, guint16 * dest16, float *base, guint16 * base16,
+	       float *temp, int width, int height, unsigned int lev,
+	       level_noise * noise, int nthreads)
+{
+  hat_context hat;
+  int t, k;
 
-      /* initialize stdev values for all intensities */
-      stdev[0] = stdev[1] = stdev[2] = stdev[3] = stdev[4] = 0.0;
-      samples[0] = samples[1] = samples[2] = samples[3] = samples[4] = 0;
+  hat.dest = dest;
+  hat.dest16 = dest16;
+  hat.base = base;
+  hat.base16 = base16;
+  hat.temp = temp;
+  hat.width = width;
+  hat.height = height;
+  hat.sc = 1 << lev;
+  hat.noise = noise;
+  hat.thold = noise_limit (lev);
+  for_bands (hat_transform_band, &hat, height, nthreads);
 
-      /* calculate stdevs for all intensities */
-      for (i = 0; i < size; i++)
+  if (noise)
+    for (t = 0; t < nthreads; t++)
+      for (k = 0; k < 5; k++)
 	{
-	  fimg[hpass][i] -= fimg[lpass][i];
-	  if (fimg[hpass][i] < thold && fimg[hpass][i] > -thold)
-	    {
-	      if (fimg[lpass][i] > 0.8) {
-	        stdev[4] += fimg[hpass][i] * fimg[hpass][i];
-	        samples[4]++;
-	      } else if (fimg[lpass][i] > 0.6) {
-	        stdev[3] += fimg[hpass][i] * fimg[hpass][i];
-	        samples[3]++;
-	      }	else if (fimg[lpass][i] > 0.4) {
-	        stdev[2] += fimg[hpass][i] * fimg[hpass][i];
-	        samples[2]++;
-	      }	else if (fimg[lpass][i] > 0.2) {
-	        stdev[1] += fimg[hpass][i] * fimg[hpass][i];
-	        samples[1]++;
-	      } else {
-	        stdev[0] += fimg[hpass][i] * fimg[hpass][i];
-	        samples[0]++;
-	      }
-	    }
+	  noise->sums[k] += hat.sums[t][k];
+	  noise->samples[k] += hat.samples[t][k];
 	}
-      stdev[0] = sqrt (stdev[0] / (samples[0] + 1));
-      stdev[1] = sqrt (stdev[1] / (samples[1] + 1));
-      stdev[2] = sqrt (stdev[2] / (samples[2] + 1));
-      stdev[3] = sqrt (stdev[3] / (samples[3] + 1));
-      stdev[4] = sqrt (stdev[4] / (samples[4] + 1));
+}
+
+/* soft thresholding of a level, added to dest */
+#define THRESHOLD_SPAN 1024
+
+typedef struct
+{
+  float *hpass, *lowpass;	/* the detail is hpass - lowpass, or */
+  guint16 *hpass16, *lowpass16;	/* the same of compact planes, or */
+  float *detail;		/* the detail and */
+  guchar *bucket;		/* the intensity buckets, if not NULL */
+  float *dest;
+  float *residual;		/* if not NULL, also added to dest */
+  gboolean add_lowpass;		/* or else the low pass, if set */
+  gboolean accumulate;		/* add to dest, rather than set it */
+  int width;
+  float thold[5], shrink[5], low;
+} threshold_context;
 
-      if (b != 0)
-	gimp_progress_update (a + b * (lev + 0.75) / 5.0);
+/* d + shrink below -t, d - shrink above t and d * low between, without
+ * branches */
+static inline float
+soft_threshold (float d, float t, float shrink, float low)
+{
+  int inside = (d >= -t) & (d <= t);
 
-      /* do thresholding */
+  shrink = d < -t ? shrink : -shrink;
+  return d * (inside ? low : 1.0f) + (inside ? 0.0f : shrink);
+}
+
+/* the thresholded detail of size pixels into value, from the detail at
+ * offset or from the spans hpass and lowpass. The threshold of the
+ * intensity is selected, not indexed, so the loops can be vectorized */
+static void
+threshold_span (threshold_context * th, int offset, int size, float *hpass,
+		float *lowpass, float *value)
+{
+  float t0 = th->thold[0], t1 = th->thold[1], t2 = th->thold[2];
+  float t3 = th->thold[3], t4 = th->thold[4];
+  float s0 = th->shrink[0], s1 = th->shrink[1], s2 = th->shrink[2];
+  float s3 = th->shrink[3], s4 = th->shrink[4];
+  float low = th->low, t, shrink, l;
+  float *detail;
+  guchar *bucket;
+  int i, k;
+
+  if (th->detail)
+    {
+      detail = th->detail + offset;
+      bucket = th->bucket + offset;
       for (i = 0; i < size; i++)
 	{
-	  if (fimg[lpass][i] > 0.8) {
-	    thold = threshold * stdev[4];
-	  } else if (fimg[lpass][i] > 0.6) {
-	    thold = threshold * stdev[3];
-	  } else if (fimg[lpass][i] > 0.4) {
-	    thold = threshold * stdev[2];
-	  } else if (fimg[lpass][i] > 0.2) {
-	    thold = threshold * stdev[1];
-	  } else {
-	    thold = threshold * stdev[0];
-	  }
-
-	  if (fimg[hpass][i] < -thold)
-	    fimg[hpass][i] += thold - thold * low;
-	  else if (fimg[hpass][i] > thold)
-	    fimg[hpass][i] -= thold - thold * low;
-	  else
-	    fimg[hpass][i] *= low;
+	  k = bucket[i];
+	  t = k == 4 ? t4 : k == 3 ? t3 : k == 2 ? t2 : k == 1 ? t1 : t0;
+	  shrink = k == 4 ? s4 : k == 3 ? s3 : k == 2 ? s2
+	    : k == 1 ? s1 : s0;
+	  value[i] = soft_threshold (detail[i], t, shrink, low);
+	}
+    }
+  else
+    for (i = 0; i < size; i++)
+      {
+	l = lowpass[i];
+	t = l >= 0.8f ? t4 : l >= 0.6f ? t3 : l >= 0.4f ? t2
+	  : l >= 0.2f ? t1 : t0;
+	shrink = l >= 0.8f ? s4 : l >= 0.6f ? s3 : l >= 0.4f ? s2
+	  : l >= 0.2f ? s1 : s0;
+	value[i] = soft_threshold (hpass[i] - l, t, shrink, low);
+      }
+}
+
+/* threshold the rows of a band a span at a time, small enough for the
+ * values to stay in the cache until they are added to dest. Spans of
+ * compact planes are unpacked first */
+static void
+threshold_band (gpointer data, int band, int row_begin, int row_end)
+{
+  threshold_context *th = (threshold_context *) data;
+  float value[THRESHOLD_SPAN], high[THRESHOLD_SPAN], low[THRESHOLD_SPAN];
+  float *dest, *residual, *hpass = NULL, *lowpass = NULL;
+  int i, j, size, end = row_end * th->width;
+
+  for (i = row_begin * th->width; i < end; i += size)
+    {
+      size = MIN (THRESHOLD_SPAN, end - i);
+      if (th->hpass16)
+	unpack_row (hpass = high, th->hpass16 + i, size);
+      else if (th->hpass)
+	hpass = th->hpass + i;
+      if (th->lowpass16)
+	unpack_row (lowpass = low, th->lowpass16 + i, size);
+      else if (th->lowpass)
+	lowpass = th->lowpass + i;
+      threshold_span (th, i, size, hpass, lowpass, value);
+
+      dest = th->dest + i;
+      residual = th->add_lowpass ? lowpass
+	: th->residual ? th->residual + i : NULL;
+      if (!th->accumulate)
+	for (j = 0; j < size; j++)
+	  dest[j] = value[j];
+      else if (!residual)
+	for (j = 0; j < size; j++)
+	  dest[j] += value[j];
+      else
+	for (j = 0; j < size; j++)
+	  dest[j] = dest[j] + value[j] + residual[j];
+    }
+}
+
+/* threshold a level in a single pass, in bands of rows on nthreads
+ * threads */
+static void
+threshold_level (threshold_context * th, float threshold, double low,
+		 double stdev[5], int height, int nthreads)
+{
+  int k;
+
+  for (k = 0; k < 5; k++)
+    {
+      th->thold[k] = threshold * stdev[k];
+      th->shrink[k] = th->thold[k] - th->thold[k] * low;
+    }
+  th->low = low;
+  for_bands (threshold_band, th, height, nthreads);
+}
+
+/* fimg as float planes, and as compact planes for the scratch planes if
+ * compact */
+static void
+split_planes (float *fimg[3], gboolean compact, float *planes[3],
+	      guint16 * planes16[3])
+{
+  int c;
+
+  planes[0] = fimg[0];
+  planes16[0] = NULL;
+  for (c = 1; c < 3; c++)
+    {
+      planes[c] = compact ? NULL : fimg[c];
+      planes16[c] = compact ? (guint16 *) fimg[c] : NULL;
+    }
+}
+
+/* actual denoising algorithm. code copied from UFRaw (originates from dcraw)
+ * the noise is profiled from fimg[0], unless it is given in noise (see
+ * wavelet_noise_sums). Each level takes the transform, which also gathers
+ * the noise, and one pass to threshold the detail and add it up. The
+ * work is split on nthreads threads. The fraction done is reported to
+ * progress, if not NULL */
+void
+wavelet_denoise (float *fimg[3], unsigned int width,
+		 unsigned int height, float threshold, double low,
+		 double noise[5][5], int nthreads, gboolean compact,
+		 wavelet_progress progress, gpointer data)
+{
+  float *temp, *planes[3];
+  guint16 *planes16[3];
+  unsigned int lev, lpass, hpass;
+  double stdev[5], sums[5];
+  unsigned int samples[5];
+  level_noise level = { 0, 0, width, height, NULL, NULL, sums, samples };
+  threshold_context th;
+
+  nthreads = band_count (nthreads, height);
+  split_planes (fimg, compact, planes, planes16);
+
+  /* FIXME: replace by GIMP functions */
+  temp = (float *) malloc (3 * nthreads * width * sizeof (float));
 
-	  if (hpass)
-	    fimg[0][i] += fimg[hpass][i];
+  hpass = 0;
+  for (lev = 0; lev < 5; lev++)
+    {
+      if (progress)
+	progress (lev / 5.0, data);
+      lpass = ((lev & 1) + 1);
+      if (noise)
+	{
+	  hat_transform (planes[lpass], planes16[lpass], planes[hpass],
+			 planes16[hpass], temp, width, height, lev, NULL,
+			 nthreads);
+	  memcpy (stdev, noise[lev], sizeof (stdev));
+	}
+      else
+	{
+	  memset (sums, 0, sizeof (sums));
+	  memset (samples, 0, sizeof (samples));
+	  hat_transform (planes[lpass], planes16[lpass], planes[hpass],
+			 planes16[hpass], temp, width, height, lev, &level,
+			 nthreads);
+	  noise_stdev (sums, samples, stdev);
 	}
+
+      if (progress)
+	progress ((lev + 0.5) / 5.0, data);
+
+      /* do thresholding, and add the residual after the last level */
+      th.hpass = planes[hpass];
+      th.hpass16 = planes16[hpass];
+      th.lowpass = planes[lpass];
+      th.lowpass16 = planes16[lpass];
+      th.detail = NULL;
+      th.bucket = NULL;
+      th.dest = fimg[0];
+      th.residual = NULL;
+      th.add_lowpass = lev == 4;
+      th.accumulate = hpass != 0;
+      th.width = width;
+      threshold_level (&th, threshold, low, stdev, height, nthreads);
       hpass = lpass;
     }
 
-  for (i = 0; i < size; i++)
-    fimg[0][i] = fimg[0][i] + fimg[lpass][i];
+  /* FIXME: replace by GIMP functions */
+  free (temp);
+
+  if (progress)
+    progress (1.0, data);
+}
+
+/* add the noise of the pixels in columns x0 to x1 and rows y0 to y1 of
+ * fimg[0] to sums and samples, per level and intensity. For a plane too
+ * large to transform at once: sum over the interiors of overlapping tiles,
+ * then take wavelet_noise_stdev for wavelet_denoise. fimg[1] and fimg[2]
+ * are scratch, compact or not as for wavelet_denoise */
+void
+wavelet_noise_sums (float *fimg[3], unsigned int width, unsigned int height,
+		    unsigned int x0, unsigned int y0, unsigned int x1,
+		    unsigned int y1, double sums[5][5],
+		    unsigned int samples[5][5], int nthreads,
+		    gboolean compact)
+{
+  float *temp, *planes[3];
+  guint16 *planes16[3];
+  unsigned int lev, lpass, hpass;
+  level_noise level = { x0, y0, x1, y1, NULL, NULL, NULL, NULL };
+
+  nthreads = band_count (nthreads, height);
+  split_planes (fimg, compact, planes, planes16);
+
+  /* FIXME: replace by GIMP functions */
+  temp = (float *) malloc (3 * nthreads * width * sizeof (float));
+
+  hpass = 0;
+  for (lev = 0; lev < 5; lev++)
+    {
+      lpass = ((lev & 1) + 1);
+      level.sums = sums[lev];
+      level.samples = samples[lev];
+      hat_transform (planes[lpass], planes16[lpass], planes[hpass],
+		     planes16[hpass], temp, width, height, lev, &level,
+		     nthreads);
+      hpass = lpass;
+    }
+
+  free (temp);
+}
+
+void
+wavelet_noise_stdev (double sums[5][5], unsigned int samples[5][5],
+		     double noise[5][5])
+{
+  int lev;
+
+  for (lev = 0; lev < 5; lev++)
+    noise_stdev (sums[lev], samples[lev], noise[lev]);
+}
+
+/* the forward half of wavelet_denoise: the detail and the noise of every
+ * level of plane, which is left as it is. Keep it to denoise the same
+ * plane with other thresholds by wavelet_reconstruct */
+void
+wavelet_decompose (wavelet_decomposition * dec, float *plane,
+		   unsigned int width, unsigned int height, int nthreads)
+{
+  float *temp, *hpass, *lpass;
+  unsigned int lev, size;
+  double sums[5];
+  unsigned int samples[5];
+  level_noise level = { 0, 0, width, height, NULL, NULL, sums, samples };
+
+  size = width * height;
+  nthreads = band_count (nthreads, height);
+  dec->width = width;
+  dec->height = height;
 
   /* FIXME: replace by GIMP functions */
+  temp = (float *) malloc (3 * nthreads * width * sizeof (float));
+
+  hpass = plane;
+  for (lev = 0; lev < 5; lev++)
+    {
+      lpass = (float *) malloc (size * sizeof (float));
+      dec->detail[lev] = (float *) malloc (size * sizeof (float));
+      dec->bucket[lev] = (guchar *) malloc (size);
+      level.detail = dec->detail[lev];
+      level.bucket = dec->bucket[lev];
+      memset (sums, 0, sizeof (sums));
+      memset (samples, 0, sizeof (samples));
+      hat_transform (lpass, NULL, hpass, NULL, temp, width, height, lev,
+		     &level, nthreads);
+      noise_stdev (sums, samples, dec->stdev[lev]);
+      if (hpass != plane)
+	free (hpass);
+      hpass = lpass;
+    }
+  dec->lowpass = hpass;
+
   free (temp);
 }
+
+/* the backward half of wavelet_denoise: denoise the decomposed plane
+ * into plane */
+void
+wavelet_reconstruct (wavelet_decomposition * dec, float *plane,
+		     float threshold, double low, int nthreads)
+{
+  unsigned int lev;
+  threshold_context th;
+
+  nthreads = band_count (nthreads, dec->height);
+  for (lev = 0; lev < 5; lev++)
+    {
+      th.hpass = NULL;
+      th.hpass16 = NULL;
+      th.lowpass = NULL;
+      th.lowpass16 = NULL;
+      th.detail = dec->detail[lev];
+      th.bucket = dec->bucket[lev];
+      th.dest = plane;
+      th.residual = lev == 4 ? dec->lowpass : NULL;
+      th.add_lowpass = FALSE;
+      th.accumulate = lev != 0;
+      th.width = dec->width;
+      threshold_level (&th, threshold, low, dec->stdev[lev], dec->height,
+		       nthreads);
+    }
+}
+
+void
+wavelet_decomposition_free (wavelet_decomposition * dec)
+{
+  unsigned int lev;
+
+  /* FIXME: replace by GIMP functions */
+  for (lev = 0; lev < 5; lev++)
+    {
+      free (dec->detail[lev]);
+      free (dec->bucket[lev]);
+    }
+  free (dec->lowpass);
+  dec->lowpass = NULL;
+}
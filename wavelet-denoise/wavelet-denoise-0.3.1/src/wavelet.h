@@ -0,0 +1,92 @@
+/* 
+ * Wavelet denoise GIMP plugin
+ * 
+ * wavelet.h
+ * Copyright 2008 by Marco Rossini
+ * 
+ * Implements the wavelet denoise code of UFRaw by Udi Fuchs
+ * which itself bases on the code by Dave Coffin
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ * 
+ */
+
+/* The denoiser itself (wavelet.c) and the colour model conversions
+ * (colorspace.c). They need glib but not GIMP, so the plugin, the batch
+ * program and the benchmark all link them as libwavelet-denoise.a. */
+
+#ifndef __WAVELET_H__
+#define __WAVELET_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#define MAX2(x,y) ((x) > (y) ? (x) : (y))
+#define MIN2(x,y) ((x) < (y) ? (x) : (y))
+#define CLIP(x,min,max) MAX2((min), MIN2((x), (max)))
+
+/* upper limit of threads sharing the wavelet transform */
+#define MAX_THREADS 16
+
+#define MODE_YCBCR 0
+#define MODE_RGB 1
+#define MODE_LAB 2
+
+/* called by wavelet_denoise with the fraction done, from the thread that
+ * called it */
+typedef void (*wavelet_progress) (float fraction, gpointer data);
+
+/* the wavelet transform of a plane, see wavelet_decompose */
+typedef struct
+{
+  float *detail[5];		/* high pass of each level */
+  guchar *bucket[5];		/* intensity bucket of each pixel per level */
+  float *lowpass;		/* what is left after the last level */
+  double stdev[5][5];		/* noise per level and intensity bucket */
+  unsigned int width, height;
+} wavelet_decomposition;
+
+/* fimg[1] and fimg[2] of wavelet_denoise and wavelet_noise_sums are scratch
+ * for the low pass of the levels. If compact, they hold 16 bit fixed point
+ * instead of float, which takes half the memory and is close enough for 8
+ * bit images (see wavelet-denoise-bench). WAVELET_SCRATCH_SIZE is the
+ * bytes to allocate for each */
+#define WAVELET_SCRATCH_SIZE(width,height,compact) \
+  ((gsize) (width) * (height) * ((compact) ? sizeof (guint16) : sizeof (float)))
+
+void wavelet_denoise (float *fimg[3], unsigned int width,
+		      unsigned int height, float threshold, double low,
+		      double noise[5][5], int nthreads, gboolean compact,
+		      wavelet_progress progress, gpointer data);
+void wavelet_noise_sums (float *fimg[3], unsigned int width,
+			 unsigned int height, unsigned int x0,
+			 unsigned int y0, unsigned int x1, unsigned int y1,
+			 double sums[5][5], unsigned int samples[5][5],
+			 int nthreads, gboolean compact);
+void wavelet_noise_stdev (double sums[5][5], unsigned int samples[5][5],
+			  double noise[5][5]);
+void wavelet_decompose (wavelet_decomposition * dec, float *plane,
+			unsigned int width, unsigned int height,
+			int nthreads);
+void wavelet_reconstruct (wavelet_decomposition * dec, float *plane,
+			  float threshold, double low, int nthreads);
+void wavelet_decomposition_free (wavelet_decomposition * dec);
+
+void load_row (guchar * line, float **fimg, gsize offset, int width,
+	       int channels, int colour_mode);
+void store_row (float **fimg, gsize offset, guchar * line, int width,
+		int channels, int colour_mode);
+void load_row16 (guint16 * line, float **fimg, gsize offset, int width,
+		 int channels, int colour_mode);
+void store_row16 (float **fimg, gsize offset, guint16 * line, int width,
+		  int channels, int colour_mode);
+void rgb2srgb (float **fimg, int size, int pc);
+void ycbcr2srgb (float **fimg, int size, int pc);
+void lab2srgb (float **fimg, int size, int pc);
+void xyz2srgb (float **fimg, int size, int pc);
+
+#endif /* __WAVELET_H__ */